@@ -2,8 +2,51 @@
 QT += quick qml core gui
 CONFIG += c++11
 SOURCES += main.cpp \
-           v4l2camera.cpp
-HEADERS += v4l2camera.h
+           v4l2camera.cpp \
+           yuvkernels.cpp \
+           workerpool.cpp \
+           framepool.cpp \
+           framemailbox.cpp \
+           cameraview.cpp \
+           yuvnode.cpp \
+           palette.cpp \
+           toneadjust.cpp \
+           sharpen.cpp \
+           denoise.cpp \
+           calibration.cpp \
+           agc.cpp \
+           hotspottracker.cpp \
+           framestats.cpp \
+           v4l2source.cpp \
+           replaysource.cpp \
+           boxscale.cpp \
+           rawrecorder.cpp \
+           framehistory.cpp \
+           shmexporter.cpp
+HEADERS += v4l2camera.h \
+           yuvkernels.h \
+           workerpool.h \
+           framepool.h \
+           framemailbox.h \
+           cameraview.h \
+           yuvnode.h \
+           videoframe.h \
+           palette.h \
+           toneadjust.h \
+           sharpen.h \
+           denoise.h \
+           calibration.h \
+           agc.h \
+           hotspottracker.h \
+           framestats.h \
+           framesource.h \
+           v4l2source.h \
+           replaysource.h \
+           boxscale.h \
+           rawrecorder.h \
+           framehistory.h \
+           shmexporter.h \
+           shmframes.h
 RESOURCES += qml.qrc
 TARGET = Owner_simple_menu
 TEMPLATE = app
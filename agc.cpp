@@ -0,0 +1,138 @@
+#include "agc.h"
+#include <algorithm>
+#include <cstring>
+
+void Agc::configure(int bitDepth, int bands)
+{
+    bitDepth = std::max(8, std::min(16, bitDepth));
+    m_maxValue = (1 << bitDepth) - 1;
+    m_binShift = std::max(0, bitDepth - 12);
+    m_bands = std::max(1, bands);
+    m_table.resize(m_maxValue + 1);
+    m_histograms.assign((size_t)m_bands * HistogramBins, 0);
+    m_merged.resize(HistogramBins);
+    m_low = m_high = -1;
+
+    // first frame: no statistics yet, show the full range
+    for (int v = 0; v <= m_maxValue; ++v) m_table[v] = (uint8_t)(v >> (bitDepth - 8));
+}
+
+void Agc::update(Mode mode)
+{
+    uint32_t *hist = m_merged.data();
+    memcpy(hist, m_histograms.data(), HistogramBins * sizeof(uint32_t));
+    for (int b = 1; b < m_bands; ++b) {
+        const uint32_t *band = bandHistogram(b);
+        for (int i = 0; i < HistogramBins; ++i) hist[i] += band[i];
+    }
+    std::fill(m_histograms.begin(), m_histograms.end(), 0);
+
+    uint64_t total = 0;
+    for (int i = 0; i < HistogramBins; ++i) total += hist[i];
+    if (total == 0) return;
+
+    if (mode == Plateau) {
+        buildPlateau(hist);
+    } else {
+        buildLinear(hist, total);
+    }
+}
+
+void Agc::discard()
+{
+    std::fill(m_histograms.begin(), m_histograms.end(), 0);
+}
+
+void Agc::buildLinear(const uint32_t *hist, uint64_t total)
+{
+    const uint64_t lowCount = total / 100;
+    const uint64_t highCount = total - total / 100;
+    int lowBin = 0, highBin = HistogramBins - 1;
+    uint64_t cum = 0;
+    bool lowFound = false;
+    for (int i = 0; i < HistogramBins; ++i) {
+        cum += hist[i];
+        if (!lowFound && cum > lowCount) {
+            lowBin = i;
+            lowFound = true;
+        }
+        if (cum >= highCount) {
+            highBin = i;
+            break;
+        }
+    }
+    const int low = (lowBin << m_binShift) << 4;
+    const int high = ((((highBin + 1) << m_binShift) - 1) << 4);
+
+    // follow scene changes over a few frames instead of jumping
+    if (m_low < 0) {
+        m_low = low;
+        m_high = high;
+    } else {
+        m_low += (low - m_low) / 8;
+        m_high += (high - m_high) / 8;
+    }
+    const int lo = m_low >> 4;
+    const int span = std::max(1, (m_high >> 4) - lo);
+    for (int v = 0; v <= m_maxValue; ++v) {
+        const int out = (v - lo) * 255 / span;
+        m_table[v] = (uint8_t)(out < 0 ? 0 : (out > 255 ? 255 : out));
+    }
+}
+
+void Agc::buildPlateau(const uint32_t *hist)
+{
+    // clip every bin at twice the mean of the occupied bins, so a large
+    // uniform background cannot take over the output range
+    uint64_t total = 0;
+    int occupied = 0;
+    for (int i = 0; i < HistogramBins; ++i) {
+        if (hist[i]) {
+            total += hist[i];
+            ++occupied;
+        }
+    }
+    const uint32_t plateau = (uint32_t)std::max<uint64_t>(1, 2 * total / occupied);
+    uint64_t clippedTotal = 0;
+    for (int i = 0; i < HistogramBins; ++i) clippedTotal += std::min(hist[i], plateau);
+
+    uint64_t cum = 0;
+    const int binWidth = 1 << m_binShift;
+    for (int i = 0; i < HistogramBins; ++i) {
+        const uint32_t clipped = std::min(hist[i], plateau);
+        const uint8_t out = (uint8_t)((cum * 2 + clipped) * 255 / (clippedTotal * 2));
+        cum += clipped;
+        const int first = i << m_binShift;
+        if (first > m_maxValue) break;
+        const int last = std::min(m_maxValue, first + binWidth - 1);
+        memset(&m_table[first], out, last - first + 1);
+    }
+}
+
+void agcRow(const uint16_t *src, const uint8_t *table, int maxValue, int binShift,
+            uint32_t *hist, uint8_t *out, int width)
+{
+    for (int x = 0; x < width; ++x) {
+        int v = src[x];
+        if (v > maxValue) v = maxValue;
+        ++hist[v >> binShift];
+        out[x] = table[v];
+    }
+}
+
+void agcHistogramRow(const uint16_t *src, int maxValue, int binShift, uint32_t *hist, int width)
+{
+    for (int x = 0; x < width; ++x) {
+        int v = src[x];
+        if (v > maxValue) v = maxValue;
+        ++hist[v >> binShift];
+    }
+}
+
+void agcMapRow(const uint16_t *src, const uint8_t *table, int maxValue, uint8_t *out, int width)
+{
+    for (int x = 0; x < width; ++x) {
+        int v = src[x];
+        out[x] = table[v > maxValue ? maxValue : v];
+    }
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Automatic gain control for 10..16-bit radiometric frames (Y10/Y12/Y14/Y16,
+// one little-endian 16-bit word per pixel). Conversion maps every pixel
+// through table() and counts it into a histogram in the same pass; once the
+// frame is done, update() turns that histogram into the table for the next
+// frame. Frame N's statistics thus drive frame N+1 and no pixel is read twice.
+class Agc
+{
+public:
+    enum Mode { Linear, Plateau };
+    enum { HistogramBins = 4096 };
+
+    // stream start: sensor bit depth and number of conversion bands, each of
+    // which gets its own histogram. The table starts as a plain linear map.
+    void configure(int bitDepth, int bands);
+
+    const uint8_t *table() const { return m_table.data(); }
+    int maxValue() const { return m_maxValue; }
+    int binShift() const { return m_binShift; }
+    uint32_t *bandHistogram(int band) { return &m_histograms[(size_t)band * HistogramBins]; }
+
+    // capture thread, after all bands of a frame have finished: merges and
+    // clears the band histograms and rebuilds table() for the next frame.
+    // Linear stretches the 1st..99th percentile to the full 8-bit range,
+    // Plateau equalizes the histogram with each bin clipped at the plateau.
+    void update(Mode mode);
+    // instead of update(): forgets the band histograms of a frame that is not
+    // to steer the mapping (a held frame shown again)
+    void discard();
+
+private:
+    void buildLinear(const uint32_t *hist, uint64_t total);
+    void buildPlateau(const uint32_t *hist);
+
+    int m_maxValue{0};
+    int m_binShift{0};
+    int m_bands{0};
+    std::vector<uint8_t> m_table;        // maxValue + 1 entries
+    std::vector<uint32_t> m_histograms;  // bands * HistogramBins
+    std::vector<uint32_t> m_merged;
+    // smoothed stretch limits (Linear), in input units << 4
+    int m_low{-1};
+    int m_high{-1};
+};
+
+// One row through the AGC: out[x] = table[min(src[x], maxValue)], counting
+// every pixel into hist[value >> binShift]
+void agcRow(const uint16_t *src, const uint8_t *table, int maxValue, int binShift,
+            uint32_t *hist, uint8_t *out, int width);
+// histogram only, for rows whose mapping is done elsewhere
+void agcHistogramRow(const uint16_t *src, int maxValue, int binShift, uint32_t *hist, int width);
+// mapping only
+void agcMapRow(const uint16_t *src, const uint8_t *table, int maxValue, uint8_t *out, int width);
@@ -0,0 +1,465 @@
+// Benchmarks for the conversion kernels, the point-operation stages and the
+// capture -> display hand-off, on synthetic frames so no sensor is needed.
+// Every measurement is one JSON object per line on stdout (logs go to
+// stderr), to be diffed between releases:
+//
+//   owlet_bench [--seconds <s>] [--filter <text>]
+//
+// --seconds is the run time of each end-to-end case (default 1; kernel cases
+// run a tenth of it), --filter runs only cases whose identifying fields
+// (bench, stage, kernels, resolution, size, threads) contain text, e.g.
+// '"stage":"nv12"' or '"threads":4'.
+
+#include <QCoreApplication>
+#include <QStringList>
+#include <QDebug>
+#include <linux/videodev2.h>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "v4l2camera.h"
+#include "framesource.h"
+#include "framestats.h"
+#include "palette.h"
+#include "replaysource.h"
+#include "yuvkernels.h"
+#include "workerpool.h"
+
+// ---------------------------------------------------------------------------
+// allocation counting: every malloc-family call of the process, so C++ new
+// and QImage buffers alike
+// ---------------------------------------------------------------------------
+
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t n, size_t size);
+void *__libc_realloc(void *ptr, size_t size);
+void *__libc_memalign(size_t alignment, size_t size);
+}
+
+static std::atomic<unsigned long long> s_allocations{0};
+
+extern "C" void *malloc(size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t n, size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_calloc(n, size);
+}
+
+extern "C" void *realloc(void *ptr, size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+
+extern "C" int posix_memalign(void **ptr, size_t alignment, size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    *ptr = __libc_memalign(alignment, size);
+    return *ptr ? 0 : ENOMEM;
+}
+
+extern "C" void *aligned_alloc(size_t alignment, size_t size)
+{
+    s_allocations.fetch_add(1, std::memory_order_relaxed);
+    return __libc_memalign(alignment, size);
+}
+
+static unsigned long long allocations()
+{
+    return s_allocations.load(std::memory_order_relaxed);
+}
+
+// ---------------------------------------------------------------------------
+// synthetic frames
+// ---------------------------------------------------------------------------
+
+struct Resolution {
+    const char *name;
+    int width;
+    int height;
+};
+
+static const Resolution s_resolutions[] = {
+    { "VGA", 640, 480 },
+    { "720p", 1280, 720 },
+    { "1080p", 1920, 1080 },
+};
+
+static const int s_threadCounts[] = { 1, 2, 4 };
+
+// horizontal gradient plus noise, so clamping and palette lookups see the
+// full range instead of one cached value
+static std::vector<uint8_t> syntheticFrame(uint32_t pixfmt, int width, int height)
+{
+    std::vector<uint8_t> data(ReplaySource::frameBytes(pixfmt, width, height));
+    uint32_t state = 0x12345678u;
+    if (pixfmt == V4L2_PIX_FMT_Y16) {
+        uint16_t *p = reinterpret_cast<uint16_t*>(data.data());
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+                p[y * width + x] = (uint16_t)(8000 + x * 4000 / width + (state & 255));
+            }
+        }
+        return data;
+    }
+    for (size_t i = 0; i < data.size(); ++i) {
+        state ^= state << 13; state ^= state >> 17; state ^= state << 5;
+        data[i] = (uint8_t)((i * 255 / data.size()) / 2 + (state & 127));
+    }
+    return data;
+}
+
+static std::string formatName(uint32_t pixfmt)
+{
+    std::string s;
+    for (int i = 0; i < 4; ++i) {
+        const char c = (char)((pixfmt >> (8 * i)) & 0xff);
+        if (c != ' ') s += c;
+    }
+    return s;
+}
+
+// ---------------------------------------------------------------------------
+// output
+// ---------------------------------------------------------------------------
+
+static QString s_filter;
+
+static void report(const std::string &line)
+{
+    printf("%s\n", line.c_str());
+    fflush(stdout);
+}
+
+static std::string jsonCase(const char *bench, const std::string &stage, const char *kernels,
+                            const Resolution &res, int threads)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf),
+             "{\"bench\":\"%s\",\"stage\":\"%s\",\"kernels\":\"%s\",\"resolution\":\"%s\","
+             "\"width\":%d,\"height\":%d,\"threads\":%d",
+             bench, stage.c_str(), kernels, res.name, res.width, res.height, threads);
+    return buf;
+}
+
+// cases are identified by their leading fields; the filter runs on those
+static bool wanted(const std::string &head)
+{
+    return s_filter.isEmpty() || QString::fromStdString(head).contains(s_filter);
+}
+
+// ---------------------------------------------------------------------------
+// row kernels and point-operation stages over a WorkerPool
+// ---------------------------------------------------------------------------
+
+struct RowJob {
+    enum Stage { Nv12, Nv21, Uyvy, Yuyv, Grey, LutPlanar, LutPacked, CurvePlanar, CurvePacked } stage;
+    const YuvRowKernels *kernels;
+    const uint8_t *src;
+    const uint8_t *uv;
+    const uint32_t *lut;
+    const uint8_t *curve;
+    uint8_t *dst;
+    int dstStride;
+    int width;
+};
+
+static void runRows(void *ctx, int rowBegin, int rowEnd)
+{
+    const RowJob &job = *static_cast<const RowJob*>(ctx);
+    const int w = job.width;
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        uint8_t *dst = job.dst + (size_t)row * job.dstStride;
+        switch (job.stage) {
+        case RowJob::Nv12: job.kernels->nv12(job.src + row * w, job.uv + (row / 2) * w, dst, w); break;
+        case RowJob::Nv21: job.kernels->nv21(job.src + row * w, job.uv + (row / 2) * w, dst, w); break;
+        case RowJob::Uyvy: job.kernels->uyvy(job.src + row * w * 2, dst, w); break;
+        case RowJob::Yuyv: job.kernels->yuyv(job.src + row * w * 2, dst, w); break;
+        case RowJob::Grey: job.kernels->grey(job.src + row * w, dst, w); break;
+        case RowJob::LutPlanar: lutRowPlanar(job.src + row * w, job.lut, dst, w); break;
+        case RowJob::LutPacked: lutRowPacked(job.src + row * w * 2, 0, job.lut, dst, w); break;
+        case RowJob::CurvePlanar: curveRowPlanar(job.src + row * w, job.curve, dst, w); break;
+        case RowJob::CurvePacked: curveRowPacked(job.src + row * w * 2, 0, job.curve, dst, w); break;
+        }
+    }
+}
+
+static void benchRows(RowJob job, const std::string &head, const Resolution &res, WorkerPool &pool,
+                      double seconds)
+{
+    if (!wanted(head)) return;
+    const int rowAlign = (job.stage == RowJob::Nv12 || job.stage == RowJob::Nv21) ? 2 : 1;
+    pool.run(res.height, rowAlign, &runRows, &job); // warm caches and workers
+
+    const unsigned long long allocBefore = allocations();
+    const qint64 start = monotonicNs();
+    const qint64 until = start + (qint64)(seconds * 1e9);
+    long frames = 0;
+    qint64 now;
+    do {
+        pool.run(res.height, rowAlign, &runRows, &job);
+        ++frames;
+        now = monotonicNs();
+    } while (now < until || frames < 3);
+    const double elapsed = (double)(now - start);
+    const double pixels = (double)frames * res.width * res.height;
+
+    char tail[160];
+    snprintf(tail, sizeof(tail), ",\"ns_per_pixel\":%.4f,\"fps\":%.1f,\"allocs_per_frame\":%.3f,\"frames\":%ld}",
+             elapsed / pixels, frames * 1e9 / elapsed, (double)(allocations() - allocBefore) / frames, frames);
+    report(head + tail);
+}
+
+static void benchKernels(double seconds)
+{
+    const YuvRowKernels *sets[8];
+    const int setCount = availableYuvRowKernels(sets, 8);
+    const Palette *iron = findPalette("iron");
+    uint8_t curve[256];
+    for (int i = 0; i < 256; ++i) curve[i] = (uint8_t)(255 - i);
+
+    for (const Resolution &res : s_resolutions) {
+        const std::vector<uint8_t> planar = syntheticFrame(V4L2_PIX_FMT_NV12, res.width, res.height);
+        const std::vector<uint8_t> packed = syntheticFrame(V4L2_PIX_FMT_YUYV, res.width, res.height);
+        // RGB888, or room for a packed row when a curve stage writes 4:2:2
+        std::vector<uint8_t> out((size_t)res.width * res.height * 3 + 16);
+
+        for (int threads : s_threadCounts) {
+            WorkerPool pool(threads);
+            RowJob job = {};
+            job.dst = out.data();
+            job.dstStride = res.width * 3;
+            job.width = res.width;
+
+            const struct { RowJob::Stage stage; const char *name; bool packedSrc; } colour[] = {
+                { RowJob::Nv12, "nv12", false }, { RowJob::Nv21, "nv21", false },
+                { RowJob::Uyvy, "uyvy", true }, { RowJob::Yuyv, "yuyv", true },
+                { RowJob::Grey, "grey", false },
+            };
+            for (int k = 0; k < setCount; ++k) {
+                for (const auto &c : colour) {
+                    job.stage = c.stage;
+                    job.kernels = sets[k];
+                    job.src = c.packedSrc ? packed.data() : planar.data();
+                    job.uv = planar.data() + (size_t)res.width * res.height;
+                    benchRows(job, jsonCase("kernel", c.name, sets[k]->name, res, threads), res, pool, seconds);
+                }
+            }
+
+            job.kernels = &yuvRowKernels();
+            job.lut = iron ? iron->lut : nullptr;
+            job.curve = curve;
+            if (job.lut) {
+                job.stage = RowJob::LutPlanar;
+                job.src = planar.data();
+                benchRows(job, jsonCase("stage", "lut_planar", "default", res, threads), res, pool, seconds);
+                job.stage = RowJob::LutPacked;
+                job.src = packed.data();
+                benchRows(job, jsonCase("stage", "lut_packed", "default", res, threads), res, pool, seconds);
+            }
+            job.stage = RowJob::CurvePlanar;
+            job.src = planar.data();
+            job.dstStride = res.width;
+            benchRows(job, jsonCase("stage", "curve_planar", "default", res, threads), res, pool, seconds);
+            job.stage = RowJob::CurvePacked;
+            job.src = packed.data();
+            job.dstStride = res.width * 2;
+            benchRows(job, jsonCase("stage", "curve_packed", "default", res, threads), res, pool, seconds);
+        }
+    }
+}
+
+// ---------------------------------------------------------------------------
+// end to end: synthetic source -> V4L2Camera -> mailbox consumer
+// ---------------------------------------------------------------------------
+
+// Unthrottled in-memory source with driver-like buffer ownership: a buffer
+// is busy from dequeue until requeue or the release of its exported frame.
+class SyntheticSource : public FrameSource
+{
+public:
+    enum { Buffers = 4 };
+
+    SyntheticSource(uint32_t pixfmt, int width, int height)
+    {
+        m_pixfmt = pixfmt;
+        m_width = width;
+        m_height = height;
+        const std::vector<uint8_t> frame = syntheticFrame(pixfmt, width, height);
+        for (int i = 0; i < Buffers; ++i) {
+            m_data[i] = frame;
+            m_frames[i].release = &SyntheticSource::releaseRawFrame;
+            m_frames[i].owner = this;
+            m_frames[i].index = i;
+        }
+    }
+
+    QString name() const override { return QString("synthetic"); }
+    bool start(int, int, QString &) override { return true; }
+    void stop() override {}
+
+    Status dequeue(SourceBuffer &buf, int, QString &) override
+    {
+        for (int i = 0; i < Buffers; ++i) {
+            bool expected = false;
+            if (!m_busy[i].compare_exchange_strong(expected, true)) continue;
+            buf.index = i;
+            buf.planeCount = 1;
+            buf.planes[0] = m_data[i].data();
+            buf.bytesPerLine[0] = (int)(m_data[i].size() / m_height);
+            if (m_pixfmt == V4L2_PIX_FMT_NV12 || m_pixfmt == V4L2_PIX_FMT_NV21) {
+                buf.planeCount = 2;
+                buf.bytesPerLine[0] = m_width;
+                buf.planes[1] = m_data[i].data() + m_width * m_height;
+                buf.bytesPerLine[1] = m_width;
+            }
+            buf.sequence = m_sequence++;
+            buf.timestampNs = monotonicNs();
+            m_dequeued.fetch_add(1, std::memory_order_relaxed);
+            return Ok;
+        }
+        // every buffer is held downstream, like a starved driver
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        return Again;
+    }
+
+    bool requeue(int index, QString &) override
+    {
+        m_busy[index].store(false);
+        return true;
+    }
+
+    RawFrame *exportBuffer(int index) override { return &m_frames[index]; }
+
+    unsigned long long dequeued() const { return m_dequeued.load(std::memory_order_relaxed); }
+
+private:
+    static void releaseRawFrame(RawFrame *frame)
+    {
+        static_cast<SyntheticSource*>(frame->owner)->m_busy[frame->index].store(false);
+    }
+
+    std::vector<uint8_t> m_data[Buffers];
+    RawFrame m_frames[Buffers];
+    std::atomic<bool> m_busy[Buffers] = {};
+    std::atomic<unsigned long long> m_dequeued{0};
+    uint32_t m_sequence{0};
+};
+
+static void benchPipeline(uint32_t pixfmt, const char *palette, const Resolution &res, int threads,
+                          double seconds)
+{
+    std::string stage = formatName(pixfmt);
+    if (palette) stage += std::string("+") + palette;
+    const std::string head = jsonCase("pipeline", stage, yuvRowKernels().name, res, threads);
+    if (!wanted(head)) return;
+
+    SyntheticSource *source = new SyntheticSource(pixfmt, res.width, res.height);
+    V4L2Camera camera(QString("synthetic"), res.width, res.height);
+    camera.setSource(source);
+    camera.setConversionThreads(threads);
+    if (palette) camera.setPalette(QString(palette));
+
+    // the display side: takes every frame it can, like the scene graph sync
+    std::atomic<bool> quit{false};
+    std::atomic<unsigned long long> shown{0};
+    FrameMailbox *mailbox = camera.mailbox();
+    std::thread consumer([&] {
+        volatile uint8_t sink = 0;
+        while (!quit.load(std::memory_order_relaxed)) {
+            mailbox->acknowledge();
+            VideoFrame frame;
+            if (mailbox->take(frame)) {
+                if (!frame.image.isNull()) sink = frame.image.constBits()[0];
+                shown.fetch_add(1, std::memory_order_relaxed);
+            } else {
+                std::this_thread::sleep_for(std::chrono::microseconds(50));
+            }
+        }
+        (void)sink;
+    });
+
+    camera.start();
+    // warm-up: pools filled, workers running, first frames through
+    const qint64 warmUntil = monotonicNs() + 200000000LL;
+    while (monotonicNs() < warmUntil || shown.load() < 2) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        if (monotonicNs() > warmUntil + 5000000000LL) break; // nothing arrives
+    }
+
+    const unsigned long long capturedBefore = source->dequeued();
+    const unsigned long long shownBefore = shown.load();
+    const unsigned long long allocBefore = allocations();
+    const qint64 start = monotonicNs();
+    std::this_thread::sleep_for(std::chrono::nanoseconds((qint64)(seconds * 1e9)));
+    const double elapsed = (double)(monotonicNs() - start);
+    const unsigned long long captured = source->dequeued() - capturedBefore;
+    const unsigned long long displayed = shown.load() - shownBefore;
+    const unsigned long long allocs = allocations() - allocBefore;
+
+    camera.stopCapture();
+    camera.wait();
+    quit = true;
+    consumer.join();
+
+    char tail[224];
+    snprintf(tail, sizeof(tail),
+             ",\"ns_per_pixel\":%.4f,\"fps\":%.1f,\"display_fps\":%.1f,\"allocs_per_frame\":%.3f,\"frames\":%llu}",
+             captured ? elapsed / ((double)captured * res.width * res.height) : 0.0,
+             captured * 1e9 / elapsed, displayed * 1e9 / elapsed,
+             captured ? (double)allocs / captured : 0.0, captured);
+    report(head + tail);
+}
+
+static void benchPipelines(double seconds)
+{
+    const struct { uint32_t pixfmt; const char *palette; } cases[] = {
+        { V4L2_PIX_FMT_NV12, nullptr },
+        { V4L2_PIX_FMT_NV12, "iron" },
+        { V4L2_PIX_FMT_YUYV, nullptr },
+        { V4L2_PIX_FMT_Y16, nullptr },
+    };
+    for (const Resolution &res : s_resolutions) {
+        for (const auto &c : cases) {
+            for (int threads : s_threadCounts) benchPipeline(c.pixfmt, c.palette, res, threads, seconds);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    QCoreApplication app(argc, argv);
+
+    double seconds = 1.0;
+    const QStringList args = app.arguments();
+    for (int i = 1; i < args.size(); ++i) {
+        if (args[i] == "--seconds" && i + 1 < args.size()) {
+            seconds = args[++i].toDouble();
+        } else if (args[i] == "--filter" && i + 1 < args.size()) {
+            s_filter = args[++i];
+        } else {
+            fprintf(stderr, "usage: %s [--seconds <s>] [--filter <text>]\n", argv[0]);
+            return 2;
+        }
+    }
+    if (seconds <= 0) seconds = 1.0;
+
+    benchKernels(seconds / 10);
+    benchPipelines(seconds);
+    return 0;
+}
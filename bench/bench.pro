@@ -0,0 +1,49 @@
+QT += core gui
+QT -= quick qml
+CONFIG += c++11 console
+CONFIG -= app_bundle
+INCLUDEPATH += ..
+SOURCES += bench.cpp \
+           ../v4l2camera.cpp \
+           ../yuvkernels.cpp \
+           ../workerpool.cpp \
+           ../framepool.cpp \
+           ../framemailbox.cpp \
+           ../palette.cpp \
+           ../toneadjust.cpp \
+           ../sharpen.cpp \
+           ../denoise.cpp \
+           ../calibration.cpp \
+           ../agc.cpp \
+           ../hotspottracker.cpp \
+           ../framestats.cpp \
+           ../v4l2source.cpp \
+           ../replaysource.cpp \
+           ../boxscale.cpp \
+           ../rawrecorder.cpp \
+           ../framehistory.cpp \
+           ../shmexporter.cpp
+HEADERS += ../v4l2camera.h \
+           ../yuvkernels.h \
+           ../workerpool.h \
+           ../framepool.h \
+           ../framemailbox.h \
+           ../videoframe.h \
+           ../palette.h \
+           ../toneadjust.h \
+           ../sharpen.h \
+           ../denoise.h \
+           ../calibration.h \
+           ../agc.h \
+           ../hotspottracker.h \
+           ../framestats.h \
+           ../framesource.h \
+           ../v4l2source.h \
+           ../replaysource.h \
+           ../boxscale.h \
+           ../rawrecorder.h \
+           ../framehistory.h \
+           ../shmexporter.h \
+           ../shmframes.h
+TARGET = owlet_bench
+TEMPLATE = app
@@ -0,0 +1,110 @@
+#include "boxscale.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OWLET_BOX_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OWLET_BOX_NEON 1
+#endif
+
+void boxAccumulateRow(const uint8_t *src, uint16_t *acc, int count, bool first)
+{
+    int i = 0;
+#if defined(OWLET_BOX_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= count; i += 16) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_unpacklo_epi8(v, zero);
+        __m128i hi = _mm_unpackhi_epi8(v, zero);
+        __m128i *a = reinterpret_cast<__m128i*>(acc + i);
+        if (!first) {
+            lo = _mm_add_epi16(lo, _mm_loadu_si128(a));
+            hi = _mm_add_epi16(hi, _mm_loadu_si128(a + 1));
+        }
+        _mm_storeu_si128(a, lo);
+        _mm_storeu_si128(a + 1, hi);
+    }
+#elif defined(OWLET_BOX_NEON)
+    for (; i + 16 <= count; i += 16) {
+        const uint8x16_t v = vld1q_u8(src + i);
+        if (first) {
+            vst1q_u16(acc + i, vmovl_u8(vget_low_u8(v)));
+            vst1q_u16(acc + i + 8, vmovl_u8(vget_high_u8(v)));
+        } else {
+            vst1q_u16(acc + i, vaddw_u8(vld1q_u16(acc + i), vget_low_u8(v)));
+            vst1q_u16(acc + i + 8, vaddw_u8(vld1q_u16(acc + i + 8), vget_high_u8(v)));
+        }
+    }
+#endif
+    if (first) {
+        for (; i < count; ++i) acc[i] = src[i];
+    } else {
+        for (; i < count; ++i) acc[i] += src[i];
+    }
+}
+
+void boxReduceRow(const uint16_t *acc, int step, int factor, int divisor,
+                  uint8_t *out, int outStep, int count)
+{
+    // divide by multiplying: a sum is at most 255 * divisor, so a 22-bit
+    // reciprocal, rounded up, neither overflows nor misrounds
+    const uint32_t recip = ((1u << 22) + divisor - 1) / divisor;
+    const int stride = factor * step;
+    if (factor == 2) {
+        for (int i = 0; i < count; ++i, acc += stride) {
+            out[i * outStep] = (uint8_t)(((acc[0] + acc[step]) * recip + (1u << 21)) >> 22);
+        }
+        return;
+    }
+    for (int i = 0; i < count; ++i, acc += stride) {
+        uint32_t sum = 0;
+        for (int j = 0; j < factor; ++j) sum += acc[j * step];
+        out[i * outStep] = (uint8_t)((sum * recip + (1u << 21)) >> 22);
+    }
+}
+
+void boxAccumulateRow16(const uint16_t *src, uint32_t *acc, int count, bool first)
+{
+    int i = 0;
+#if defined(OWLET_BOX_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 8 <= count; i += 8) {
+        const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        __m128i lo = _mm_unpacklo_epi16(v, zero);
+        __m128i hi = _mm_unpackhi_epi16(v, zero);
+        __m128i *a = reinterpret_cast<__m128i*>(acc + i);
+        if (!first) {
+            lo = _mm_add_epi32(lo, _mm_loadu_si128(a));
+            hi = _mm_add_epi32(hi, _mm_loadu_si128(a + 1));
+        }
+        _mm_storeu_si128(a, lo);
+        _mm_storeu_si128(a + 1, hi);
+    }
+#elif defined(OWLET_BOX_NEON)
+    for (; i + 8 <= count; i += 8) {
+        const uint16x8_t v = vld1q_u16(src + i);
+        if (first) {
+            vst1q_u32(acc + i, vmovl_u16(vget_low_u16(v)));
+            vst1q_u32(acc + i + 4, vmovl_u16(vget_high_u16(v)));
+        } else {
+            vst1q_u32(acc + i, vaddw_u16(vld1q_u32(acc + i), vget_low_u16(v)));
+            vst1q_u32(acc + i + 4, vaddw_u16(vld1q_u32(acc + i + 4), vget_high_u16(v)));
+        }
+    }
+#endif
+    if (first) {
+        for (; i < count; ++i) acc[i] = src[i];
+    } else {
+        for (; i < count; ++i) acc[i] += src[i];
+    }
+}
+
+void boxReduceRow16(const uint32_t *acc, int factor, int divisor, uint16_t *out, int count)
+{
+    for (int i = 0; i < count; ++i, acc += factor) {
+        uint32_t sum = 0;
+        for (int j = 0; j < factor; ++j) sum += acc[j];
+        out[i] = (uint16_t)((sum + divisor / 2) / divisor);
+    }
+}
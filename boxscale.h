@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+// Box downscaling by an integer factor, streamed a row at a time so it can
+// run inside the conversion bands: the factor source rows behind one output
+// row are summed column by column into an accumulator row, then every
+// factor neighbouring sums of one channel are averaged into one output
+// sample. Each source byte is read once and only output-size rows are
+// written; the accumulator (2 bytes per source byte) stays in L1 for common
+// widths.
+//
+// Channels are addressed with a step, so the same reduction serves planar
+// luma (step 1), interleaved chroma pairs (step 2 per channel) and packed
+// 4:2:2 (luma step 2, each chroma channel step 4).
+
+enum { MaxBoxFactor = 8 };
+
+// acc[i] = src[i] for the first row of a box, acc[i] += src[i] for the rest;
+// count bytes. Up to MaxBoxFactor rows fit in 16 bits.
+void boxAccumulateRow(const uint8_t *src, uint16_t *acc, int count, bool first);
+// out[i * outStep] = average of acc[(i * factor + j) * step], j < factor,
+// divided by divisor (factor times the number of accumulated rows)
+void boxReduceRow(const uint16_t *acc, int step, int factor, int divisor,
+                  uint8_t *out, int outStep, int count);
+
+// the same for 16-bit radiometric words
+void boxAccumulateRow16(const uint16_t *src, uint32_t *acc, int count, bool first);
+void boxReduceRow16(const uint32_t *acc, int factor, int divisor, uint16_t *out, int count);
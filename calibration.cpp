@@ -0,0 +1,302 @@
+#include "calibration.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <QDebug>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OWLET_NUC_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OWLET_NUC_NEON 1
+#endif
+
+void nucRow(const uint16_t *src, const uint16_t *gain, const int16_t *offset, int maxValue,
+            uint16_t *dst, int width)
+{
+    int x = 0;
+#if defined(OWLET_NUC_SSE2)
+    // SSE2 has no unsigned 32 -> 16 pack: pack signed around 32768 instead
+    const __m128i bias = _mm_set1_epi32(32768);
+    const __m128i limit = _mm_set1_epi16((short)(maxValue - 32768));
+    const __m128i flip = _mm_set1_epi16((short)0x8000);
+    for (; x + 8 <= width; x += 8) {
+        const __m128i r = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+        const __m128i g = _mm_loadu_si128(reinterpret_cast<const __m128i*>(gain + x));
+        const __m128i o = _mm_loadu_si128(reinterpret_cast<const __m128i*>(offset + x));
+        const __m128i lo = _mm_mullo_epi16(r, g);
+        const __m128i hi = _mm_mulhi_epu16(r, g);
+        __m128i v0 = _mm_srli_epi32(_mm_unpacklo_epi16(lo, hi), Calibration::GainShift);
+        __m128i v1 = _mm_srli_epi32(_mm_unpackhi_epi16(lo, hi), Calibration::GainShift);
+        v0 = _mm_sub_epi32(_mm_add_epi32(v0, _mm_srai_epi32(_mm_unpacklo_epi16(o, o), 16)), bias);
+        v1 = _mm_sub_epi32(_mm_add_epi32(v1, _mm_srai_epi32(_mm_unpackhi_epi16(o, o), 16)), bias);
+        const __m128i v = _mm_min_epi16(_mm_packs_epi32(v0, v1), limit);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_xor_si128(v, flip));
+    }
+#elif defined(OWLET_NUC_NEON)
+    const uint16x8_t limit = vdupq_n_u16((uint16_t)maxValue);
+    for (; x + 8 <= width; x += 8) {
+        const uint16x8_t r = vld1q_u16(src + x);
+        const uint16x8_t g = vld1q_u16(gain + x);
+        const int16x8_t o = vld1q_s16(offset + x);
+        const uint32x4_t p0 = vshrq_n_u32(vmull_u16(vget_low_u16(r), vget_low_u16(g)), Calibration::GainShift);
+        const uint32x4_t p1 = vshrq_n_u32(vmull_u16(vget_high_u16(r), vget_high_u16(g)), Calibration::GainShift);
+        const int32x4_t v0 = vaddw_s16(vreinterpretq_s32_u32(p0), vget_low_s16(o));
+        const int32x4_t v1 = vaddw_s16(vreinterpretq_s32_u32(p1), vget_high_s16(o));
+        vst1q_u16(dst + x, vminq_u16(vcombine_u16(vqmovun_s32(v0), vqmovun_s32(v1)), limit));
+    }
+#endif
+    for (; x < width; ++x) {
+        const int v = (int)(((uint32_t)src[x] * gain[x]) >> Calibration::GainShift) + offset[x];
+        dst[x] = (uint16_t)(v < 0 ? 0 : (v > maxValue ? maxValue : v));
+    }
+}
+
+Calibration::Calibration(int width, int height)
+    : m_width(width), m_height(height),
+      m_ownGain((size_t)width * height, (uint16_t)GainOne), m_ownOffset((size_t)width * height, 0)
+{
+    m_gain = m_ownGain.data();
+    m_offset = m_ownOffset.data();
+}
+
+Calibration::~Calibration()
+{
+    if (m_map) munmap(m_map, m_mapBytes);
+}
+
+Calibration *Calibration::load(const QString &path, QString &error)
+{
+    const int fd = open(path.toLocal8Bit().constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        error = QString("Calibration: cannot open %1: %2").arg(path).arg(strerror(errno));
+        return nullptr;
+    }
+    struct stat st;
+    void *map = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(CalibrationFileHeader)) {
+        map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (map == MAP_FAILED) {
+        error = QString("Calibration: cannot map %1").arg(path);
+        return nullptr;
+    }
+
+    CalibrationFileHeader header;
+    memcpy(&header, map, sizeof(header));
+    const size_t pixels = (size_t)header.width * header.height;
+    const size_t expected = sizeof(header) + pixels * 4 + (size_t)header.deadCount * 4;
+    if (memcmp(header.magic, "OWLNUC1", 8) != 0 || !pixels || header.width > 16384 || header.height > 16384
+        || (size_t)st.st_size != expected) {
+        munmap(map, st.st_size);
+        error = QString("Calibration: %1 is not a calibration file").arg(path);
+        return nullptr;
+    }
+
+    Calibration *calibration = new Calibration(0, 0);
+    calibration->m_width = header.width;
+    calibration->m_height = header.height;
+    calibration->m_map = map;
+    calibration->m_mapBytes = st.st_size;
+    const uchar *data = static_cast<const uchar*>(map) + sizeof(header);
+    calibration->m_gain = reinterpret_cast<const uint16_t*>(data);
+    calibration->m_offset = reinterpret_cast<const int16_t*>(data + pixels * 2);
+    const uint32_t *dead = reinterpret_cast<const uint32_t*>(data + pixels * 4);
+    for (uint32_t i = 0; i < header.deadCount; ++i) {
+        if (dead[i] < pixels) calibration->m_dead.push_back(dead[i]);
+    }
+    std::sort(calibration->m_dead.begin(), calibration->m_dead.end());
+    calibration->m_dead.erase(std::unique(calibration->m_dead.begin(), calibration->m_dead.end()),
+                              calibration->m_dead.end());
+    calibration->findReplacements();
+    qDebug() << "Calibration:" << path << header.width << "x" << header.height << ","
+             << calibration->m_dead.size() << "dead pixels";
+    return calibration;
+}
+
+Calibration *Calibration::clone() const
+{
+    Calibration *copy = new Calibration(0, 0);
+    const size_t pixels = (size_t)m_width * m_height;
+    copy->m_width = m_width;
+    copy->m_height = m_height;
+    copy->m_ownGain.assign(m_gain, m_gain + pixels);
+    copy->m_ownOffset.assign(m_offset, m_offset + pixels);
+    copy->m_gain = copy->m_ownGain.data();
+    copy->m_offset = copy->m_ownOffset.data();
+    copy->m_dead = m_dead;
+    copy->m_replacements = m_replacements;
+    return copy;
+}
+
+bool Calibration::save(const QString &path, QString &error) const
+{
+    CalibrationFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, "OWLNUC1", 8);
+    header.width = m_width;
+    header.height = m_height;
+    header.deadCount = (uint32_t)m_dead.size();
+    const size_t pixels = (size_t)m_width * m_height;
+
+    // written next to the target and renamed over it, so a running camera
+    // that has the old file mapped keeps reading the old contents
+    const QString temp = path + ".tmp";
+    FILE *file = fopen(temp.toLocal8Bit().constData(), "wb");
+    if (!file) {
+        error = QString("Calibration: cannot create %1: %2").arg(temp).arg(strerror(errno));
+        return false;
+    }
+    fwrite(&header, sizeof(header), 1, file);
+    fwrite(m_gain, sizeof(uint16_t), pixels, file);
+    fwrite(m_offset, sizeof(int16_t), pixels, file);
+    if (!m_dead.empty()) fwrite(m_dead.data(), sizeof(uint32_t), m_dead.size(), file);
+    const bool failed = ferror(file) != 0;
+    if (fclose(file) != 0 || failed
+        || rename(temp.toLocal8Bit().constData(), path.toLocal8Bit().constData()) != 0) {
+        error = QString("Calibration: writing %1 failed").arg(path);
+        unlink(temp.toLocal8Bit().constData());
+        return false;
+    }
+    return true;
+}
+
+void Calibration::setOffsets(std::vector<int16_t> &&offsets)
+{
+    if (offsets.size() != (size_t)m_width * m_height) return;
+    m_ownOffset = std::move(offsets);
+    m_offset = m_ownOffset.data();
+}
+
+// the nearest good pixels left and right, else above and below, at most
+// MaxReach away; a cluster too big for that keeps its own value
+void Calibration::findReplacements()
+{
+    enum { MaxReach = 4 };
+    const size_t pixels = (size_t)m_width * m_height;
+    std::vector<uint8_t> bad(pixels, 0);
+    for (uint32_t pixel : m_dead) bad[pixel] = 1;
+
+    m_replacements.clear();
+    m_replacements.reserve(m_dead.size());
+    for (uint32_t pixel : m_dead) {
+        const int x = pixel % m_width;
+        const int y = pixel / m_width;
+        // dx, dy step to a neighbour; -1 when there is none in reach
+        auto search = [&](int dx, int dy) -> int64_t {
+            for (int d = 1; d <= MaxReach; ++d) {
+                const int nx = x + dx * d;
+                const int ny = y + dy * d;
+                if (nx < 0 || ny < 0 || nx >= m_width || ny >= m_height) break;
+                const uint32_t n = (uint32_t)ny * m_width + nx;
+                if (!bad[n]) return n;
+            }
+            return -1;
+        };
+        int64_t a = search(-1, 0);
+        int64_t b = search(1, 0);
+        if (a < 0 && b < 0) {
+            a = search(0, -1);
+            b = search(0, 1);
+        }
+        if (a < 0) a = b;
+        if (b < 0) b = a;
+        if (a < 0) a = b = pixel;
+        m_replacements.push_back({ pixel, (uint32_t)a, (uint32_t)b });
+    }
+}
+
+void Calibration::correctRows(const uint16_t *src, int srcStride, const QRect &rect, int maxValue,
+                              uint16_t *dst, int dstStride, int rowBegin, int rowEnd) const
+{
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        const size_t pixel = (size_t)(rect.y() + row) * m_width + rect.x();
+        nucRow(src + (size_t)(rect.y() + row) * srcStride + rect.x(), m_gain + pixel, m_offset + pixel,
+               maxValue, dst + (size_t)row * dstStride, rect.width());
+    }
+}
+
+int Calibration::corrected(const uint16_t *src, int srcStride, uint32_t pixel, int maxValue) const
+{
+    const int v = (int)(((uint32_t)src[(size_t)(pixel / m_width) * srcStride + pixel % m_width] * m_gain[pixel])
+                        >> GainShift) + m_offset[pixel];
+    return v < 0 ? 0 : (v > maxValue ? maxValue : v);
+}
+
+void Calibration::replaceDeadPixels(const uint16_t *src, int srcStride, const QRect &rect, int maxValue,
+                                    uint16_t *dst, int dstStride) const
+{
+    // the neighbours may be outside rect: they are corrected from src
+    const uint32_t first = (uint32_t)rect.y() * m_width;
+    const uint32_t end = (uint32_t)(rect.y() + rect.height()) * m_width;
+    auto it = std::lower_bound(m_replacements.begin(), m_replacements.end(), first,
+                               [](const Replacement &r, uint32_t pixel) { return r.pixel < pixel; });
+    for (; it != m_replacements.end() && it->pixel < end; ++it) {
+        const int x = (int)(it->pixel % m_width) - rect.x();
+        if (x < 0 || x >= rect.width()) continue;
+        const int y = (int)(it->pixel / m_width) - rect.y();
+        const int value = (corrected(src, srcStride, it->a, maxValue) + corrected(src, srcStride, it->b, maxValue) + 1) >> 1;
+        dst[(size_t)y * dstStride + x] = (uint16_t)value;
+    }
+}
+
+void FlatField::begin(int width, int height, int frames)
+{
+    m_width = width;
+    m_height = height;
+    m_frames = frames < 1 ? 1 : frames;
+    m_remaining = m_frames;
+    m_sum.assign((size_t)width * height, 0);
+}
+
+void FlatField::cancel()
+{
+    m_remaining = 0;
+    std::vector<uint32_t>().swap(m_sum);
+}
+
+void FlatField::accumulateRows(const uint16_t *src, int srcStride, int rowBegin, int rowEnd)
+{
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        const uint16_t *in = src + (size_t)row * srcStride;
+        uint32_t *sum = &m_sum[(size_t)row * m_width];
+        for (int x = 0; x < m_width; ++x) sum[x] += in[x];
+    }
+}
+
+std::vector<int16_t> FlatField::takeOffsets(const Calibration &calibration)
+{
+    const size_t pixels = (size_t)m_width * m_height;
+    const uint16_t *gain = calibration.gains();
+    std::vector<uint8_t> bad(pixels, 0);
+    for (uint32_t pixel : calibration.deadPixels()) bad[pixel] = 1;
+
+    // the mean of the averaged frame under the current gains is the level
+    // every pixel is brought to
+    const double scale = 1.0 / ((double)m_frames * Calibration::GainOne);
+    double total = 0;
+    size_t good = 0;
+    for (size_t i = 0; i < pixels; ++i) {
+        if (bad[i]) continue;
+        total += (double)m_sum[i] * gain[i] * scale;
+        ++good;
+    }
+    const double level = good ? total / good : 0.0;
+
+    std::vector<int16_t> offsets(pixels, 0);
+    for (size_t i = 0; i < pixels; ++i) {
+        if (bad[i]) continue;
+        const long offset = std::lround(level - (double)m_sum[i] * gain[i] * scale);
+        offsets[i] = (int16_t)std::max(-32768L, std::min(32767L, offset));
+    }
+    cancel();
+    return offsets;
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <QRect>
+#include <QString>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Non-uniformity correction for 10..16-bit radiometric frames, applied to
+// the raw words before the AGC and the palette see them:
+//
+//     out = clamp(raw * gain / GainOne + offset, 0, maxValue)
+//
+// with a gain and an offset per sensor pixel, and dead pixels replaced by the
+// mean of two corrected neighbours. The neighbours are worked out once when
+// the calibration is loaded, so correction is a branch-free pass over the
+// pixels plus a walk down a short list.
+//
+// Calibration files are mapped read-only: a CalibrationFileHeader, then
+// width * height gains (uint16, GainOne = 1.0), width * height offsets
+// (int16, in sensor counts), then deadCount dead pixel indices (uint32,
+// y * width + x, ascending).
+struct CalibrationFileHeader
+{
+    char magic[8];          // "OWLNUC1"
+    uint32_t width;
+    uint32_t height;
+    uint32_t deadCount;
+    uint32_t reserved[3];
+};
+
+class Calibration
+{
+public:
+    enum { GainShift = 14, GainOne = 1 << GainShift };
+
+    // unity gain, no offset, no dead pixels
+    Calibration(int width, int height);
+    ~Calibration();
+    Calibration(const Calibration&) = delete;
+    Calibration &operator=(const Calibration&) = delete;
+
+    // nullptr and error set when path is not a usable calibration file
+    static Calibration *load(const QString &path, QString &error);
+    // a copy that owns its maps, to be saved while the original stays in use
+    Calibration *clone() const;
+    bool save(const QString &path, QString &error) const;
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+    const uint16_t *gains() const { return m_gain; }
+    const int16_t *offsets() const { return m_offset; }
+    const std::vector<uint32_t> &deadPixels() const { return m_dead; }
+    // replaces the offset map, e.g. with one from a flat field
+    void setOffsets(std::vector<int16_t> &&offsets);
+
+    // rows [rowBegin, rowEnd) of rect, relative to its top, from a whole
+    // sensor frame into dst, whose first row is rect's first row; strides
+    // in pixels. Any number of bands in parallel.
+    void correctRows(const uint16_t *src, int srcStride, const QRect &rect, int maxValue,
+                     uint16_t *dst, int dstStride, int rowBegin, int rowEnd) const;
+    // then, once all rows are done: dead pixels inside rect
+    void replaceDeadPixels(const uint16_t *src, int srcStride, const QRect &rect, int maxValue,
+                           uint16_t *dst, int dstStride) const;
+
+private:
+    struct Replacement {
+        uint32_t pixel;
+        uint32_t a; // neighbours to average; a == b when only one is good
+        uint32_t b;
+    };
+
+    void findReplacements();
+    int corrected(const uint16_t *src, int srcStride, uint32_t pixel, int maxValue) const;
+
+    int m_width;
+    int m_height;
+    // maps are either in the file mapping or owned
+    void *m_map{nullptr};
+    size_t m_mapBytes{0};
+    const uint16_t *m_gain{nullptr};
+    const int16_t *m_offset{nullptr};
+    std::vector<uint16_t> m_ownGain;
+    std::vector<int16_t> m_ownOffset;
+    std::vector<uint32_t> m_dead;
+    std::vector<Replacement> m_replacements; // by pixel
+};
+
+// Averages whole sensor frames of a uniform scene (lens cap, shutter, flat
+// target) into a new offset map that flattens them under a calibration's
+// gains. Bands of a frame can be added in parallel.
+class FlatField
+{
+public:
+    void begin(int width, int height, int frames);
+    void cancel();
+    bool running() const { return m_remaining > 0; }
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    void accumulateRows(const uint16_t *src, int srcStride, int rowBegin, int rowEnd);
+    // after all bands of a frame; true once the last frame is in
+    bool frameDone() { return --m_remaining == 0; }
+    // offsets that bring every good pixel of the average to the mean
+    // corrected level; frees the sums
+    std::vector<int16_t> takeOffsets(const Calibration &calibration);
+
+private:
+    int m_width{0};
+    int m_height{0};
+    int m_frames{0};
+    int m_remaining{0};
+    std::vector<uint32_t> m_sum;
+};
+
+// One row through the gains and offsets
+void nucRow(const uint16_t *src, const uint16_t *gain, const int16_t *offset, int maxValue,
+            uint16_t *dst, int width);
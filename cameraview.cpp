@@ -0,0 +1,326 @@
+#include "cameraview.h"
+#include "yuvnode.h"
+#include "framestats.h"
+#include <QQuickWindow>
+#include <QSGImageNode>
+#include <QSGRendererInterface>
+#include <QSGTexture>
+#include <QMetaObject>
+#include <QtMath>
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#define OWLET_PERSISTENT_GL_TEXTURE 1
+#endif
+
+#ifdef OWLET_PERSISTENT_GL_TEXTURE
+// Texture that keeps one GL object for the whole stream: a new frame is only
+// staged by setImage() and copied with glTexSubImage2D on the next bind().
+// The staged QImage (a pooled camera buffer) is released right after upload.
+class CameraTexture : public QSGTexture
+{
+public:
+    ~CameraTexture() override
+    {
+        QOpenGLContext *ctx = QOpenGLContext::currentContext();
+        if (m_id && ctx) ctx->functions()->glDeleteTextures(1, &m_id);
+    }
+
+    void setImage(const QImage &img, FrameStats *stats, const FrameTiming &timing)
+    {
+        m_pending = (img.format() == QImage::Format_RGB888) ? img : img.convertToFormat(QImage::Format_RGB888);
+        m_size = m_pending.size();
+        m_stats = stats;
+        m_timing = timing;
+    }
+
+    int textureId() const override { return (int)m_id; }
+    QSize textureSize() const override { return m_size; }
+    bool hasAlphaChannel() const override { return false; }
+    bool hasMipmaps() const override { return false; }
+
+    void bind() override
+    {
+        QOpenGLFunctions *gl = QOpenGLContext::currentContext()->functions();
+        const bool created = (m_id == 0);
+        if (created) gl->glGenTextures(1, &m_id);
+        gl->glBindTexture(GL_TEXTURE_2D, m_id);
+        updateBindOptions(created);
+        if (m_pending.isNull()) return;
+
+        const int w = m_pending.width();
+        const int h = m_pending.height();
+        gl->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+        if (m_allocated != m_pending.size()) {
+            gl->glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, w, h, 0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+            m_allocated = m_pending.size();
+        }
+        if (m_pending.bytesPerLine() == w * 3) {
+            gl->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, GL_RGB, GL_UNSIGNED_BYTE, m_pending.constBits());
+        } else {
+            // padded rows and no GL_UNPACK_ROW_LENGTH on GLES2: one row at a time
+            for (int y = 0; y < h; ++y) {
+                gl->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, w, 1, GL_RGB, GL_UNSIGNED_BYTE, m_pending.constScanLine(y));
+            }
+        }
+        gl->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        m_pending = QImage();
+        if (m_stats) m_stats->recordDisplay(m_timing, monotonicNs());
+        m_stats = nullptr;
+    }
+
+private:
+    GLuint m_id{0};
+    QSize m_size;
+    QSize m_allocated;
+    QImage m_pending;
+    FrameStats *m_stats{nullptr};
+    FrameTiming m_timing;
+};
+#endif
+
+// Root node of the item. Holds an image node for RGB frames and, when the
+// scene graph runs on OpenGL, a YuvNode for raw frames; only the one matching
+// the last frame is given a non-empty rect. Lives and dies on the render thread.
+class CameraNode : public QSGNode
+{
+public:
+    ~CameraNode() override
+    {
+        delete m_texture;
+    }
+
+    QSize frameSize() const { return m_frameSize; }
+
+    // stats, if given, gets the upload time of the frame
+    void setFrame(QQuickWindow *window, const VideoFrame &frame, FrameStats *stats)
+    {
+#ifdef OWLET_HAVE_YUV_NODE
+        if (frame.raw && YuvNode::supports(frame.raw->pixelFormat)) {
+            if (!m_yuv) {
+                m_yuv = new YuvNode;
+                appendChildNode(m_yuv);
+            }
+            m_yuv->setFrame(frame.raw, stats, frame.timing);
+            m_frameSize = frame.size();
+            m_showYuv = true;
+            return;
+        }
+#endif
+        if (frame.image.isNull()) return;
+        if (!m_image) {
+            m_image = window->createImageNode();
+            m_image->setFiltering(QSGTexture::Linear);
+            appendChildNode(m_image);
+        }
+        m_frameSize = frame.image.size();
+        m_showYuv = false;
+
+#ifdef OWLET_PERSISTENT_GL_TEXTURE
+        if (window->rendererInterface()->graphicsApi() == QSGRendererInterface::OpenGL) {
+            if (!m_glTexture) {
+                m_glTexture = new CameraTexture;
+                m_texture = m_glTexture;
+                m_image->setTexture(m_texture);
+            }
+            m_glTexture->setImage(frame.image, stats, frame.timing);
+            m_image->markDirty(QSGNode::DirtyMaterial);
+            return;
+        }
+#endif
+        // software backend (and Qt 6): the texture just wraps the image
+        QSGTexture *old = m_texture;
+        m_texture = window->createTextureFromImage(frame.image, QQuickWindow::TextureIsOpaque);
+        m_image->setTexture(m_texture);
+        delete old;
+        if (stats) stats->recordDisplay(frame.timing, monotonicNs());
+    }
+
+    // target in item coordinates, source in frame pixels
+    void setRects(const QRectF &target, const QRectF &source)
+    {
+        const QRectF none;
+        if (m_image) {
+            m_image->setRect(m_showYuv ? none : target);
+            m_image->setSourceRect(source);
+        }
+#ifdef OWLET_HAVE_YUV_NODE
+        if (m_yuv) {
+            const qreal w = m_frameSize.width(), h = m_frameSize.height();
+            m_yuv->setRects(m_showYuv ? target : none,
+                            QRectF(source.x() / w, source.y() / h, source.width() / w, source.height() / h));
+        }
+#endif
+    }
+
+private:
+    QSGImageNode *m_image{nullptr};
+    QSGTexture *m_texture{nullptr};
+#ifdef OWLET_PERSISTENT_GL_TEXTURE
+    CameraTexture *m_glTexture{nullptr};
+#endif
+#ifdef OWLET_HAVE_YUV_NODE
+    YuvNode *m_yuv{nullptr};
+#endif
+    bool m_showYuv{false};
+    QSize m_frameSize;
+};
+
+CameraView::CameraView(QQuickItem *parent)
+    : QQuickItem(parent)
+{
+    setFlag(ItemHasContents, true);
+    connect(this, &QQuickItem::widthChanged, this, &CameraView::updateViewport);
+    connect(this, &QQuickItem::heightChanged, this, &CameraView::updateViewport);
+    connect(this, &QQuickItem::windowChanged, this, &CameraView::updateViewport);
+}
+
+void CameraView::setCamera(V4L2Camera *camera)
+{
+    if (m_camera == camera) return;
+    if (m_camera) disconnect(m_camera, nullptr, this, nullptr);
+    m_camera = camera;
+    if (m_camera) {
+        connect(m_camera, &V4L2Camera::frameAvailable, this, &CameraView::onFrameAvailable);
+        // a notification sent before we were connected is still pending; re-arm it
+        onFrameAvailable();
+        updateViewport();
+    }
+    emit cameraChanged();
+}
+
+void CameraView::setYuvShaders(bool enabled)
+{
+    if (m_yuvShaders == enabled) return;
+    m_yuvShaders = enabled;
+    update();
+    emit yuvShadersChanged();
+}
+
+void CameraView::setFillMode(FillMode mode)
+{
+    if (m_fillMode == mode) return;
+    m_fillMode = mode;
+    updateViewport();
+    update();
+    emit fillModeChanged();
+}
+
+void CameraView::setZoom(qreal zoom)
+{
+    zoom = qBound(1.0, zoom, 16.0);
+    if (qFuzzyCompare(m_zoom, zoom)) return;
+    m_zoom = zoom;
+    updateViewport();
+    emit zoomChanged();
+}
+
+// pixels outside the item are never drawn, so they need not be converted,
+// and there is no point in converting more of them than the item has
+void CameraView::updateViewport()
+{
+    if (!m_camera) return;
+    QRectF crop;
+    if (m_zoom > 1.0) {
+        const qreal side = 1.0 / m_zoom;
+        crop = QRectF((1.0 - side) / 2, (1.0 - side) / 2, side, side);
+    }
+    const bool fill = m_fillMode == PreserveAspectCrop && width() > 0 && height() > 0;
+    m_camera->setCrop(crop, fill ? width() / height() : 0);
+    const qreal dpr = window() ? window()->effectiveDevicePixelRatio() : 1.0;
+    m_camera->setOutputSize(QSize(qCeil(width() * dpr), qCeil(height() * dpr)));
+}
+
+void CameraView::onFrameAvailable()
+{
+    if (!m_camera) return;
+    m_camera->mailbox()->acknowledge();
+    update();
+}
+
+void CameraView::onFrameSizeSynced()
+{
+    if (m_frameSize == m_syncedFrameSize) return;
+    m_frameSize = m_syncedFrameSize;
+    emit frameSizeChanged();
+}
+
+// target rectangle in item coordinates and source rectangle in texture pixels
+static void layoutRects(const QSizeF &frame, const QRectF &bounds, CameraView::FillMode mode,
+                        QRectF &target, QRectF &source)
+{
+    target = bounds;
+    source = QRectF(0, 0, frame.width(), frame.height());
+    if (mode == CameraView::Stretch || frame.width() <= 0 || frame.height() <= 0) return;
+
+    const qreal sx = bounds.width() / frame.width();
+    const qreal sy = bounds.height() / frame.height();
+    if (mode == CameraView::PreserveAspectFit) {
+        const qreal s = qMin(sx, sy);
+        const qreal w = frame.width() * s;
+        const qreal h = frame.height() * s;
+        target = QRectF(bounds.x() + (bounds.width() - w) / 2, bounds.y() + (bounds.height() - h) / 2, w, h);
+    } else {
+        // crop through the source rect so nothing outside the item is drawn
+        const qreal s = qMax(sx, sy);
+        const qreal w = bounds.width() / s;
+        const qreal h = bounds.height() / s;
+        source = QRectF((frame.width() - w) / 2, (frame.height() - h) / 2, w, h);
+    }
+}
+
+QPointF CameraView::mapFromFrame(const QPointF &normalized) const
+{
+    if (m_frameSize.isEmpty()) return QPointF();
+    QRectF target, source;
+    layoutRects(QSizeF(m_frameSize), boundingRect(), m_fillMode, target, source);
+    const qreal fx = normalized.x() * m_frameSize.width();
+    const qreal fy = normalized.y() * m_frameSize.height();
+    return QPointF(target.x() + (fx - source.x()) * target.width() / source.width(),
+                   target.y() + (fy - source.y()) * target.height() / source.height());
+}
+
+QSGNode *CameraView::updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data)
+{
+    Q_UNUSED(data)
+    CameraNode *node = static_cast<CameraNode*>(oldNode);
+
+    // raw frames only when they can be drawn here: shaders need the OpenGL
+    // backend, everything else (software backend, Qt 6) gets converted frames
+#ifdef OWLET_HAVE_YUV_NODE
+    const bool gpuYuv = m_yuvShaders && window()->rendererInterface()->graphicsApi() == QSGRendererInterface::OpenGL;
+#else
+    const bool gpuYuv = false;
+#endif
+    if (m_camera) m_camera->setRawOutput(gpuYuv);
+
+    // runs on the render thread while the GUI thread is blocked: this is the
+    // mailbox's single consumer
+    VideoFrame frame;
+    bool fresh = m_camera && m_camera->mailbox()->take(frame);
+    if (fresh && frame.timing.valid()) frame.timing.takeNs = monotonicNs();
+    if (fresh && frame.deferred()) {
+        // lazy conversion: this frame is about to be shown
+        m_camera->convertDeferred(frame);
+        fresh = !frame.isNull();
+    }
+    if (!node) {
+        if (!fresh) return nullptr;
+        node = new CameraNode;
+    }
+    if (fresh) {
+        FrameStats *stats = frame.timing.valid() ? m_camera->stats() : nullptr;
+        node->setFrame(window(), frame, stats);
+        if (node->frameSize() != m_syncedFrameSize) {
+            m_syncedFrameSize = node->frameSize();
+            QMetaObject::invokeMethod(this, "onFrameSizeSynced", Qt::QueuedConnection);
+        }
+    }
+    if (node->frameSize().isEmpty()) return node;
+
+    QRectF target, source;
+    layoutRects(QSizeF(node->frameSize()), boundingRect(), m_fillMode, target, source);
+    node->setRects(target, source);
+    return node;
+}
@@ -0,0 +1,75 @@
+#pragma once
+
+#include <QQuickItem>
+#include <QPointer>
+#include <QImage>
+
+#include "v4l2camera.h"
+
+// Scene-graph item that shows the newest frame of a V4L2Camera. Frames are
+// taken straight from the camera mailbox during the sync phase. On OpenGL the
+// camera hands over raw YUV buffers that a shader converts (yuvShaders), or
+// RGB frames go into one persistent texture; on the software backend RGB
+// frames are wrapped as software textures.
+class CameraView : public QQuickItem
+{
+    Q_OBJECT
+    Q_PROPERTY(V4L2Camera *camera READ camera WRITE setCamera NOTIFY cameraChanged)
+    Q_PROPERTY(FillMode fillMode READ fillMode WRITE setFillMode NOTIFY fillModeChanged)
+    Q_PROPERTY(bool yuvShaders READ yuvShaders WRITE setYuvShaders NOTIFY yuvShadersChanged)
+    Q_PROPERTY(QSize frameSize READ frameSize NOTIFY frameSizeChanged)
+    Q_PROPERTY(qreal zoom READ zoom WRITE setZoom NOTIFY zoomChanged)
+public:
+    enum FillMode { Stretch, PreserveAspectFit, PreserveAspectCrop };
+    Q_ENUM(FillMode)
+
+    explicit CameraView(QQuickItem *parent = nullptr);
+
+    V4L2Camera *camera() const { return m_camera; }
+    void setCamera(V4L2Camera *camera);
+
+    FillMode fillMode() const { return m_fillMode; }
+    void setFillMode(FillMode mode);
+
+    // convert raw YUV frames on the GPU when the scene graph allows it
+    bool yuvShaders() const { return m_yuvShaders; }
+    void setYuvShaders(bool enabled);
+
+    QSize frameSize() const { return m_frameSize; }
+
+    // Digital zoom around the frame centre, 1 = the whole frame. The camera
+    // is asked to convert only what this item shows: the zoomed region,
+    // trimmed to the item's shape under PreserveAspectCrop, and scaled down
+    // towards the item's size in device pixels. frameSize and mapFromFrame()
+    // refer to the frames as delivered, i.e. to that region.
+    qreal zoom() const { return m_zoom; }
+    void setZoom(qreal zoom);
+
+    // point in normalized frame coordinates (0..1) -> item coordinates,
+    // following the current fill mode
+    Q_INVOKABLE QPointF mapFromFrame(const QPointF &normalized) const;
+
+signals:
+    void cameraChanged();
+    void fillModeChanged();
+    void yuvShadersChanged();
+    void frameSizeChanged();
+    void zoomChanged();
+
+protected:
+    QSGNode *updatePaintNode(QSGNode *oldNode, UpdatePaintNodeData *data) override;
+
+private slots:
+    void onFrameAvailable();
+    void onFrameSizeSynced();
+
+private:
+    void updateViewport();
+
+    QPointer<V4L2Camera> m_camera;
+    FillMode m_fillMode{PreserveAspectCrop};
+    bool m_yuvShaders{true};
+    qreal m_zoom{1.0};
+    QSize m_frameSize;
+    QSize m_syncedFrameSize; // written during sync, read on the GUI thread afterwards
+};
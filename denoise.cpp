@@ -0,0 +1,139 @@
+#include "denoise.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OWLET_DENOISE_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OWLET_DENOISE_NEON 1
+#endif
+
+enum { AlphaOne = 32767 }; // Q15
+
+void TemporalDenoiser::configure(int width, int height, int strength, int threshold)
+{
+    strength = strength < 1 ? 1 : (strength > MaxStrength ? (int)MaxStrength : strength);
+    m_minAlpha = AlphaOne * MaxStrength / (MaxStrength + 15 * strength);
+    m_threshold = threshold < 1 ? 1 : (threshold > MaxThreshold ? (int)MaxThreshold : threshold);
+    if (width == m_width && height == m_height) return;
+    m_width = width;
+    m_height = height;
+    m_acc.assign((size_t)width * height, 0);
+    m_primed = false;
+}
+
+void TemporalDenoiser::filterRows(const uint8_t *const *rows, int row, int count, uint8_t *out, int outStride)
+{
+    const int w = m_width;
+    const int blocks = (w + BlockSize - 1) / BlockSize;
+    uint16_t *acc = &m_acc[(size_t)row * w];
+
+    // sum of absolute differences against the accumulator, per block
+    static thread_local std::vector<uint32_t> sad;
+    static thread_local std::vector<int16_t> alpha;
+    if ((int)sad.size() < blocks + 1) {
+        sad.resize(blocks + 1);
+        alpha.resize(blocks + 1);
+    }
+    int x = 0;
+    if (m_primed) {
+#if defined(OWLET_DENOISE_SSE2)
+        const __m128i eight = _mm_set1_epi16(8);
+        for (; x + 16 <= w; x += 16) {
+            __m128i sum = _mm_setzero_si128();
+            for (int r = 0; r < count; ++r) {
+                const uint16_t *a = acc + (size_t)r * w + x;
+                const __m128i prev = _mm_packus_epi16(
+                    _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a)), eight), 4),
+                    _mm_srli_epi16(_mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + 8)), eight), 4));
+                const __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(rows[r] + x));
+                // one 64-bit lane per 8-pixel block
+                sum = _mm_add_epi64(sum, _mm_sad_epu8(cur, prev));
+            }
+            sad[x / BlockSize] = (uint32_t)_mm_cvtsi128_si32(sum);
+            sad[x / BlockSize + 1] = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(sum, 8));
+        }
+#elif defined(OWLET_DENOISE_NEON)
+        for (; x + 16 <= w; x += 16) {
+            uint16x8_t sum = vdupq_n_u16(0);
+            for (int r = 0; r < count; ++r) {
+                const uint16_t *a = acc + (size_t)r * w + x;
+                const uint8x16_t prev = vcombine_u8(vrshrn_n_u16(vld1q_u16(a), 4), vrshrn_n_u16(vld1q_u16(a + 8), 4));
+                sum = vpadalq_u8(sum, vabdq_u8(vld1q_u8(rows[r] + x), prev));
+            }
+            // lanes 0..3 are the first block, 4..7 the second
+            const uint64x2_t blockSums = vpaddlq_u32(vpaddlq_u16(sum));
+            sad[x / BlockSize] = (uint32_t)vgetq_lane_u64(blockSums, 0);
+            sad[x / BlockSize + 1] = (uint32_t)vgetq_lane_u64(blockSums, 1);
+        }
+#endif
+        for (int b = x / BlockSize; b < blocks; ++b) sad[b] = 0;
+        for (int r = 0; r < count; ++r) {
+            const uint16_t *a = acc + (size_t)r * w;
+            for (int i = x; i < w; ++i) {
+                const int d = rows[r][i] - ((a[i] + 8) >> 4);
+                sad[i / BlockSize] += d < 0 ? -d : d;
+            }
+        }
+    }
+
+    // mean difference per block, in 1/16 levels, to alpha
+    const int low = m_threshold << 4;
+    for (int b = 0; b < blocks; ++b) {
+        if (!m_primed) {
+            alpha[b] = AlphaOne;
+            continue;
+        }
+        const int pixels = ((b + 1) * BlockSize <= w ? (int)BlockSize : w - b * BlockSize) * count;
+        const int mad = (int)((sad[b] << 4) / pixels);
+        if (mad <= low) alpha[b] = (int16_t)m_minAlpha;
+        else if (mad >= 3 * low) alpha[b] = AlphaOne;
+        else alpha[b] = (int16_t)(m_minAlpha + (AlphaOne - m_minAlpha) * (mad - low) / (2 * low));
+    }
+
+    // acc += alpha * (y - acc), the product's high half like mulhi/vqdmulh
+    for (int r = 0; r < count; ++r) {
+        const uint8_t *src = rows[r];
+        uint16_t *a = acc + (size_t)r * w;
+        uint8_t *dst = out + (size_t)r * outStride;
+        x = 0;
+#if defined(OWLET_DENOISE_SSE2)
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i eight = _mm_set1_epi16(8);
+        for (; x + 16 <= w; x += 16) {
+            const __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + x));
+            __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x));
+            __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + x + 8));
+            const __m128i dLo = _mm_sub_epi16(_mm_slli_epi16(_mm_unpacklo_epi8(cur, zero), 4), lo);
+            const __m128i dHi = _mm_sub_epi16(_mm_slli_epi16(_mm_unpackhi_epi8(cur, zero), 4), hi);
+            lo = _mm_add_epi16(lo, _mm_mulhi_epi16(_mm_slli_epi16(dLo, 1), _mm_set1_epi16(alpha[x / BlockSize])));
+            hi = _mm_add_epi16(hi, _mm_mulhi_epi16(_mm_slli_epi16(dHi, 1), _mm_set1_epi16(alpha[x / BlockSize + 1])));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(a + x), lo);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(a + x + 8), hi);
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x),
+                             _mm_packus_epi16(_mm_srli_epi16(_mm_add_epi16(lo, eight), 4),
+                                              _mm_srli_epi16(_mm_add_epi16(hi, eight), 4)));
+        }
+#elif defined(OWLET_DENOISE_NEON)
+        for (; x + 16 <= w; x += 16) {
+            const uint8x16_t cur = vld1q_u8(src + x);
+            int16x8_t lo = vreinterpretq_s16_u16(vld1q_u16(a + x));
+            int16x8_t hi = vreinterpretq_s16_u16(vld1q_u16(a + x + 8));
+            const int16x8_t dLo = vsubq_s16(vreinterpretq_s16_u16(vshll_n_u8(vget_low_u8(cur), 4)), lo);
+            const int16x8_t dHi = vsubq_s16(vreinterpretq_s16_u16(vshll_n_u8(vget_high_u8(cur), 4)), hi);
+            lo = vaddq_s16(lo, vqdmulhq_s16(dLo, vdupq_n_s16(alpha[x / BlockSize])));
+            hi = vaddq_s16(hi, vqdmulhq_s16(dHi, vdupq_n_s16(alpha[x / BlockSize + 1])));
+            vst1q_u16(a + x, vreinterpretq_u16_s16(lo));
+            vst1q_u16(a + x + 8, vreinterpretq_u16_s16(hi));
+            vst1q_u8(dst + x, vcombine_u8(vrshrn_n_u16(vreinterpretq_u16_s16(lo), 4),
+                                          vrshrn_n_u16(vreinterpretq_u16_s16(hi), 4)));
+        }
+#endif
+        for (; x < w; ++x) {
+            const int d = (src[x] << 4) - a[x];
+            const int v = a[x] + ((2 * d * alpha[x / BlockSize]) >> 16);
+            a[x] = (uint16_t)v;
+            dst[x] = (uint8_t)((v + 8) >> 4);
+        }
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Motion-adaptive recursive temporal filter on luma:
+// acc += alpha * (y - acc), out = acc, with alpha chosen per 8x8 block.
+//
+// The accumulator is one 16-bit frame in 12.4 fixed point at the
+// conversion's output size, row-major and unpadded. It is filtered a strip of
+// BlockSize rows at a time from inside the conversion bands: each strip's
+// blocks are first compared with the accumulator (sum of absolute
+// differences, 16 pixels per SSE2/NEON step, one SAD lane per block) and then
+// blended, so the source rows and the 20 KB or so of accumulator behind a
+// strip are still in cache for the second look and a frame is traversed
+// once. Blocks whose mean difference stays under the threshold are blended
+// at the full strength; above it alpha ramps up to 1 (the new pixel as is)
+// at three times the threshold, so moving objects do not leave ghosts.
+// Results are identical to the scalar code.
+//
+// One instance belongs to the camera. Bands filter disjoint strips in
+// parallel; configure() and frameDone() run on the capture thread around a
+// frame.
+class TemporalDenoiser
+{
+public:
+    enum { BlockSize = 8 };
+    enum { MaxStrength = 100, MaxThreshold = 64 };
+
+    // capture thread, before a frame: output size and parameters. strength
+    // 1..MaxStrength sets the weight of the accumulator on static blocks
+    // (100: alpha = 1/16); threshold is the mean absolute luma difference per
+    // block that counts as motion. A new size starts over from the next
+    // frame.
+    void configure(int width, int height, int strength, int threshold);
+    // forget the accumulator: the next frame passes through unfiltered and
+    // seeds it (new crop, filter turned back on, new stream)
+    void reset() { m_primed = false; }
+    // capture thread, after all bands of a frame have finished
+    void frameDone() { m_primed = true; }
+
+    // filters count (<= BlockSize) rows starting at row, a multiple of
+    // BlockSize: rows are 8-bit luma, out gets count rows of width bytes,
+    // outStride apart
+    void filterRows(const uint8_t *const *rows, int row, int count, uint8_t *out, int outStride);
+
+    int width() const { return m_width; }
+
+private:
+    int m_width{0};
+    int m_height{0};
+    int m_minAlpha{32767}; // Q15, on blocks without motion
+    int m_threshold{8};
+    bool m_primed{false};
+    std::vector<uint16_t> m_acc; // width * height, 12.4 fixed point
+};
@@ -0,0 +1,306 @@
+#include "framehistory.h"
+#include "rawrecorder.h"
+#include <linux/videodev2.h>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <QDateTime>
+#include <QDebug>
+
+FrameHistory::FrameHistory(size_t budgetBytes, QObject *parent)
+    : QObject(parent), m_budget(budgetBytes)
+{
+    void *arena = nullptr;
+    if (budgetBytes && posix_memalign(&arena, RawRecorder::BlockBytes, budgetBytes) != 0) {
+        qWarning() << "Frame history: cannot allocate" << budgetBytes / (1 << 20) << "MiB, history is off";
+        arena = nullptr;
+    }
+    m_arena = static_cast<uchar*>(arena);
+}
+
+FrameHistory::~FrameHistory()
+{
+    if (m_dumpThread.joinable()) m_dumpThread.join();
+    free(m_arena);
+}
+
+// capture thread, under m_mutex: slots for the new format, all empty
+void FrameHistory::reset(const RawFrame &frame, int frameBytes)
+{
+    m_pixfmt = frame.pixelFormat;
+    m_width = frame.width;
+    m_height = frame.height;
+    m_frameBytes = frameBytes;
+    const size_t count = m_budget / frameBytes;
+    m_slots.assign(count, Slot());
+    m_dumpOrder.reserve(count);
+    m_head = 0;
+    m_pinned = -1;
+    qDebug() << "Frame history:" << count << "frames of" << m_width << "x" << m_height;
+}
+
+void FrameHistory::submit(const RawFrame &frame, uint32_t sequence, qint64 timestampNs)
+{
+    if (!m_arena || frozen()) return;
+    const int bytes = rawFrameBytes(frame);
+    if (!bytes) return;
+
+    int slot;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_frozen || m_dumping) return;
+        if (frame.pixelFormat != m_pixfmt || frame.width != m_width || frame.height != m_height) {
+            reset(frame, bytes);
+        }
+        if (m_slots.empty()) return; // the budget does not hold one frame
+        // the oldest slot, out of the history while it is overwritten
+        slot = m_head;
+        m_slots[slot].valid = false;
+        m_head = (m_head + 1) % (int)m_slots.size();
+    }
+    packRawFrame(frame, m_arena + (size_t)slot * m_frameBytes);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Slot &s = m_slots[slot];
+    s.sequence = sequence;
+    s.timestampNs = timestampNs;
+    s.valid = true;
+}
+
+bool FrameHistory::pinned(uint32_t pixelFormat, int width, int height, SourceBuffer &buf) const
+{
+    if (!frozen()) return false;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_pinned < 0 || pixelFormat != m_pixfmt || width != m_width || height != m_height) return false;
+    const uchar *data = m_arena + (size_t)m_pinned * m_frameBytes;
+    const bool semiPlanar = (m_pixfmt == V4L2_PIX_FMT_NV12 || m_pixfmt == V4L2_PIX_FMT_NV21);
+    const bool wide = !semiPlanar && m_pixfmt != V4L2_PIX_FMT_GREY;
+    buf.index = -1;
+    buf.planeCount = 1;
+    buf.planes[0] = data;
+    buf.bytesPerLine[0] = m_width * (wide ? 2 : 1);
+    if (semiPlanar) {
+        buf.planeCount = 2;
+        buf.planes[1] = data + (size_t)m_width * m_height;
+        buf.bytesPerLine[1] = m_width;
+    }
+    buf.sequence = m_slots[m_pinned].sequence;
+    buf.timestampNs = m_slots[m_pinned].timestampNs;
+    return true;
+}
+
+// slots in time order run from m_head round to m_head - 1
+int FrameHistory::newestLocked() const
+{
+    const int n = (int)m_slots.size();
+    for (int i = 1; i <= n; ++i) {
+        const int slot = (m_head - i + n) % n;
+        if (m_slots[slot].valid) return slot;
+    }
+    return -1;
+}
+
+int FrameHistory::oldestLocked() const
+{
+    const int n = (int)m_slots.size();
+    for (int i = 0; i < n; ++i) {
+        const int slot = (m_head + i) % n;
+        if (m_slots[slot].valid) return slot;
+    }
+    return -1;
+}
+
+int FrameHistory::stepLocked(int slot, int frames) const
+{
+    const int n = (int)m_slots.size();
+    int order = (slot - m_head + n) % n;
+    const int dir = frames < 0 ? -1 : 1;
+    for (int i = 0; i != frames; i += dir) {
+        const int next = order + dir;
+        if (next < 0 || next >= n || !m_slots[(m_head + next) % n].valid) break;
+        order = next;
+    }
+    return (m_head + order) % n;
+}
+
+void FrameHistory::pinLocked(int slot)
+{
+    m_pinned = slot;
+    const int newest = newestLocked();
+    m_position = (slot >= 0 && newest >= 0)
+        ? (m_slots[slot].timestampNs - m_slots[newest].timestampNs) / 1e9 : 0.0;
+}
+
+void FrameHistory::setFrozen(bool frozen)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_frozen == frozen) return;
+        if (frozen) {
+            const int newest = newestLocked();
+            if (newest < 0) return; // nothing to show yet
+            m_frozen = true;
+            pinLocked(newest);
+        } else {
+            m_frozen = false;
+            pinLocked(-1);
+        }
+    }
+    emit frozenChanged();
+    emit positionChanged();
+}
+
+double FrameHistory::position() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_position;
+}
+
+int FrameHistory::frames() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    int count = 0;
+    for (const Slot &slot : m_slots) count += slot.valid;
+    return count;
+}
+
+double FrameHistory::span() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const int oldest = oldestLocked();
+    const int newest = newestLocked();
+    if (oldest < 0) return 0.0;
+    return (m_slots[newest].timestampNs - m_slots[oldest].timestampNs) / 1e9;
+}
+
+bool FrameHistory::dumping() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_dumping;
+}
+
+bool FrameHistory::seek(qint64 timestampNs)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_frozen) return false;
+        int best = -1;
+        qint64 bestDistance = 0;
+        for (int i = 0; i < (int)m_slots.size(); ++i) {
+            if (!m_slots[i].valid) continue;
+            const qint64 distance = qAbs(m_slots[i].timestampNs - timestampNs);
+            if (best < 0 || distance < bestDistance) {
+                best = i;
+                bestDistance = distance;
+            }
+        }
+        if (best < 0) return false;
+        pinLocked(best);
+    }
+    emit positionChanged();
+    return true;
+}
+
+bool FrameHistory::seekBack(double seconds)
+{
+    qint64 newestNs;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        const int newest = newestLocked();
+        if (!m_frozen || newest < 0) return false;
+        newestNs = m_slots[newest].timestampNs;
+    }
+    return seek(newestNs - (qint64)(seconds * 1e9));
+}
+
+void FrameHistory::step(int frames)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_frozen || m_pinned < 0) return;
+        pinLocked(stepLocked(m_pinned, frames));
+    }
+    emit positionChanged();
+}
+
+bool FrameHistory::dump(const QString &path)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_dumping || m_slots.empty()) return false;
+        m_dumpOrder.clear();
+        const int n = (int)m_slots.size();
+        for (int i = 0; i < n; ++i) {
+            const int slot = (m_head + i) % n;
+            if (m_slots[slot].valid) m_dumpOrder.push_back(slot);
+        }
+        if (m_dumpOrder.empty()) return false;
+        m_dumping = true;
+    }
+    // a finished dump's thread is still joinable
+    if (m_dumpThread.joinable()) m_dumpThread.join();
+    const QString file = path.isEmpty()
+        ? QDateTime::currentDateTime().toString("'owlet-'yyyyMMdd-hhmmss'-history.raw'") : path;
+    m_dumpThread = std::thread(&FrameHistory::writeDump, this, file);
+    emit dumpingChanged();
+    return true;
+}
+
+// dump thread: the held slots cannot change until m_dumping is cleared
+void FrameHistory::writeDump(const QString &path)
+{
+    static const uchar zeros[RawRecorder::BlockBytes] = {};
+    const size_t block = RawRecorder::BlockBytes;
+    const QString indexPath = path + ".idx";
+    QString error;
+    FILE *data = fopen(path.toLocal8Bit().constData(), "wb");
+    FILE *index = data ? fopen(indexPath.toLocal8Bit().constData(), "wb") : nullptr;
+    if (!data || !index) {
+        error = QString("Frame history: cannot create %1: %2").arg(data ? indexPath : path).arg(strerror(errno));
+    } else {
+        RawFileHeader header;
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, "OWLRAW1", 8);
+        header.pixelFormat = m_pixfmt;
+        header.width = m_width;
+        header.height = m_height;
+        header.frameBytes = m_frameBytes;
+        fwrite(&header, sizeof(header), 1, data);
+        fwrite(zeros, block - sizeof(header), 1, data);
+
+        // one frame per chunk
+        uint64_t offset = block;
+        const size_t chunkBytes = sizeof(RawChunkHeader) + m_frameBytes;
+        const size_t padding = (block - chunkBytes % block) % block;
+        for (int slot : m_dumpOrder) {
+            RawChunkHeader chunk;
+            memcpy(chunk.magic, "OWLC", 4);
+            chunk.frames = 1;
+            chunk.payloadBytes = m_frameBytes;
+            fwrite(&chunk, sizeof(chunk), 1, data);
+            fwrite(m_arena + (size_t)slot * m_frameBytes, m_frameBytes, 1, data);
+            if (padding) fwrite(zeros, padding, 1, data);
+
+            RawIndexEntry entry;
+            entry.offset = offset + sizeof(RawChunkHeader);
+            entry.timestampNs = m_slots[slot].timestampNs;
+            entry.sequence = m_slots[slot].sequence;
+            entry.bytes = m_frameBytes;
+            fwrite(&entry, sizeof(entry), 1, index);
+            offset += chunkBytes + padding;
+        }
+        if (ferror(data) || ferror(index)) {
+            error = QString("Frame history: writing %1 failed").arg(path);
+        }
+    }
+    if (index && fclose(index) != 0 && error.isEmpty()) error = QString("Frame history: writing %1 failed").arg(indexPath);
+    if (data && fclose(data) != 0 && error.isEmpty()) error = QString("Frame history: writing %1 failed").arg(path);
+    if (error.isEmpty()) qDebug() << "Frame history:" << m_dumpOrder.size() << "frames dumped to" << path;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_dumping = false;
+    }
+    emit dumpingChanged();
+    emit dumpFinished(path, error);
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "framesource.h"
+
+// The last few seconds of raw sensor frames, for freezing the picture and
+// scrubbing back after an event. Frames are kept unpadded (as RawRecorder
+// stores them) in one arena allocated up front: the budget divided by the
+// frame size gives the number of slots, and storing a frame is a copy into
+// the oldest slot, never an allocation.
+//
+// Freezing pins the newest frame for display while capture carries on
+// (recording, tracking); the history stops taking frames until it is
+// thawed, so the window being scrubbed stays put. While frozen, seek() and
+// step() pick another held frame. dump() writes the window out in the
+// RawRecorder format on a thread of its own; the history is held for that
+// time as well.
+class FrameHistory : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool frozen READ frozen WRITE setFrozen NOTIFY frozenChanged)
+    // the pinned frame's age relative to the newest held frame, in seconds
+    // (0 or negative); 0 while live
+    Q_PROPERTY(double position READ position NOTIFY positionChanged)
+    // frames held and the time they span, as of the last freeze or seek
+    Q_PROPERTY(int frames READ frames NOTIFY positionChanged)
+    Q_PROPERTY(double span READ span NOTIFY positionChanged)
+    Q_PROPERTY(bool dumping READ dumping NOTIFY dumpingChanged)
+public:
+    explicit FrameHistory(size_t budgetBytes, QObject *parent = nullptr);
+    ~FrameHistory() override;
+
+    size_t budget() const { return m_budget; }
+
+    bool frozen() const { return m_frozen.load(std::memory_order_relaxed); }
+    void setFrozen(bool frozen);
+    double position() const;
+    int frames() const;
+    double span() const;
+    bool dumping() const;
+
+    // while frozen: pins the held frame closest to timestampNs
+    // (CLOCK_MONOTONIC), or the one seconds before the newest
+    Q_INVOKABLE bool seek(qint64 timestampNs);
+    Q_INVOKABLE bool seekBack(double seconds);
+    // while frozen: moves the pin by frames, negative is older
+    Q_INVOKABLE void step(int frames);
+    // writes every held frame, oldest first, to path (and path.idx); an
+    // empty path picks owlet-<date>-<time>-history.raw. False when a dump is
+    // already running or nothing is held.
+    Q_INVOKABLE bool dump(const QString &path = QString());
+
+    // capture thread: copies a whole frame into the oldest slot unless frozen
+    // or dumping; a new format empties the history
+    void submit(const RawFrame &frame, uint32_t sequence, qint64 timestampNs);
+    // capture thread, while frozen: the pinned frame as a buffer to convert;
+    // false if there is none of that format
+    bool pinned(uint32_t pixelFormat, int width, int height, SourceBuffer &buf) const;
+
+signals:
+    void frozenChanged();
+    void positionChanged();
+    void dumpingChanged();
+    void dumpFinished(const QString &path, const QString &error);
+
+private:
+    struct Slot {
+        uint32_t sequence{0};
+        qint64 timestampNs{0};
+        bool valid{false};
+    };
+
+    void reset(const RawFrame &frame, int frameBytes);
+    int newestLocked() const;
+    int oldestLocked() const;
+    int stepLocked(int slot, int frames) const;
+    void pinLocked(int slot);
+    void writeDump(const QString &path);
+
+    size_t m_budget;
+    uchar *m_arena{nullptr};
+
+    mutable std::mutex m_mutex; // everything below
+    // format of the held frames, frameBytes 0 while there are none
+    uint32_t m_pixfmt{0};
+    int m_width{0};
+    int m_height{0};
+    int m_frameBytes{0};
+    std::vector<Slot> m_slots; // sized per format, in arena order
+    int m_head{0};             // next slot to fill
+    int m_pinned{-1};
+    double m_position{0};
+    bool m_dumping{false};
+    std::vector<int> m_dumpOrder; // slots being dumped, oldest first
+
+    std::atomic<bool> m_frozen{false};
+    std::thread m_dumpThread;
+};
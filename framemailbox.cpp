@@ -0,0 +1,37 @@
+#include "framemailbox.h"
+
+FrameMailbox::FrameMailbox()
+{
+}
+
+bool FrameMailbox::publish(const VideoFrame &frame)
+{
+    m_slots[m_back] = frame;
+    int prev = m_state.exchange(m_back | FreshBit, std::memory_order_acq_rel);
+    m_back = prev & ~FreshBit;
+    if (prev & FreshBit) {
+        m_dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    // give an overwritten frame back to its pool (or the driver) right away
+    m_slots[m_back] = VideoFrame();
+    m_published.fetch_add(1, std::memory_order_relaxed);
+
+    return !m_notifyPending.exchange(true, std::memory_order_acq_rel);
+}
+
+void FrameMailbox::acknowledge()
+{
+    m_notifyPending.store(false, std::memory_order_release);
+}
+
+bool FrameMailbox::take(VideoFrame &out)
+{
+    if (!(m_state.load(std::memory_order_acquire) & FreshBit)) return false;
+    // only the producer sets FreshBit, so the middle slot stays fresh until we swap.
+    // Our front slot is always empty: frames are moved out, never retained here.
+    int prev = m_state.exchange(m_front, std::memory_order_acq_rel);
+    m_front = prev & ~FreshBit;
+    out = std::move(m_slots[m_front]);
+    m_slots[m_front] = VideoFrame();
+    return true;
+}
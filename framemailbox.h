@@ -0,0 +1,41 @@
+#pragma once
+
+#include <atomic>
+
+#include "videoframe.h"
+
+// Lock-free triple buffer carrying the newest frame from the capture thread
+// (single producer) to the display side (single consumer). Publishing never
+// blocks: an unconsumed frame is replaced by the newer one and counted as
+// dropped. A notification flag ensures at most one wake-up is in flight.
+class FrameMailbox
+{
+public:
+    FrameMailbox();
+
+    // producer: stores frame as the newest one. Returns true when the
+    // consumer has to be notified, i.e. no notification is pending yet.
+    bool publish(const VideoFrame &frame);
+
+    // consumer: call when a notification is handled; later publishes notify again
+    void acknowledge();
+    // consumer: moves the newest unseen frame into out; false if none arrived.
+    // The mailbox keeps no reference to a taken frame.
+    bool take(VideoFrame &out);
+
+    quint64 publishedCount() const { return m_published.load(std::memory_order_relaxed); }
+    quint64 droppedCount() const { return m_dropped.load(std::memory_order_relaxed); }
+
+private:
+    // m_state holds the index of the middle slot plus FreshBit when that slot
+    // holds a frame the consumer has not seen yet
+    static const int FreshBit = 4;
+
+    VideoFrame m_slots[3];
+    int m_back{0};   // owned by the producer
+    int m_front{2};  // owned by the consumer
+    std::atomic<int> m_state{1};
+    std::atomic<bool> m_notifyPending{false};
+    std::atomic<quint64> m_published{0};
+    std::atomic<quint64> m_dropped{0};
+};
@@ -0,0 +1,112 @@
+#include "framepool.h"
+#include <cstdlib>
+#include <cstring>
+
+struct FramePool::Core
+{
+    struct Slot {
+        Core *core;
+        int index;
+    };
+
+    std::atomic<int> refs{1};             // the pool itself + one per image in flight
+    std::atomic<unsigned long long> freeMask{0};
+    std::atomic<quint64> exhausted{0};
+    uchar *memory{nullptr};
+    size_t slotBytes{0};
+    int width{0};
+    int height{0};
+    int stride{0};
+    int count{0};
+    QImage::Format format{QImage::Format_RGB888};
+    Slot buffers[MaxBuffers];
+
+    void unref()
+    {
+        if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            free(memory);
+            delete this;
+        }
+    }
+};
+
+void FramePool::releaseBuffer(void *info)
+{
+    Core::Slot *slot = static_cast<Core::Slot*>(info);
+    Core *core = slot->core;
+    core->freeMask.fetch_or(1ULL << slot->index, std::memory_order_release);
+    core->unref();
+}
+
+FramePool::FramePool(int width, int height, QImage::Format format, int count)
+    : m_core(new Core)
+{
+    if (count < 1) count = 1;
+    if (count > MaxBuffers) count = MaxBuffers;
+
+    const int bytesPerPixel = (format == QImage::Format_RGB888) ? 3 : (format == QImage::Format_Grayscale8 ? 1 : 4);
+    m_core->width = width;
+    m_core->height = height;
+    m_core->format = format;
+    m_core->count = count;
+    // cache-line aligned rows and slots
+    m_core->stride = (width * bytesPerPixel + 63) & ~63;
+    m_core->slotBytes = ((size_t)m_core->stride * height + 4095) & ~(size_t)4095;
+
+    void *mem = nullptr;
+    if (posix_memalign(&mem, 4096, m_core->slotBytes * count) != 0) mem = nullptr;
+    m_core->memory = static_cast<uchar*>(mem);
+    if (!m_core->memory) {
+        m_core->count = 0;
+        return;
+    }
+    // touch every page now so capture never page-faults on a fresh buffer
+    memset(m_core->memory, 0, m_core->slotBytes * count);
+
+    for (int i = 0; i < count; ++i) {
+        m_core->buffers[i].core = m_core;
+        m_core->buffers[i].index = i;
+    }
+    m_core->freeMask = (count == 64) ? ~0ULL : ((1ULL << count) - 1);
+}
+
+FramePool::~FramePool()
+{
+    m_core->unref();
+}
+
+QImage FramePool::acquire()
+{
+    Core *core = m_core;
+    unsigned long long mask = core->freeMask.load(std::memory_order_acquire);
+    while (mask) {
+        int i = __builtin_ctzll(mask);
+        if (core->freeMask.compare_exchange_weak(mask, mask & ~(1ULL << i), std::memory_order_acq_rel)) {
+            core->refs.fetch_add(1, std::memory_order_relaxed);
+            return QImage(core->memory + i * core->slotBytes, core->width, core->height, core->stride,
+                          core->format, releaseBuffer, &core->buffers[i]);
+        }
+    }
+    core->exhausted.fetch_add(1, std::memory_order_relaxed);
+    return QImage();
+}
+
+int FramePool::count() const
+{
+    return m_core->count;
+}
+
+int FramePool::width() const
+{
+    return m_core->width;
+}
+
+int FramePool::height() const
+{
+    return m_core->height;
+}
+
+quint64 FramePool::exhaustedCount() const
+{
+    return m_core->exhausted.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QImage>
+#include <atomic>
+
+// Fixed set of preallocated frame buffers handed out as QImages. A buffer
+// returns to the pool when the last QImage sharing it is destroyed, so the
+// pool may safely be deleted while images are still in flight.
+class FramePool
+{
+public:
+    static const int MaxBuffers = 64;
+
+    FramePool(int width, int height, QImage::Format format, int count);
+    ~FramePool();
+
+    // a free buffer wrapped in a QImage, or a null QImage if all are in use
+    QImage acquire();
+
+    int count() const;
+    int width() const;
+    int height() const;
+    // number of acquire() calls that found no free buffer
+    quint64 exhaustedCount() const;
+
+private:
+    FramePool(const FramePool &) = delete;
+    FramePool &operator=(const FramePool &) = delete;
+
+    struct Core;
+    // QImage cleanup hook: runs when the last copy of an image goes away
+    static void releaseBuffer(void *info);
+
+    Core *m_core;
+};
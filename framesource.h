@@ -0,0 +1,87 @@
+#pragma once
+
+#include <QString>
+#include <cstdint>
+
+#include "videoframe.h"
+
+// One dequeued buffer. Its planes stay valid and untouched until it is
+// requeued, or until the last reference to its exported RawFrame is gone.
+// Planes are those of the pixel format (NV12: luma, then interleaved
+// chroma) whether or not they share one block of memory, and rows may be
+// padded beyond the visible width.
+struct SourceBuffer
+{
+    int index{-1};
+    int planeCount{0};
+    const uchar *planes[3] = {};
+    int bytesPerLine[3] = {};
+    uint32_t sequence{0};
+    qint64 timestampNs{0};  // CLOCK_MONOTONIC capture time, 0 if unknown
+};
+
+// Where V4L2Camera gets its frames from. The capture thread calls start(),
+// then per frame dequeue() followed by either requeue() or exportBuffer(),
+// and finally stop(). A dequeued buffer belongs to the caller until it is
+// requeued or exported; an exported buffer goes back to the source when its
+// RawFrame is released, from any thread and possibly after stop().
+// dequeue() returns a buffer that is already ready without waiting, so
+// calling it in a loop drains everything the source has queued up.
+class FrameSource
+{
+public:
+    enum Status {
+        Ok,
+        Again,    // nothing within the timeout, or woken up
+        Failed,   // this buffer is lost, the stream goes on; error is set
+        Finished  // end of stream; error is set unless it ended normally
+    };
+
+    // picture adjustments a sensor or ISP may do in hardware
+    enum Control { Brightness, Contrast, Gamma, ControlCount };
+
+    virtual ~FrameSource() {}
+
+    // human readable origin, for logs and errors
+    virtual QString name() const = 0;
+
+    // negotiates the format, width x height being the preferred size, and
+    // starts streaming; cleans up after itself on failure
+    virtual bool start(int width, int height, QString &error) = 0;
+    virtual void stop() = 0;
+
+    // valid after start()
+    uint32_t pixelFormat() const { return m_pixfmt; } // V4L2_PIX_FMT_*
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+    // timeoutMs < 0 waits until a buffer arrives or wakeup() is called
+    virtual Status dequeue(SourceBuffer &buf, int timeoutMs, QString &error) = 0;
+    // any thread, any time during the source's lifetime: a dequeue() that
+    // is waiting, or the next one to wait, returns Again right away
+    virtual void wakeup() {}
+    virtual bool requeue(int index, QString &error) = 0;
+    // hands the buffer over to consumers instead of requeueing it: the
+    // returned frame has its release hook set, the caller fills in format
+    // and planes and wraps it in a RawFrameRef
+    virtual RawFrame *exportBuffer(int index) = 0;
+
+    // Capture thread, after start(): a bit (1 << Control) for every control
+    // the source implements.
+    virtual int controls() const { return 0; }
+    // Sets the controls in mask to values[], given as the menu has them
+    // (brightness an offset in 8-bit steps, contrast and gamma factors, 1
+    // unchanged), in one batch. Returns the controls that could not be set,
+    // with error describing why; 0 when all were.
+    virtual int setControls(int mask, const double *values, QString &error)
+    {
+        Q_UNUSED(values)
+        error = QString("%1 has no controls").arg(name());
+        return mask;
+    }
+
+protected:
+    uint32_t m_pixfmt{0};
+    int m_width{0};
+    int m_height{0};
+};
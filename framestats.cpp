@@ -0,0 +1,200 @@
+#include "framestats.h"
+#include "framemailbox.h"
+
+#include <QDebug>
+#include <time.h>
+
+qint64 monotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (qint64)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+int LatencyHistogram::bucketFor(quint64 ns)
+{
+    const int sub = 1 << SubBits;
+    if (ns < (quint64)sub) return (int)ns;
+    const int e = 63 - __builtin_clzll(ns);
+    return (e - SubBits + 1) * sub + (int)((ns >> (e - SubBits)) & (sub - 1));
+}
+
+qint64 LatencyHistogram::bucketValue(int bucket)
+{
+    const int sub = 1 << SubBits;
+    if (bucket < sub) return bucket;
+    const int e = bucket / sub + SubBits - 1;
+    const qint64 width = 1LL << (e - SubBits);
+    // middle of the bucket
+    return (qint64)(sub + bucket % sub) * width + width / 2;
+}
+
+void LatencyHistogram::record(qint64 ns)
+{
+    if (ns < 0) ns = 0;
+    m_buckets[bucketFor((quint64)ns)].fetch_add(1, std::memory_order_relaxed);
+    qint64 seen = m_max.load(std::memory_order_relaxed);
+    while (ns > seen && !m_max.compare_exchange_weak(seen, ns, std::memory_order_relaxed)) {
+    }
+}
+
+LatencyHistogram::Summary LatencyHistogram::collect()
+{
+    quint32 counts[Buckets];
+    Summary s;
+    for (int i = 0; i < Buckets; ++i) {
+        counts[i] = m_buckets[i].exchange(0, std::memory_order_relaxed);
+        s.count += counts[i];
+    }
+    s.max = m_max.exchange(0, std::memory_order_relaxed);
+    if (!s.count) return s;
+
+    const quint64 rank50 = (s.count + 1) / 2;
+    const quint64 rank99 = s.count - s.count / 100;
+    quint64 seen = 0;
+    for (int i = 0; i < Buckets; ++i) {
+        if (!counts[i]) continue;
+        const quint64 before = seen;
+        seen += counts[i];
+        if (before < rank50 && seen >= rank50) s.p50 = bucketValue(i);
+        if (before < rank99 && seen >= rank99) {
+            s.p99 = bucketValue(i);
+            break;
+        }
+    }
+    // a bucket midpoint can overshoot the largest sample
+    if (s.p50 > s.max) s.p50 = s.max;
+    if (s.p99 > s.max) s.p99 = s.max;
+    return s;
+}
+
+FrameStats::FrameStats(const FrameMailbox *mailbox, QObject *parent)
+    : QObject(parent)
+    , m_mailbox(mailbox)
+{
+    m_timer.setInterval(1000);
+    connect(&m_timer, &QTimer::timeout, this, &FrameStats::collect);
+}
+
+void FrameStats::setEnabled(bool enabled)
+{
+    if (this->enabled() == enabled) return;
+    if (enabled) {
+        // start from a clean window; stale samples were never recorded
+        for (LatencyHistogram &h : m_stages) h.collect();
+        m_captured.store(0, std::memory_order_relaxed);
+        m_displayed.store(0, std::memory_order_relaxed);
+        m_droppedFrames.store(0, std::memory_order_relaxed);
+        m_sequenceReset.store(true, std::memory_order_relaxed);
+        m_mailboxDropsBase = m_mailbox ? m_mailbox->droppedCount() : 0;
+        m_mailboxDrops = 0;
+        m_sinceLog = 0;
+        m_lastCollectNs = monotonicNs();
+        m_timer.start();
+    } else {
+        m_timer.stop();
+        m_fps = m_displayFps = 0;
+        m_latency.clear();
+        m_summary.clear();
+    }
+    m_enabled.store(enabled, std::memory_order_relaxed);
+    emit enabledChanged();
+    emit updated();
+}
+
+void FrameStats::setLogInterval(int seconds)
+{
+    if (seconds < 0) seconds = 0;
+    if (m_logInterval == seconds) return;
+    m_logInterval = seconds;
+    m_sinceLog = 0;
+    emit logIntervalChanged();
+}
+
+void FrameStats::noteSequence(quint32 sequence)
+{
+    if (m_sequenceReset.exchange(false, std::memory_order_relaxed)) {
+        m_lastSequence = sequence;
+        return;
+    }
+    // unsigned difference survives the 32-bit wrap; a restarted stream
+    // (sequence going backwards) is not a drop
+    const quint32 gap = sequence - m_lastSequence;
+    if (gap > 1 && gap < 0x80000000u) m_droppedFrames.fetch_add(gap - 1, std::memory_order_relaxed);
+    m_lastSequence = sequence;
+}
+
+void FrameStats::recordCapture(const FrameTiming &timing)
+{
+    if (!enabled() || !timing.valid()) return;
+    if (timing.driverNs) m_stages[DriverToDequeue].record(timing.dequeueNs - timing.driverNs);
+    if (timing.convertEndNs) m_stages[Convert].record(timing.convertEndNs - timing.convertStartNs);
+    m_stages[Capture].record(timing.publishNs - timing.dequeueNs);
+    m_captured.fetch_add(1, std::memory_order_relaxed);
+}
+
+void FrameStats::recordConversion(const FrameTiming &timing)
+{
+    if (!enabled() || !timing.valid()) return;
+    m_stages[Convert].record(timing.convertEndNs - timing.convertStartNs);
+}
+
+void FrameStats::recordDisplay(const FrameTiming &timing, qint64 uploadNs)
+{
+    if (!enabled() || !timing.valid() || !timing.takeNs) return;
+    m_stages[Queue].record(timing.takeNs - timing.publishNs);
+    m_stages[Upload].record(uploadNs - timing.takeNs);
+    m_stages[EndToEnd].record(uploadNs - (timing.driverNs ? timing.driverNs : timing.dequeueNs));
+    m_displayed.fetch_add(1, std::memory_order_relaxed);
+}
+
+const char *FrameStats::stageName(int stage)
+{
+    static const char *const names[StageCount] = {
+        "driver", "convert", "capture", "queue", "upload", "total"
+    };
+    return names[stage];
+}
+
+void FrameStats::collect()
+{
+    const qint64 now = monotonicNs();
+    const double seconds = (now - m_lastCollectNs) / 1e9;
+    m_lastCollectNs = now;
+    if (seconds <= 0) return;
+
+    m_fps = m_captured.exchange(0, std::memory_order_relaxed) / seconds;
+    m_displayFps = m_displayed.exchange(0, std::memory_order_relaxed) / seconds;
+    if (m_mailbox) m_mailboxDrops = m_mailbox->droppedCount() - m_mailboxDropsBase;
+
+    LatencyHistogram::Summary s[StageCount];
+    m_latency.clear();
+    for (int i = 0; i < StageCount; ++i) {
+        s[i] = m_stages[i].collect();
+        if (!s[i].count) continue;
+        QVariantMap stage;
+        stage.insert(QStringLiteral("p50"), s[i].p50 / 1e6);
+        stage.insert(QStringLiteral("p99"), s[i].p99 / 1e6);
+        stage.insert(QStringLiteral("max"), s[i].max / 1e6);
+        stage.insert(QStringLiteral("count"), (double)s[i].count);
+        m_latency.insert(QLatin1String(stageName(i)), stage);
+    }
+
+    m_summary = QString::asprintf("%.1f fps (shown %.1f)  drop %d/%d  convert %.2f/%.2f ms  total %.2f/%.2f ms",
+                                  m_fps, m_displayFps, droppedFrames(), mailboxDrops(),
+                                  s[Convert].p50 / 1e6, s[Convert].p99 / 1e6,
+                                  s[EndToEnd].p50 / 1e6, s[EndToEnd].p99 / 1e6);
+
+    if (m_logInterval > 0 && ++m_sinceLog >= m_logInterval) {
+        m_sinceLog = 0;
+        QString line = QString::asprintf("%.1f fps, shown %.1f, driver drops %d, mailbox drops %d;",
+                                         m_fps, m_displayFps, droppedFrames(), mailboxDrops());
+        for (int i = 0; i < StageCount; ++i) {
+            if (!s[i].count) continue;
+            line += QString::asprintf(" %s %.2f/%.2f/%.2f", stageName(i),
+                                      s[i].p50 / 1e6, s[i].p99 / 1e6, s[i].max / 1e6);
+        }
+        qDebug().noquote() << "Frame stats (p50/p99/max ms):" << line;
+    }
+    emit updated();
+}
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <QTimer>
+#include <QVariantMap>
+#include <atomic>
+#include <cstdint>
+
+#include "videoframe.h"
+
+class FrameMailbox;
+
+// CLOCK_MONOTONIC in nanoseconds: the clock V4L2 stamps buffers with
+qint64 monotonicNs();
+
+// Lock-free latency histogram: any thread records, one reader collects.
+// Buckets are log-linear (8 per power of two), so percentiles are within
+// about 6% of the exact value at any scale.
+class LatencyHistogram
+{
+public:
+    struct Summary {
+        quint64 count{0};
+        qint64 p50{0};
+        qint64 p99{0};
+        qint64 max{0};
+    };
+
+    void record(qint64 ns);
+    // summary of everything recorded since the previous collect()
+    Summary collect();
+
+private:
+    enum { SubBits = 3, Buckets = 64 << SubBits };
+    static int bucketFor(quint64 ns);
+    static qint64 bucketValue(int bucket);
+
+    std::atomic<quint32> m_buckets[Buckets] = {};
+    std::atomic<qint64> m_max{0};
+};
+
+// Where time goes between the driver filling a buffer and the pixels being
+// uploaded for display. The capture thread and the render thread record
+// FrameTiming stamps; a GUI-thread timer folds them into the properties
+// below once a second and optionally into the log. While disabled nothing
+// is stamped and each stage costs one relaxed load.
+class FrameStats : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool enabled READ enabled WRITE setEnabled NOTIFY enabledChanged)
+    // seconds between log dumps, 0 = no logging
+    Q_PROPERTY(int logInterval READ logInterval WRITE setLogInterval NOTIFY logIntervalChanged)
+    Q_PROPERTY(double fps READ fps NOTIFY updated)
+    Q_PROPERTY(double displayFps READ displayFps NOTIFY updated)
+    // frames the driver skipped (gaps in v4l2_buffer.sequence) since enabling
+    Q_PROPERTY(int droppedFrames READ droppedFrames NOTIFY updated)
+    // frames replaced in the mailbox before the display took them, since enabling
+    Q_PROPERTY(int mailboxDrops READ mailboxDrops NOTIFY updated)
+    // stage name -> { p50, p99, max } in milliseconds and the number of
+    // samples behind them (count), for the last second
+    Q_PROPERTY(QVariantMap latency READ latency NOTIFY updated)
+    // one-line digest for an OSD
+    Q_PROPERTY(QString summary READ summary NOTIFY updated)
+public:
+    enum Stage {
+        DriverToDequeue,  // driver timestamp -> DQBUF returned
+        Convert,          // conversion start -> end
+        Capture,          // DQBUF returned -> published to the mailbox
+        Queue,            // published -> taken by the scene graph
+        Upload,           // taken -> texture upload finished
+        EndToEnd,         // driver timestamp (or DQBUF) -> upload finished
+        StageCount
+    };
+
+    explicit FrameStats(const FrameMailbox *mailbox, QObject *parent = nullptr);
+
+    bool enabled() const { return m_enabled.load(std::memory_order_relaxed); }
+    void setEnabled(bool enabled);
+    int logInterval() const { return m_logInterval; }
+    void setLogInterval(int seconds);
+
+    double fps() const { return m_fps; }
+    double displayFps() const { return m_displayFps; }
+    int droppedFrames() const { return (int)m_droppedFrames.load(std::memory_order_relaxed); }
+    int mailboxDrops() const { return (int)m_mailboxDrops; }
+    QVariantMap latency() const { return m_latency; }
+    QString summary() const { return m_summary; }
+
+    // capture thread: account for a dequeued sequence number
+    void noteSequence(quint32 sequence);
+    // capture thread: a frame was published
+    void recordCapture(const FrameTiming &timing);
+    // render thread: a lazily converted frame was converted
+    void recordConversion(const FrameTiming &timing);
+    // render thread: the frame's pixels are on the GPU (or handed to the
+    // software renderer)
+    void recordDisplay(const FrameTiming &timing, qint64 uploadNs);
+
+signals:
+    void enabledChanged();
+    void logIntervalChanged();
+    void updated();
+
+private slots:
+    void collect();
+
+private:
+    static const char *stageName(int stage);
+
+    std::atomic<bool> m_enabled{false};
+    const FrameMailbox *m_mailbox;
+    QTimer m_timer;
+    int m_logInterval{0};
+    int m_sinceLog{0};
+
+    LatencyHistogram m_stages[StageCount];
+    std::atomic<quint64> m_captured{0};
+    std::atomic<quint64> m_displayed{0};
+    std::atomic<quint64> m_droppedFrames{0};
+    std::atomic<bool> m_sequenceReset{true};
+    quint32 m_lastSequence{0}; // capture thread only
+
+    // GUI thread
+    qint64 m_lastCollectNs{0};
+    quint64 m_mailboxDropsBase{0};
+    quint64 m_mailboxDrops{0};
+    double m_fps{0};
+    double m_displayFps{0};
+    QVariantMap m_latency;
+    QString m_summary;
+};
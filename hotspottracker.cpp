@@ -0,0 +1,287 @@
+#include "hotspottracker.h"
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OWLET_TRACKER_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OWLET_TRACKER_NEON 1
+#endif
+
+namespace {
+
+// scenes flatter than this have no hot spot worth following
+const int MinContrast = 12;
+
+int findRoot(std::vector<int> &parent, int i)
+{
+    while (parent[i] != i) {
+        parent[i] = parent[parent[i]];
+        i = parent[i];
+    }
+    return i;
+}
+
+int unite(std::vector<int> &parent, int a, int b)
+{
+    a = findRoot(parent, a);
+    b = findRoot(parent, b);
+    if (a == b) return a;
+    if (a < b) {
+        parent[b] = a;
+        return a;
+    }
+    parent[a] = b;
+    return b;
+}
+
+void rowMinMax(const uint8_t *p, int width, int &mn, int &mx)
+{
+    int x = 0;
+#if defined(OWLET_TRACKER_SSE2)
+    if (width >= 16) {
+        __m128i vmin = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i vmax = vmin;
+        for (x = 16; x + 16 <= width; x += 16) {
+            const __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + x));
+            vmin = _mm_min_epu8(vmin, v);
+            vmax = _mm_max_epu8(vmax, v);
+        }
+        uint8_t lo[16], hi[16];
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(lo), vmin);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(hi), vmax);
+        for (int i = 0; i < 16; ++i) {
+            if (lo[i] < mn) mn = lo[i];
+            if (hi[i] > mx) mx = hi[i];
+        }
+    }
+#elif defined(OWLET_TRACKER_NEON)
+    if (width >= 16) {
+        uint8x16_t vmin = vld1q_u8(p), vmax = vmin;
+        for (x = 16; x + 16 <= width; x += 16) {
+            const uint8x16_t v = vld1q_u8(p + x);
+            vmin = vminq_u8(vmin, v);
+            vmax = vmaxq_u8(vmax, v);
+        }
+        uint8_t lo[16], hi[16];
+        vst1q_u8(lo, vmin);
+        vst1q_u8(hi, vmax);
+        for (int i = 0; i < 16; ++i) {
+            if (lo[i] < mn) mn = lo[i];
+            if (hi[i] > mx) mx = hi[i];
+        }
+    }
+#endif
+    for (; x < width; ++x) {
+        if (p[x] < mn) mn = p[x];
+        if (p[x] > mx) mx = p[x];
+    }
+}
+
+} // namespace
+
+void thumbnailMaxRow(const uint8_t *src, int pixelStep, uint8_t *thumb, int thumbWidth, bool first)
+{
+    const int scale = HotSpotTracker::ThumbnailScale;
+    int i = 0;
+#if defined(OWLET_TRACKER_SSE2)
+    if (pixelStep == 1) {
+        // 16 source pixels -> 4 thumbnail pixels: max within each 32-bit lane
+        const __m128i lowByte = _mm_set1_epi32(0xff);
+        for (; i + 4 <= thumbWidth; i += 4) {
+            __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i * scale));
+            v = _mm_max_epu8(v, _mm_srli_epi32(v, 8));
+            v = _mm_max_epu8(v, _mm_srli_epi32(v, 16));
+            v = _mm_and_si128(v, lowByte);
+            v = _mm_packs_epi32(v, v);
+            v = _mm_packus_epi16(v, v);
+            uint8_t *t = thumb + i;
+            if (!first) {
+                int prev;
+                memcpy(&prev, t, 4);
+                v = _mm_max_epu8(v, _mm_cvtsi32_si128(prev));
+            }
+            const int packed = _mm_cvtsi128_si32(v);
+            memcpy(t, &packed, 4);
+        }
+    }
+#elif defined(OWLET_TRACKER_NEON)
+    if (pixelStep == 1) {
+        for (; i + 4 <= thumbWidth; i += 4) {
+            const uint8x16_t v = vld1q_u8(src + i * scale);
+            // pairwise max twice: 16 -> 8 -> 4
+            uint8x8_t m = vpmax_u8(vget_low_u8(v), vget_high_u8(v));
+            m = vpmax_u8(m, m);
+            uint8_t out[8];
+            vst1_u8(out, m);
+            for (int k = 0; k < 4; ++k) {
+                thumb[i + k] = first ? out[k] : (out[k] > thumb[i + k] ? out[k] : thumb[i + k]);
+            }
+        }
+    }
+#endif
+    for (; i < thumbWidth; ++i) {
+        const uint8_t *p = src + i * scale * pixelStep;
+        uint8_t m = first ? 0 : thumb[i];
+        for (int k = 0; k < scale; ++k) {
+            if (p[k * pixelStep] > m) m = p[k * pixelStep];
+        }
+        thumb[i] = m;
+    }
+}
+
+HotSpotTracker::HotSpotTracker(QObject *parent)
+    : QObject(parent)
+{
+    m_thread = std::thread(&HotSpotTracker::loop, this);
+}
+
+HotSpotTracker::~HotSpotTracker()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_quit = true;
+    }
+    m_wakeCond.notify_one();
+    m_thread.join();
+}
+
+void HotSpotTracker::setEnabled(bool enabled)
+{
+    if (m_enabled == enabled) return;
+    m_enabled = enabled;
+    if (!enabled) {
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        m_ringSize = 0;
+    }
+    emit enabledChanged();
+    emit trajectoryChanged();
+}
+
+QVariantList HotSpotTracker::trajectory() const
+{
+    QVariantList points;
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    points.reserve(m_ringSize);
+    for (int i = 0; i < m_ringSize; ++i) {
+        const int slot = (m_ringHead - m_ringSize + i + TrajectoryLength) % TrajectoryLength;
+        points.append(m_ring[slot]);
+    }
+    return points;
+}
+
+void HotSpotTracker::submit(const VideoFrame &thumbnail)
+{
+    if (!m_mailbox.publish(thumbnail)) return;
+    // first thumbnail since the tracker last woke up
+    {
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        m_wake = true;
+    }
+    m_wakeCond.notify_one();
+}
+
+void HotSpotTracker::loop()
+{
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            m_wakeCond.wait(lock, [this] { return m_wake || m_quit; });
+            if (m_quit) return;
+            m_wake = false;
+        }
+        m_mailbox.acknowledge();
+
+        VideoFrame frame;
+        if (!m_mailbox.take(frame) || !m_enabled) continue;
+        QPointF pos;
+        const bool found = locate(frame.image, pos);
+        // the pooled thumbnail goes back to the camera before anything else
+        frame = VideoFrame();
+        if (!found) continue;
+        {
+            std::lock_guard<std::mutex> lock(m_ringMutex);
+            if (!m_enabled) continue;
+            m_ring[m_ringHead] = pos;
+            m_ringHead = (m_ringHead + 1) % TrajectoryLength;
+            if (m_ringSize < TrajectoryLength) ++m_ringSize;
+        }
+        emit trajectoryChanged();
+    }
+}
+
+bool HotSpotTracker::locate(const QImage &thumb, QPointF &pos)
+{
+    const int w = thumb.width();
+    const int h = thumb.height();
+    if (w <= 0 || h <= 0) return false;
+
+    int mn = 255, mx = 0;
+    for (int y = 0; y < h; ++y) rowMinMax(thumb.constScanLine(y), w, mn, mx);
+    if (mx - mn < MinContrast) return false;
+    const int threshold = mx - qMax(4, (mx - mn) / 8);
+
+    // first pass: provisional labels with 8-connectivity, merged by union-find
+    const size_t pixels = (size_t)w * h;
+    if (m_labels.size() < pixels) {
+        m_labels.resize(pixels);
+        m_parent.reserve(pixels);
+        m_blobs.reserve(pixels);
+    }
+    m_parent.clear();
+    for (int y = 0; y < h; ++y) {
+        const uint8_t *row = thumb.constScanLine(y);
+        int *lab = &m_labels[(size_t)y * w];
+        const int *up = y ? lab - w : nullptr;
+        for (int x = 0; x < w; ++x) {
+            if (row[x] < threshold) {
+                lab[x] = -1;
+                continue;
+            }
+            int label = -1;
+            const int neighbours[4] = {
+                x > 0 ? lab[x - 1] : -1,
+                up && x > 0 ? up[x - 1] : -1,
+                up ? up[x] : -1,
+                up && x + 1 < w ? up[x + 1] : -1
+            };
+            for (int n : neighbours) {
+                if (n < 0) continue;
+                label = (label < 0) ? findRoot(m_parent, n) : unite(m_parent, label, n);
+            }
+            if (label < 0) {
+                label = (int)m_parent.size();
+                m_parent.push_back(label);
+            }
+            lab[x] = label;
+        }
+    }
+
+    // second pass: statistics per component
+    std::vector<Blob> &blobs = m_blobs;
+    blobs.assign(m_parent.size(), Blob{0, 0, 0.0, 0.0, 0.0});
+    for (int y = 0; y < h; ++y) {
+        const uint8_t *row = thumb.constScanLine(y);
+        const int *lab = &m_labels[(size_t)y * w];
+        for (int x = 0; x < w; ++x) {
+            if (lab[x] < 0) continue;
+            Blob &b = blobs[findRoot(m_parent, lab[x])];
+            const double weight = row[x] - threshold + 1;
+            if (row[x] > b.peak) b.peak = row[x];
+            ++b.area;
+            b.sumW += weight;
+            b.sumX += weight * x;
+            b.sumY += weight * y;
+        }
+    }
+
+    const Blob *best = nullptr;
+    for (const Blob &b : blobs) {
+        if (!b.area) continue;
+        if (!best || b.peak > best->peak || (b.peak == best->peak && b.area > best->area)) best = &b;
+    }
+    if (!best) return false;
+    pos = QPointF((best->sumX / best->sumW + 0.5) / w, (best->sumY / best->sumW + 0.5) / h);
+    return true;
+}
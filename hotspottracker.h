@@ -0,0 +1,85 @@
+#pragma once
+
+#include <QObject>
+#include <QPointF>
+#include <QVariantList>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "framemailbox.h"
+
+// Follows the hottest blob of the scene on its own thread. The camera feeds
+// it luma thumbnails (Grayscale8, one pixel per ThumbnailScale x ThumbnailScale
+// block, holding the block maximum so small hot spots survive) through a
+// FrameMailbox; a slow tracker only ever skips thumbnails, it never holds up
+// capture or display.
+//
+// Per thumbnail: SIMD maximum, threshold a little below it, connected
+// components over the thresholded pixels, and the value-weighted centroid of
+// the component with the highest peak (largest area on ties) goes into a
+// bounded ring of recent positions.
+class HotSpotTracker : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool enabled READ enabled WRITE setEnabled NOTIFY enabledChanged)
+    // recent positions, oldest first, as QPointF in normalized frame
+    // coordinates (0..1); empty while disabled
+    Q_PROPERTY(QVariantList trajectory READ trajectory NOTIFY trajectoryChanged)
+public:
+    enum { ThumbnailScale = 4, TrajectoryLength = 64 };
+
+    explicit HotSpotTracker(QObject *parent = nullptr);
+    ~HotSpotTracker() override;
+
+    bool enabled() const { return m_enabled; }
+    void setEnabled(bool enabled);
+
+    QVariantList trajectory() const;
+
+    // producer side (capture thread): hand over a thumbnail, never blocks
+    void submit(const VideoFrame &thumbnail);
+
+signals:
+    void enabledChanged();
+    void trajectoryChanged();
+
+private:
+    struct Blob {
+        int peak;
+        int area;
+        double sumW, sumX, sumY;
+    };
+
+    void loop();
+    bool locate(const QImage &thumb, QPointF &pos);
+
+    std::atomic<bool> m_enabled{false};
+    FrameMailbox m_mailbox;
+
+    std::thread m_thread;
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeCond;
+    bool m_wake{false};
+    bool m_quit{false};
+
+    // tracker thread only, sized for the first thumbnail: a label per pixel,
+    // the union-find forest and per-component statistics
+    std::vector<int> m_labels;
+    std::vector<int> m_parent;
+    std::vector<Blob> m_blobs;
+
+    // guarded by m_ringMutex: pushed by the tracker, read by the GUI
+    mutable std::mutex m_ringMutex;
+    QPointF m_ring[TrajectoryLength];
+    int m_ringHead{0};
+    int m_ringSize{0};
+};
+
+// Max-pools one luma row into a thumbnail row: thumb[i] = max of src pixels
+// [i * ThumbnailScale, (i + 1) * ThumbnailScale), stepping pixelStep bytes
+// per pixel. first starts a new thumbnail row instead of maxing into it.
+void thumbnailMaxRow(const uint8_t *src, int pixelStep, uint8_t *thumb, int thumbWidth, bool first);
@@ -1,70 +1,18 @@
 #include <QGuiApplication>
 #include <QQmlApplicationEngine>
 #include <QQmlContext>
-#include <QQuickImageProvider>
-#include <QImage>
-#include <QMutex>
-#include <QAtomicInt>
+#include <QtQml>
 #include <QDebug>
 
 #include "v4l2camera.h"
-
-// Image provider that holds the latest frame (thread-safe)
-class CameraImageProvider : public QQuickImageProvider
-{
-public:
-    CameraImageProvider()
-        : QQuickImageProvider(QQuickImageProvider::Image)
-    {}
-
-    QImage requestImage(const QString &id, QSize *size, const QSize &requestedSize) override
-    {
-        Q_UNUSED(id)
-        Q_UNUSED(requestedSize)
-        QMutexLocker locker(&m_mutex);
-        if (m_image.isNull()) {
-            return QImage();
-        }
-        if (size) *size = m_image.size();
-        return m_image;
-    }
-
-    void setImage(const QImage &img)
-    {
-        QMutexLocker locker(&m_mutex);
-        m_image = img;
-    }
-
-private:
-    QImage m_image;
-    QMutex m_mutex;
-};
-
-// small helper object exposed to QML to force image reloads (token changes with every frame)
-class CameraTokenObject : public QObject
-{
-    Q_OBJECT
-    Q_PROPERTY(QString token READ token NOTIFY tokenChanged)
-public:
-    CameraTokenObject(QObject *parent = nullptr) : QObject(parent) {}
-
-    QString token() const { return m_token; }
-
-public slots:
-    void updateToken()
-    {
-        int t = m_counter.fetchAndAddRelaxed(1) + 1;
-        m_token = QString::number(t);
-        emit tokenChanged();
-    }
-
-signals:
-    void tokenChanged();
-
-private:
-    QString m_token;
-    QAtomicInt m_counter{0};
-};
+#include "cameraview.h"
+#include "hotspottracker.h"
+#include "framestats.h"
+#include "replaysource.h"
+#include "v4l2source.h"
+#include "rawrecorder.h"
+#include "framehistory.h"
+#include "shmexporter.h"
 
 int main(int argc, char **argv)
 {
@@ -72,29 +20,121 @@ int main(int argc, char **argv)
 
     QQmlApplicationEngine engine;
 
-    // create camera and image provider
+    qmlRegisterType<CameraView>("Owlet", 1, 0, "CameraView");
+    qmlRegisterUncreatableType<V4L2Camera>("Owlet", 1, 0, "V4L2Camera", "V4L2Camera is created by the application");
+    qmlRegisterUncreatableType<HotSpotTracker>("Owlet", 1, 0, "HotSpotTracker", "HotSpotTracker is created by the application");
+    qmlRegisterUncreatableType<FrameStats>("Owlet", 1, 0, "FrameStats", "FrameStats belongs to the camera");
+    qmlRegisterUncreatableType<RawRecorder>("Owlet", 1, 0, "RawRecorder", "RawRecorder is created by the application");
+    qmlRegisterUncreatableType<FrameHistory>("Owlet", 1, 0, "FrameHistory", "FrameHistory is created by the application");
+
+    // hot-spot tracker for the trajectory overlay; outlives the camera below
+    HotSpotTracker tracker;
+    // raw footage to disk, toggled from QML; outlives the camera too
+    RawRecorder recorder;
+    // the last frames in memory for freeze and replay:
+    // OWLET_HISTORY_MB=<MiB>, 64 by default, 0 turns it off
+    bool historyOk = false;
+    int historyMb = qEnvironmentVariableIntValue("OWLET_HISTORY_MB", &historyOk);
+    if (!historyOk || historyMb < 0) historyMb = 64;
+    FrameHistory history((size_t)historyMb << 20);
+    // frames for other processes (see shmclient/), outliving the camera as
+    // well: OWLET_SHM=<socket path>
+    ShmExporter exporter;
+    const QString shmPath = qEnvironmentVariable("OWLET_SHM");
+    if (!shmPath.isEmpty()) {
+        QString error;
+        if (!exporter.start(shmPath, error)) qWarning() << "Frame export:" << error;
+    }
+
+    // create camera
     V4L2Camera *cam = new V4L2Camera("/dev/video0", 1280, 720);
-    CameraImageProvider *provider = new CameraImageProvider();
-    CameraTokenObject *tokenObj = new CameraTokenObject();
 
-    // add provider under "camera"
-    engine.addImageProvider(QLatin1String("camera"), provider);
+    // OWLET_REPLAY=<file>,<FOURCC>,<width>x<height>[,<fps>]: play back a raw
+    // capture instead of opening the device
+    const QString replay = qEnvironmentVariable("OWLET_REPLAY");
+    if (!replay.isEmpty()) {
+        QString error;
+        ReplaySource *source = ReplaySource::fromSpec(replay, error);
+        if (source) {
+            cam->setSource(source);
+        } else {
+            qWarning() << error;
+        }
+    } else {
+        // the camera's own device source: OWLET_V4L2_BUFFERS=<n> sets the
+        // driver queue depth, OWLET_V4L2_MEMORY=mmap|userptr|dmabuf the memory
+        V4L2Source *source = static_cast<V4L2Source*>(cam->source());
+        bool ok = false;
+        int buffers = qEnvironmentVariableIntValue("OWLET_V4L2_BUFFERS", &ok);
+        if (ok) source->setBufferCount(buffers);
+        const QString memoryName = qEnvironmentVariable("OWLET_V4L2_MEMORY");
+        V4L2Source::Memory memory = V4L2Source::Mmap;
+        if (!memoryName.isEmpty()) {
+            if (V4L2Source::parseMemory(memoryName, memory)) {
+                source->setMemory(memory);
+            } else {
+                qWarning() << "Unknown OWLET_V4L2_MEMORY" << memoryName << ", using mmap";
+            }
+        }
+    }
 
-    // expose token object and camera as context properties
-    engine.rootContext()->setContextProperty("cameraObj", tokenObj);
-    engine.rootContext()->setContextProperty("v4l2Camera", cam);
+    // conversion threads: OWLET_CONV_THREADS=<n>, OWLET_CONV_CPUS=<cpu,cpu,...>
+    int convThreads = qMin(QThread::idealThreadCount(), 4);
+    bool ok = false;
+    int envThreads = qEnvironmentVariableIntValue("OWLET_CONV_THREADS", &ok);
+    if (ok && envThreads > 0) convThreads = envThreads;
+    cam->setConversionThreads(convThreads);
+    std::vector<int> convCpus;
+    for (const QByteArray &cpu : qgetenv("OWLET_CONV_CPUS").split(',')) {
+        int c = cpu.trimmed().toInt(&ok);
+        if (ok) convCpus.push_back(c);
+    }
+    cam->setConversionCpus(convCpus);
+
+    // capture thread: OWLET_CAPTURE_FIFO=<priority> for SCHED_FIFO, OWLET_CAPTURE_CPU=<cpu> to pin it
+    int captureFifo = qEnvironmentVariableIntValue("OWLET_CAPTURE_FIFO", &ok);
+    if (!ok) captureFifo = 0;
+    int captureCpu = qEnvironmentVariableIntValue("OWLET_CAPTURE_CPU", &ok);
+    if (!ok) captureCpu = -1;
+    cam->setCaptureScheduling(captureFifo, captureCpu);
+
+    // OWLET_LAZY=1: convert only the frames the display picks up
+    cam->setLazyConversion(qEnvironmentVariableIntValue("OWLET_LAZY") > 0);
+    cam->setTracker(&tracker);
+    cam->setRecorder(&recorder);
+    if (historyMb > 0) cam->setHistory(&history);
+    cam->setExporter(&exporter);
+    // OWLET_RECORD=<file>: record raw frames from the start
+    const QString recordPath = qEnvironmentVariable("OWLET_RECORD");
+    if (!recordPath.isEmpty()) recorder.start(recordPath);
+
+    // OWLET_STATS_LOG=<seconds>: collect frame stats from the start and log them
+    int statsLog = qEnvironmentVariableIntValue("OWLET_STATS_LOG", &ok);
+    if (ok && statsLog > 0) {
+        cam->stats()->setLogInterval(statsLog);
+        cam->stats()->setEnabled(true);
+    }
 
-    // connect camera frames -> provider storage + token update
-    // IMPORTANT: use tokenObj (QObject*) as context for the lambda (provider is NOT a QObject)
-    QObject::connect(cam, &V4L2Camera::frameReady, tokenObj,
-                     [provider, tokenObj](const QImage &img){
-                         provider->setImage(img);
-                         tokenObj->updateToken();
-                     });
+    // expose camera as context property; CameraView in QML takes frames from it directly
+    engine.rootContext()->setContextProperty("v4l2Camera", cam);
+    engine.rootContext()->setContextProperty("hotSpotTracker", &tracker);
+    engine.rootContext()->setContextProperty("rawRecorder", &recorder);
+    engine.rootContext()->setContextProperty("frameHistory", &history);
 
     QObject::connect(cam, &V4L2Camera::errorOccurred, [](const QString &msg){
         qWarning() << "Camera error:" << msg;
     });
+    QObject::connect(&recorder, &RawRecorder::errorOccurred, [](const QString &msg){
+        qWarning() << "Recorder error:" << msg;
+    });
+    QObject::connect(&history, &FrameHistory::dumpFinished, [](const QString &path, const QString &error){
+        if (!error.isEmpty()) qWarning() << "History dump to" << path << "failed:" << error;
+    });
+
+    // OWLET_NUC=<file>: gains, offsets and dead pixels of the radiometric
+    // sensor, see calibration.h; after the error hook so a bad file is logged
+    const QString nucPath = qEnvironmentVariable("OWLET_NUC");
+    if (!nucPath.isEmpty()) cam->setCalibrationFile(nucPath);
 
     // start camera thread
     cam->start();
@@ -114,5 +154,3 @@ int main(int argc, char **argv)
     delete cam;
     return ret;
 }
-
-#include "main.moc"
@@ -2,6 +2,7 @@ import QtQuick 2.12
 import QtQuick.Window 2.12
 import QtQuick.Controls 2.12
 import QtQuick.Layouts 1.12
+import Owlet 1.0
 
 Window {
     id: root
@@ -12,17 +13,70 @@ Window {
 
     signal menuAction(string action, string value)
 
+    // "Кадр" entries have no value editor: each selection steps to the next preset
+    function nextPreset(presets, current) {
+        for (var i = 0; i < presets.length; ++i) {
+            if (Math.abs(presets[i] - current) < 0.001) return presets[(i + 1) % presets.length];
+        }
+        return presets[0];
+    }
+
+    onMenuAction: {
+        if (action === "palette") {
+            v4l2Camera.palette = value;
+        } else if (action === "trajectory") {
+            hotSpotTracker.enabled = (value === "traj_yes");
+        } else if (action === "contrast") {
+            v4l2Camera.negative = (value === "negative");
+        } else if (action === "frame") {
+            if (value === "gamma") v4l2Camera.gamma = nextPreset([1.0, 1.5, 2.2, 0.7], v4l2Camera.gamma);
+            else if (value === "frame_contrast") v4l2Camera.contrast = nextPreset([1.0, 1.5, 2.0, 0.75], v4l2Camera.contrast);
+            else if (value === "sharpen") v4l2Camera.sharpen = nextPreset([0, 0.5, 1.0, 2.0], v4l2Camera.sharpen);
+            else if (value === "denoise") v4l2Camera.denoise = nextPreset([0, 0.5, 1.0], v4l2Camera.denoise);
+            else if (value === "brightness") v4l2Camera.brightness = nextPreset([0, 32, 64, -32], v4l2Camera.brightness);
+        }
+    }
+
     Rectangle {
         anchors.fill: parent
         color: "#000000"
 
-        Image {
-            id: camImage
+        CameraView {
+            id: camView
             anchors.fill: parent
-            fillMode: Image.PreserveAspectCrop
-            source: "image://camera/live?token=" + (cameraObj ? cameraObj.token : "0")
-            asynchronous: false
-            cache: false
+            fillMode: CameraView.PreserveAspectCrop
+            camera: v4l2Camera
+        }
+
+        // trajectory of the hottest spot, drawn over the picture
+        Canvas {
+            id: trajectoryOverlay
+            anchors.fill: parent
+            visible: hotSpotTracker.enabled
+
+            Connections {
+                target: hotSpotTracker
+                onTrajectoryChanged: trajectoryOverlay.requestPaint()
+            }
+
+            onPaint: {
+                var ctx = getContext("2d");
+                ctx.clearRect(0, 0, width, height);
+                var points = hotSpotTracker.trajectory;
+                if (points.length === 0) return;
+                ctx.strokeStyle = "#00ff00";
+                ctx.lineWidth = 2;
+                ctx.beginPath();
+                for (var i = 0; i < points.length; ++i) {
+                    var p = camView.mapFromFrame(points[i]);
+                    if (i === 0) ctx.moveTo(p.x, p.y); else ctx.lineTo(p.x, p.y);
+                }
+                ctx.stroke();
+                var last = camView.mapFromFrame(points[points.length - 1]);
+                ctx.beginPath();
+                ctx.arc(last.x, last.y, 6, 0, 2 * Math.PI);
+                ctx.stroke();
+            }
         }
 
         Text {
@@ -35,6 +89,69 @@ Window {
             font.pixelSize: 16
         }
 
+        // frame statistics OSD, toggled with S
+        Text {
+            visible: v4l2Camera.stats.enabled
+            text: v4l2Camera.stats.summary
+            color: "#ffff00"
+            style: Text.Outline
+            styleColor: "black"
+            anchors.left: parent.left
+            anchors.leftMargin: 8
+            anchors.bottom: parent.bottom
+            anchors.bottomMargin: 8
+            font.pixelSize: 14
+            font.family: "monospace"
+        }
+
+        // raw recording indicator, toggled with R; the backlog shows how far
+        // the disk is behind
+        Text {
+            visible: rawRecorder.recording
+            text: "● REC " + rawRecorder.writtenFrames
+                  + (rawRecorder.droppedFrames > 0 ? "  dropped " + rawRecorder.droppedFrames : "")
+                  + (rawRecorder.backlog > 1 ? "  backlog " + rawRecorder.backlog + "/" + rawRecorder.chunkCount : "")
+            color: rawRecorder.droppedFrames > 0 ? "#ff8000" : "#ff3030"
+            style: Text.Outline
+            styleColor: "black"
+            anchors.right: parent.right
+            anchors.rightMargin: 8
+            anchors.top: parent.top
+            anchors.topMargin: 8
+            font.pixelSize: 16
+        }
+
+        // freeze-frame indicator, F to freeze, Left/Right to scrub, D to dump
+        Text {
+            visible: frameHistory.frozen || frameHistory.dumping
+            text: (frameHistory.frozen ? "❚❚ " + frameHistory.position.toFixed(2) + " s  of "
+                                        + frameHistory.span.toFixed(1) + " s" : "")
+                  + (frameHistory.dumping ? "  saving…" : "")
+            color: "#30c0ff"
+            style: Text.Outline
+            styleColor: "black"
+            anchors.right: parent.right
+            anchors.rightMargin: 8
+            anchors.top: parent.top
+            anchors.topMargin: 30
+            font.pixelSize: 16
+        }
+
+        // non-uniformity correction: C captures a flat field, the lens cap
+        // or shutter closed for the next 32 frames
+        Text {
+            visible: v4l2Camera.flatFieldRunning
+            text: "NUC…"
+            color: "#80ff80"
+            style: Text.Outline
+            styleColor: "black"
+            anchors.right: parent.right
+            anchors.rightMargin: 8
+            anchors.top: parent.top
+            anchors.topMargin: 52
+            font.pixelSize: 16
+        }
+
         // --- Menu Overlay ---
         Item {
             id: menuRoot
@@ -177,7 +294,7 @@ Window {
                 } else if (name === "trajectory") {
                     arr = [ {display: "Да", id: "traj_yes"}, {display: "Нет", id: "traj_no"}];
                 } else if (name === "frame") {
-                    arr = [ {display: "Гамма-кор", id: "gamma"}, {display: "Контраст", id: "frame_contrast"}, {display: "Шарпенинг", id: "sharpen"}, {display: "Яркость кадра", id: "brightness"}];
+                    arr = [ {display: "Гамма-кор", id: "gamma"}, {display: "Контраст", id: "frame_contrast"}, {display: "Шарпенинг", id: "sharpen"}, {display: "Шумоподавление", id: "denoise"}, {display: "Яркость кадра", id: "brightness"}];
                 }
                 return arr;
             }
@@ -212,8 +329,8 @@ Window {
                 }
 
                 var parent = menuRoot.menuStack[menuRoot.menuStack.length - 1];
-                menuRoot.menuAction(parent.id, item.display);
-                console.log("menuAction:", parent.id, item.display);
+                root.menuAction(parent.id, item.id);
+                console.log("menuAction:", parent.id, item.id);
                 menuRoot.closeAll();
             }
 
@@ -264,6 +381,34 @@ Window {
             if (event.key === Qt.Key_M) {
                 menuRoot.toggle();
                 event.accepted = true;
+            } else if (event.key === Qt.Key_S) {
+                v4l2Camera.stats.enabled = !v4l2Camera.stats.enabled;
+                event.accepted = true;
+            } else if (event.key === Qt.Key_R) {
+                if (rawRecorder.recording) rawRecorder.stop();
+                else rawRecorder.start("");
+                event.accepted = true;
+            } else if (event.key === Qt.Key_F) {
+                frameHistory.frozen = !frameHistory.frozen;
+                event.accepted = true;
+            } else if (frameHistory.frozen && (event.key === Qt.Key_Left || event.key === Qt.Key_Right)) {
+                // a frame at a time, a second with Shift
+                var back = event.key === Qt.Key_Left;
+                if (event.modifiers & Qt.ShiftModifier) frameHistory.seekBack(-frameHistory.position + (back ? 1 : -1));
+                else frameHistory.step(back ? -1 : 1);
+                event.accepted = true;
+            } else if (event.key === Qt.Key_D) {
+                frameHistory.dump("");
+                event.accepted = true;
+            } else if (event.key === Qt.Key_C) {
+                v4l2Camera.captureFlatField(32);
+                event.accepted = true;
+            } else if (event.key === Qt.Key_Plus || event.key === Qt.Key_Equal) {
+                camView.zoom = camView.zoom * 1.25;
+                event.accepted = true;
+            } else if (event.key === Qt.Key_Minus) {
+                camView.zoom = camView.zoom / 1.25;
+                event.accepted = true;
             }
         }
     }
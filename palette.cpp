@@ -0,0 +1,80 @@
+#include "palette.h"
+#include <cstring>
+
+namespace {
+
+struct ControlPoint {
+    int index;
+    uint8_t r, g, b;
+};
+
+struct PaletteSpec {
+    const char *name;
+    const ControlPoint *points;
+    int count;
+};
+
+// colours in between control points are interpolated linearly
+const ControlPoint whiteHot[] = { {0, 0, 0, 0}, {255, 255, 255, 255} };
+const ControlPoint blackHot[] = { {0, 255, 255, 255}, {255, 0, 0, 0} };
+const ControlPoint sepia[] = { {0, 20, 10, 0}, {128, 160, 118, 78}, {255, 255, 240, 200} };
+// greyscale with the hottest quarter going from orange to red
+const ControlPoint redHot[] = { {0, 0, 0, 0}, {191, 191, 191, 191}, {192, 255, 128, 0}, {255, 255, 0, 0} };
+// "ironbow": black, violet, red, orange, yellow, white
+const ControlPoint iron[] = {
+    {0, 0, 0, 0}, {32, 32, 0, 80}, {80, 120, 0, 150}, {128, 200, 30, 90},
+    {170, 240, 100, 20}, {210, 255, 180, 0}, {240, 255, 235, 120}, {255, 255, 255, 255}
+};
+// greyscale with the coldest quarter in green
+const ControlPoint greenCold[] = { {0, 0, 255, 0}, {63, 0, 96, 0}, {64, 64, 64, 64}, {255, 255, 255, 255} };
+
+const PaletteSpec specs[] = {
+    { "white_hot", whiteHot, sizeof(whiteHot) / sizeof(whiteHot[0]) },
+    { "black_hot", blackHot, sizeof(blackHot) / sizeof(blackHot[0]) },
+    { "sepia", sepia, sizeof(sepia) / sizeof(sepia[0]) },
+    { "red_hot", redHot, sizeof(redHot) / sizeof(redHot[0]) },
+    { "iron", iron, sizeof(iron) / sizeof(iron[0]) },
+    { "green_cold", greenCold, sizeof(greenCold) / sizeof(greenCold[0]) },
+};
+const int specCount = sizeof(specs) / sizeof(specs[0]);
+
+uint8_t lerp(uint8_t a, uint8_t b, int num, int den)
+{
+    return (uint8_t)(a + ((b - a) * num + (b >= a ? den / 2 : -den / 2)) / den);
+}
+
+void buildLut(const PaletteSpec &spec, Palette &out)
+{
+    out.name = spec.name;
+    for (int p = 0; p + 1 < spec.count; ++p) {
+        const ControlPoint &a = spec.points[p];
+        const ControlPoint &b = spec.points[p + 1];
+        const int span = b.index - a.index;
+        for (int i = a.index; i <= b.index; ++i) {
+            const int t = i - a.index;
+            uint8_t rgbx[4] = { lerp(a.r, b.r, t, span), lerp(a.g, b.g, t, span), lerp(a.b, b.b, t, span), 0 };
+            memcpy(&out.lut[i], rgbx, 4);
+        }
+    }
+}
+
+struct PaletteTable {
+    Palette palettes[specCount];
+    PaletteTable()
+    {
+        for (int i = 0; i < specCount; ++i) buildLut(specs[i], palettes[i]);
+    }
+};
+
+} // namespace
+
+const Palette *findPalette(const char *name)
+{
+    // built once, on first use
+    static const PaletteTable table;
+    if (!name) return nullptr;
+    for (int i = 0; i < specCount; ++i) {
+        if (strcmp(table.palettes[i].name, name) == 0) return &table.palettes[i];
+    }
+    return nullptr;
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+#include <cstdint>
+
+// 256-entry luma -> colour tables for the thermal palettes of the "Палитра"
+// menu. Each entry holds the R, G, B bytes followed by a zero byte in memory
+// order, so a kernel can copy it with one 4-byte store.
+struct Palette
+{
+    const char *name; // menu id, e.g. "iron"
+    uint32_t lut[256];
+};
+
+// palette with the given menu id, nullptr if there is none
+const Palette *findPalette(const char *name);
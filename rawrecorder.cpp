@@ -0,0 +1,343 @@
+#include "rawrecorder.h"
+#include "replaysource.h"
+#include <linux/videodev2.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstdlib>
+#include <cstring>
+#include <errno.h>
+#include <QDateTime>
+#include <QDebug>
+
+// every byte of buf at offset, across short writes
+static bool writeAll(int fd, const uchar *buf, size_t length, off_t offset)
+{
+    while (length) {
+        const ssize_t n = pwrite(fd, buf, length, offset);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        buf += n;
+        length -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// rows of one plane, padding dropped
+static uchar *copyPlane(uchar *dst, const RawFrame::Plane &plane, int rowBytes, int rows)
+{
+    for (int y = 0; y < rows; ++y) {
+        memcpy(dst, plane.data + (size_t)y * plane.bytesPerLine, rowBytes);
+        dst += rowBytes;
+    }
+    return dst;
+}
+
+static bool isSemiPlanar(uint32_t pixfmt)
+{
+    return pixfmt == V4L2_PIX_FMT_NV12 || pixfmt == V4L2_PIX_FMT_NV21;
+}
+
+int rawFrameBytes(const RawFrame &frame)
+{
+    if (!frame.planeCount || (isSemiPlanar(frame.pixelFormat) && frame.planeCount < 2)) return 0;
+    return ReplaySource::frameBytes(frame.pixelFormat, frame.width, frame.height);
+}
+
+void packRawFrame(const RawFrame &frame, uchar *dst)
+{
+    const bool semiPlanar = isSemiPlanar(frame.pixelFormat);
+    const bool wide = !semiPlanar && frame.pixelFormat != V4L2_PIX_FMT_GREY;
+    dst = copyPlane(dst, frame.planes[0], frame.width * (wide ? 2 : 1), frame.height);
+    if (semiPlanar) copyPlane(dst, frame.planes[1], frame.width, frame.height / 2);
+}
+
+RawRecorder::RawRecorder(QObject *parent)
+    : QObject(parent)
+{
+    memset(&m_header, 0, sizeof(m_header));
+    m_thread = std::thread(&RawRecorder::loop, this);
+}
+
+RawRecorder::~RawRecorder()
+{
+    stop();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_one();
+    m_thread.join();
+    for (Chunk &chunk : m_chunks) free(chunk.data);
+}
+
+QString RawRecorder::path() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_path;
+}
+
+bool RawRecorder::start(const QString &path)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this] { return !m_closing; });
+    if (m_open) return true;
+
+    const QString file = path.isEmpty()
+        ? QDateTime::currentDateTime().toString("'owlet-'yyyyMMdd-hhmmss'.raw'") : path;
+    int fd = ::open(file.toLocal8Bit().constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC | O_DIRECT, 0644);
+    if (fd < 0 && errno == EINVAL) {
+        // tmpfs and some network filesystems refuse O_DIRECT
+        qWarning() << "Recorder:" << file << "does not take O_DIRECT, writing through the page cache";
+        fd = ::open(file.toLocal8Bit().constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    }
+    if (fd < 0) {
+        const QString error = QString("open(%1) failed: %2").arg(file).arg(strerror(errno));
+        lock.unlock();
+        emit errorOccurred(error);
+        return false;
+    }
+    const QString indexFile = file + ".idx";
+    const int indexFd = ::open(indexFile.toLocal8Bit().constData(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (indexFd < 0) {
+        const QString error = QString("open(%1) failed: %2").arg(indexFile).arg(strerror(errno));
+        ::close(fd);
+        lock.unlock();
+        emit errorOccurred(error);
+        return false;
+    }
+
+    // the staging buffers are allocated by the first recording and kept
+    if (m_chunks.empty()) {
+        m_chunks.resize(Chunks);
+        for (Chunk &chunk : m_chunks) {
+            void *data = nullptr;
+            if (posix_memalign(&data, BlockBytes, ChunkBytes) != 0) data = nullptr;
+            chunk.data = static_cast<uchar*>(data);
+            chunk.index.reserve(64);
+        }
+    }
+    m_free.clear();
+    for (Chunk &chunk : m_chunks) {
+        if (chunk.data) m_free.push_back(&chunk);
+    }
+
+    m_dataFd = fd;
+    m_indexFd = indexFd;
+    m_offset = 0;
+    memset(&m_header, 0, sizeof(m_header));
+    m_path = file;
+    m_open = true;
+    m_written = 0;
+    m_dropped = 0;
+    m_backlog = 0;
+    m_recording = true;
+    lock.unlock();
+    qDebug() << "Recording raw frames to" << file;
+    emit recordingChanged();
+    emit progress();
+    return true;
+}
+
+void RawRecorder::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_open) return;
+        closeLocked();
+    }
+    m_wake.notify_one();
+    emit recordingChanged();
+}
+
+// stops taking frames; the I/O thread writes what is left and closes
+void RawRecorder::closeLocked()
+{
+    m_open = false;
+    m_recording = false;
+    if (m_fill) {
+        if (m_fill->index.empty()) {
+            m_free.push_back(m_fill);
+        } else {
+            m_full.push_back(m_fill);
+        }
+        m_fill = nullptr;
+    }
+    m_closing = true;
+}
+
+void RawRecorder::submit(const RawFrame &frame, uint32_t sequence, qint64 timestampNs)
+{
+    if (!recording() || !frame.planeCount) return;
+    const int bytes = rawFrameBytes(frame);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if (!m_open) return;
+    QString error;
+    if (!m_header.frameBytes) {
+        memcpy(m_header.magic, "OWLRAW1", 8);
+        m_header.pixelFormat = frame.pixelFormat;
+        m_header.width = frame.width;
+        m_header.height = frame.height;
+        m_header.frameBytes = bytes;
+        if (!bytes) {
+            error = QString("Recorder: pixel format %1 cannot be recorded").arg(frame.pixelFormat);
+        } else if (sizeof(RawChunkHeader) + bytes > (size_t)ChunkBytes) {
+            error = QString("Recorder: %1x%2 frames do not fit a chunk").arg(frame.width).arg(frame.height);
+        }
+    } else if (frame.pixelFormat != m_header.pixelFormat || (uint32_t)frame.width != m_header.width
+               || (uint32_t)frame.height != m_header.height) {
+        error = QString("Recorder: the stream changed format, recording stopped");
+    }
+    if (!error.isEmpty()) {
+        closeLocked();
+        lock.unlock();
+        m_wake.notify_one();
+        emit errorOccurred(error);
+        emit recordingChanged();
+        return;
+    }
+
+    if (m_fill && m_fill->used + bytes > (size_t)ChunkBytes) {
+        m_full.push_back(m_fill);
+        m_fill = nullptr;
+        m_backlog = (int)m_full.size();
+        m_wake.notify_one();
+    }
+    if (!m_fill) {
+        if (m_free.empty()) {
+            // every chunk is waiting for the disk
+            const int n = ++m_dropped;
+            lock.unlock();
+            if ((n & (n - 1)) == 0) qWarning() << "Recorder: disk is falling behind," << n << "frames dropped";
+            emit progress();
+            return;
+        }
+        m_fill = m_free.back();
+        m_free.pop_back();
+        m_fill->used = sizeof(RawChunkHeader);
+        m_fill->index.clear();
+    }
+
+    packRawFrame(frame, m_fill->data + m_fill->used);
+    RawIndexEntry entry;
+    entry.offset = m_fill->used;
+    entry.timestampNs = timestampNs;
+    entry.sequence = sequence;
+    entry.bytes = bytes;
+    m_fill->index.push_back(entry);
+    m_fill->used += bytes;
+}
+
+void RawRecorder::loop()
+{
+    for (;;) {
+        Chunk *chunk = nullptr;
+        RawFileHeader header;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this] { return !m_full.empty() || m_closing || m_quit; });
+            if (!m_full.empty()) {
+                chunk = m_full.front();
+                m_full.pop_front();
+                header = m_header;
+            } else if (m_closing) {
+                // start() waits for m_closing, the files are ours
+                lock.unlock();
+                closeFiles();
+                lock.lock();
+                m_closing = false;
+                m_failed = false;
+                m_idle.notify_all();
+                continue;
+            } else {
+                return;
+            }
+        }
+
+        QString error;
+        const bool ok = m_failed || writeChunk(chunk, header, error);
+        bool stopped = false;
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_free.push_back(chunk);
+            m_backlog = (int)m_full.size();
+            if (!ok) {
+                // what is on disk stays readable; the rest is dropped
+                m_failed = true;
+                if (m_open) {
+                    closeLocked();
+                    stopped = true;
+                }
+            }
+        }
+        if (!ok) emit errorOccurred(error);
+        if (stopped) emit recordingChanged();
+        emit progress();
+    }
+}
+
+// I/O thread: one chunk to the data file at the next block, its frames to
+// the index. The file header goes ahead of the first chunk.
+bool RawRecorder::writeChunk(Chunk *chunk, const RawFileHeader &header, QString &error)
+{
+    if (m_offset == 0) {
+        // a block of its own, aligned for O_DIRECT
+        void *block = nullptr;
+        if (posix_memalign(&block, BlockBytes, BlockBytes) != 0) {
+            error = QString("Recorder: out of memory");
+            return false;
+        }
+        memset(block, 0, BlockBytes);
+        memcpy(block, &header, sizeof(header));
+        const bool ok = writeAll(m_dataFd, static_cast<uchar*>(block), BlockBytes, 0);
+        free(block);
+        if (!ok) {
+            error = QString("Recorder: writing %1 failed: %2").arg(m_path).arg(strerror(errno));
+            return false;
+        }
+        m_offset = BlockBytes;
+    }
+
+    RawChunkHeader *chunkHeader = reinterpret_cast<RawChunkHeader*>(chunk->data);
+    memcpy(chunkHeader->magic, "OWLC", 4);
+    chunkHeader->frames = (uint32_t)chunk->index.size();
+    chunkHeader->payloadBytes = chunk->used - sizeof(RawChunkHeader);
+    // O_DIRECT writes whole blocks
+    const size_t length = (chunk->used + BlockBytes - 1) & ~(size_t)(BlockBytes - 1);
+    memset(chunk->data + chunk->used, 0, length - chunk->used);
+    if (!writeAll(m_dataFd, chunk->data, length, (off_t)m_offset)) {
+        error = QString("Recorder: writing %1 failed: %2").arg(m_path).arg(strerror(errno));
+        return false;
+    }
+
+    for (RawIndexEntry &entry : chunk->index) entry.offset += m_offset;
+    const size_t indexBytes = chunk->index.size() * sizeof(RawIndexEntry);
+    const off_t indexOffset = (off_t)(m_written.load(std::memory_order_relaxed) * sizeof(RawIndexEntry));
+    if (!writeAll(m_indexFd, reinterpret_cast<const uchar*>(chunk->index.data()), indexBytes, indexOffset)) {
+        error = QString("Recorder: writing %1.idx failed: %2").arg(m_path).arg(strerror(errno));
+        return false;
+    }
+    m_offset += length;
+    m_written += (int)chunk->index.size();
+    return true;
+}
+
+// I/O thread, once everything is written
+void RawRecorder::closeFiles()
+{
+    if (m_dataFd >= 0) {
+        fdatasync(m_dataFd);
+        ::close(m_dataFd);
+        m_dataFd = -1;
+    }
+    if (m_indexFd >= 0) {
+        fdatasync(m_indexFd);
+        ::close(m_indexFd);
+        m_indexFd = -1;
+    }
+    qDebug() << "Recorded" << m_written.load() << "frames to" << m_path << "," << m_dropped.load() << "dropped";
+}
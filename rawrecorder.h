@@ -0,0 +1,136 @@
+#pragma once
+
+#include <QObject>
+#include <QString>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "videoframe.h"
+
+// Records raw sensor frames as the driver delivered them, before any
+// conversion: NV12 takes half the space of the RGB it turns into.
+//
+// Files, little-endian:
+//   <path>      RawFileHeader padded to BlockBytes, then chunks. A chunk is
+//               a RawChunkHeader followed by its frames back to back, zero
+//               padded to a multiple of BlockBytes. Frames are stored the way
+//               ReplaySource reads them: planes in order, rows unpadded.
+//   <path>.idx  one RawIndexEntry per frame, in capture order
+//
+// The capture thread copies each frame into a page-aligned chunk buffer and
+// moves on; an I/O thread writes full chunks with O_DIRECT, past the page
+// cache. There are Chunks buffers: when all of them are waiting for the
+// disk, frames are dropped and counted instead of stalling capture.
+struct RawFileHeader
+{
+    char magic[8];        // "OWLRAW1\0"
+    uint32_t pixelFormat; // V4L2_PIX_FMT_*
+    uint32_t width;
+    uint32_t height;
+    uint32_t frameBytes;
+};
+
+struct RawChunkHeader
+{
+    char magic[4];         // "OWLC"
+    uint32_t frames;
+    uint64_t payloadBytes; // frame bytes following the header
+};
+
+struct RawIndexEntry
+{
+    uint64_t offset;      // of the frame's first byte in <path>
+    int64_t timestampNs;  // CLOCK_MONOTONIC capture time
+    uint32_t sequence;    // v4l2_buffer.sequence
+    uint32_t bytes;
+};
+
+// Frames stored unpadded, planes in order: the layout of recordings and of
+// ReplaySource. Bytes per frame, 0 for frames that cannot be stored.
+int rawFrameBytes(const RawFrame &frame);
+void packRawFrame(const RawFrame &frame, uchar *dst);
+
+class RawRecorder : public QObject
+{
+    Q_OBJECT
+    Q_PROPERTY(bool recording READ recording NOTIFY recordingChanged)
+    Q_PROPERTY(QString path READ path NOTIFY recordingChanged)
+    // since start(): frames on disk, and frames lost because the disk fell behind
+    Q_PROPERTY(int writtenFrames READ writtenFrames NOTIFY progress)
+    Q_PROPERTY(int droppedFrames READ droppedFrames NOTIFY progress)
+    // full chunks waiting for the disk, 0..Chunks; staying near Chunks means
+    // the disk does not keep up and frames are about to be dropped
+    Q_PROPERTY(int backlog READ backlog NOTIFY progress)
+    Q_PROPERTY(int chunkCount READ chunkCount CONSTANT)
+public:
+    enum { BlockBytes = 4096, ChunkBytes = 8 << 20, Chunks = 4 };
+
+    explicit RawRecorder(QObject *parent = nullptr);
+    ~RawRecorder() override;
+
+    // GUI thread. An empty path records to owlet-<date>-<time>.raw in the
+    // working directory. Waits for a previous recording to be written out.
+    Q_INVOKABLE bool start(const QString &path = QString());
+    // any thread: what has been captured is still written, then the files
+    // are closed
+    Q_INVOKABLE void stop();
+
+    bool recording() const { return m_recording.load(std::memory_order_relaxed); }
+    QString path() const;
+    int writtenFrames() const { return m_written.load(std::memory_order_relaxed); }
+    int droppedFrames() const { return m_dropped.load(std::memory_order_relaxed); }
+    int backlog() const { return m_backlog.load(std::memory_order_relaxed); }
+    int chunkCount() const { return Chunks; }
+
+    // capture thread: copies a whole frame into the current chunk; never
+    // waits for the disk
+    void submit(const RawFrame &frame, uint32_t sequence, qint64 timestampNs);
+
+signals:
+    void recordingChanged();
+    void progress();
+    void errorOccurred(const QString &message);
+
+private:
+    struct Chunk {
+        uchar *data{nullptr}; // ChunkBytes, BlockBytes aligned
+        size_t used{0};
+        std::vector<RawIndexEntry> index; // offsets within the chunk until written
+    };
+
+    void loop();
+    void closeLocked();
+    bool writeChunk(Chunk *chunk, const RawFileHeader &header, QString &error);
+    void closeFiles();
+
+    std::vector<Chunk> m_chunks;
+
+    std::thread m_thread;
+    mutable std::mutex m_mutex; // everything down to m_offset
+    std::condition_variable m_wake;  // chunks to write, closing or quitting
+    std::condition_variable m_idle;  // a recording has been written out
+    std::vector<Chunk*> m_free;
+    std::deque<Chunk*> m_full;
+    Chunk *m_fill{nullptr}; // being filled by capture
+    bool m_open{false};     // accepting frames
+    bool m_closing{false};  // write out m_full, then close the files
+    bool m_quit{false};
+    QString m_path;
+    RawFileHeader m_header; // frameBytes 0 until the first frame
+    int m_dataFd{-1};
+    int m_indexFd{-1};
+    uint64_t m_offset{0};   // file offset of the next chunk; I/O thread while open
+
+    // I/O thread only
+    bool m_failed{false};
+
+    std::atomic<bool> m_recording{false};
+    std::atomic<int> m_written{0};
+    std::atomic<int> m_dropped{0};
+    std::atomic<int> m_backlog{0};
+};
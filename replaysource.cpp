@@ -0,0 +1,265 @@
+#include "replaysource.h"
+#include "framestats.h"
+#include <linux/videodev2.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <errno.h>
+#include <chrono>
+#include <QDebug>
+#include <QStringList>
+
+ReplaySource::Mapping::~Mapping()
+{
+    if (data) munmap(const_cast<uchar*>(data), size);
+}
+
+void ReplaySource::Mapping::unref()
+{
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+}
+
+void ReplaySource::Mapping::release(int index)
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        busy[index] = false;
+    }
+    wake.notify_all();
+}
+
+void ReplaySource::Mapping::releaseRawFrame(RawFrame *frame)
+{
+    Mapping *self = static_cast<Mapping*>(frame->owner);
+    self->release(frame->index);
+    self->unref();
+}
+
+ReplaySource::ReplaySource(const QString &path, uint32_t pixelFormat, int width, int height,
+                           double fps, bool loop)
+    : m_path(path), m_fps(fps > 0 ? fps : 0.0), m_loop(loop)
+{
+    m_pixfmt = pixelFormat;
+    m_width = width;
+    m_height = height;
+}
+
+ReplaySource::~ReplaySource()
+{
+    stop();
+}
+
+ReplaySource *ReplaySource::fromSpec(const QString &spec, QString &error)
+{
+    const QStringList parts = spec.split(',');
+    if (parts.size() < 3 || parts.size() > 4) {
+        error = QString("Replay spec \"%1\" is not <file>,<FOURCC>,<width>x<height>[,<fps>]").arg(spec);
+        return nullptr;
+    }
+    const QByteArray code = parts[1].trimmed().toUpper().toLatin1().leftJustified(4, ' ', true);
+    const uint32_t pixfmt = v4l2_fourcc(code[0], code[1], code[2], code[3]);
+    const QStringList size = parts[2].trimmed().split('x');
+    bool okW = false, okH = false, okFps = true;
+    const int width = size.size() == 2 ? size[0].toInt(&okW) : 0;
+    const int height = size.size() == 2 ? size[1].toInt(&okH) : 0;
+    const double fps = parts.size() == 4 ? parts[3].trimmed().toDouble(&okFps) : 0.0;
+    if (!okW || !okH || !okFps || width <= 0 || height <= 0) {
+        error = QString("Replay spec \"%1\": bad size or rate").arg(spec);
+        return nullptr;
+    }
+    if (!frameBytes(pixfmt, width, height)) {
+        error = QString("Replay spec \"%1\": unsupported format %2").arg(spec).arg(QString::fromLatin1(code));
+        return nullptr;
+    }
+    return new ReplaySource(parts[0], pixfmt, width, height, fps);
+}
+
+int ReplaySource::frameBytes(uint32_t pixelFormat, int width, int height)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV21:
+        return width * height * 3 / 2;
+    case V4L2_PIX_FMT_YUYV:
+    case V4L2_PIX_FMT_UYVY:
+    case V4L2_PIX_FMT_Y10:
+    case V4L2_PIX_FMT_Y12:
+    case V4L2_PIX_FMT_Y14:
+    case V4L2_PIX_FMT_Y16:
+        return width * height * 2;
+    case V4L2_PIX_FMT_GREY:
+        return width * height;
+    default:
+        return 0;
+    }
+}
+
+bool ReplaySource::start(int width, int height, QString &error)
+{
+    Q_UNUSED(width)
+    Q_UNUSED(height)
+    m_frameBytes = frameBytes(m_pixfmt, m_width, m_height);
+    if (!m_frameBytes) {
+        error = QString("Replay of %1: unsupported pixel format %2").arg(m_path).arg(m_pixfmt);
+        return false;
+    }
+
+    int fd = ::open(m_path.toLocal8Bit().constData(), O_RDONLY);
+    if (fd < 0) {
+        error = QString("open(%1) failed: %2").arg(m_path).arg(strerror(errno));
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        error = QString("fstat(%1) failed: %2").arg(m_path).arg(strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    m_frameCount = (int)(st.st_size / m_frameBytes);
+    if (m_frameCount < 1) {
+        error = QString("%1 holds no complete %2x%3 frame").arg(m_path).arg(m_width).arg(m_height);
+        ::close(fd);
+        return false;
+    }
+    const size_t size = (size_t)m_frameCount * m_frameBytes;
+    // prefaulted: replay timing must not depend on the disk
+    void *data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        error = QString("mmap(%1) failed: %2").arg(m_path).arg(strerror(errno));
+        return false;
+    }
+    if ((qint64)size != (qint64)st.st_size) {
+        qWarning() << "Replay:" << m_path << "ends in a partial frame, ignoring its last"
+                   << (qint64)st.st_size - (qint64)size << "bytes";
+    }
+
+    Mapping *map = new Mapping;
+    map->data = static_cast<const uchar*>(data);
+    map->size = size;
+    for (int i = 0; i < Buffers; ++i) {
+        map->frames[i].release = &Mapping::releaseRawFrame;
+        map->frames[i].owner = map;
+        map->frames[i].index = i;
+    }
+    {
+        std::lock_guard<std::mutex> guard(m_mapMutex);
+        m_map = map;
+    }
+    m_next = 0;
+    m_sequence = 0;
+    m_due = monotonicNs();
+    qDebug() << "Replaying" << m_path << ":" << m_frameCount << "frames of" << m_width << "x" << m_height
+             << (m_fps > 0 ? QString("at %1 fps").arg(m_fps) : QString("unthrottled"));
+    return true;
+}
+
+void ReplaySource::stop()
+{
+    std::lock_guard<std::mutex> guard(m_mapMutex);
+    if (m_map) {
+        m_map->unref();
+        m_map = nullptr;
+    }
+}
+
+void ReplaySource::wakeup()
+{
+    std::lock_guard<std::mutex> guard(m_mapMutex);
+    if (!m_map) return;
+    {
+        std::lock_guard<std::mutex> lock(m_map->mutex);
+        m_map->woken = true;
+    }
+    m_map->wake.notify_all();
+}
+
+FrameSource::Status ReplaySource::dequeue(SourceBuffer &out, int timeoutMs, QString &error)
+{
+    if (!m_map) {
+        error = QString("Replay of %1 is not running").arg(m_path);
+        return Finished;
+    }
+    if (!m_loop && m_next >= m_frameCount) return Finished;
+
+    const bool forever = timeoutMs < 0;
+    const qint64 deadline = forever ? 0 : monotonicNs() + (qint64)timeoutMs * 1000000;
+    std::unique_lock<std::mutex> lock(m_map->mutex);
+    // false when woken up or out of time
+    auto wait = [&](qint64 until) {
+        if (m_map->woken) {
+            m_map->woken = false;
+            return false;
+        }
+        const qint64 now = monotonicNs();
+        if (!forever && now >= deadline) return false;
+        if (!forever && (!until || until > deadline)) until = deadline;
+        if (until) {
+            m_map->wake.wait_for(lock, std::chrono::nanoseconds(until - now));
+        } else {
+            m_map->wake.wait(lock);
+        }
+        return true;
+    };
+
+    // paced: the frame is not there before it is due, as with a sensor
+    while (m_fps > 0 && monotonicNs() < m_due) {
+        if (!wait(m_due)) return Again;
+    }
+
+    int slot = -1;
+    for (;;) {
+        for (int i = 0; i < Buffers && slot < 0; ++i) {
+            if (!m_map->busy[i]) slot = i;
+        }
+        if (slot >= 0) break;
+        if (!wait(0)) return Again;
+    }
+    m_map->busy[slot] = true;
+    lock.unlock();
+
+    if (m_next >= m_frameCount) m_next = 0;
+    out.index = slot;
+    out.planeCount = 1;
+    out.planes[0] = m_map->data + (size_t)m_next * m_frameBytes;
+    out.bytesPerLine[0] = m_frameBytes / m_height;
+    if (m_pixfmt == V4L2_PIX_FMT_NV12 || m_pixfmt == V4L2_PIX_FMT_NV21) {
+        // rows are stored tightly packed, chroma right after luma
+        out.planeCount = 2;
+        out.bytesPerLine[0] = m_width;
+        out.planes[1] = out.planes[0] + (size_t)m_width * m_height;
+        out.bytesPerLine[1] = m_width;
+    }
+    out.sequence = m_sequence++;
+    ++m_next;
+
+    const qint64 now = monotonicNs();
+    if (m_fps > 0) {
+        out.timestampNs = m_due;
+        m_due += (qint64)(1e9 / m_fps);
+        // a stalled consumer does not earn a burst of catch-up frames
+        if (m_due < now) m_due = now;
+    } else {
+        out.timestampNs = now;
+    }
+    return Ok;
+}
+
+bool ReplaySource::requeue(int index, QString &error)
+{
+    if (!m_map || index < 0 || index >= Buffers) {
+        error = QString("Replay requeue of invalid buffer %1").arg(index);
+        return false;
+    }
+    m_map->release(index);
+    return true;
+}
+
+RawFrame *ReplaySource::exportBuffer(int index)
+{
+    // the slot becomes free again when the last reference is dropped
+    m_map->refs.fetch_add(1, std::memory_order_relaxed);
+    return &m_map->frames[index];
+}
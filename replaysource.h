@@ -0,0 +1,77 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+
+#include "framesource.h"
+
+// Plays back raw frames stored back to back in a file, exactly as the driver
+// delivered them (NV12/NV21, YUYV/UYVY, GREY or Y10..Y16), so the pipeline
+// can run without a sensor. The file has no header; format and size are
+// given up front. It is mapped read-only and prefaulted, so replay never
+// waits for the disk.
+//
+// Frames come at fps, or as fast as they are consumed when fps is 0, and the
+// file starts over at its end unless loop is off. Buffers follow the
+// driver's rules: there are Buffers slots pointing into the mapping, an
+// exported slot stays out until its RawFrame is released, and with every
+// slot out dequeue() waits like a starved driver.
+class ReplaySource : public FrameSource
+{
+public:
+    enum { Buffers = 4 };
+
+    ReplaySource(const QString &path, uint32_t pixelFormat, int width, int height,
+                 double fps = 0.0, bool loop = true);
+    ~ReplaySource() override;
+
+    // "<file>,<FOURCC>,<width>x<height>[,<fps>]", e.g. "cap.yuv,NV12,1280x720,30";
+    // nullptr and error set when the spec does not parse
+    static ReplaySource *fromSpec(const QString &spec, QString &error);
+    // bytes per frame, 0 for formats replay does not know
+    static int frameBytes(uint32_t pixelFormat, int width, int height);
+
+    QString name() const override { return m_path; }
+
+    // the requested size is ignored: the file dictates it
+    bool start(int width, int height, QString &error) override;
+    void stop() override;
+
+    Status dequeue(SourceBuffer &buf, int timeoutMs, QString &error) override;
+    void wakeup() override;
+    bool requeue(int index, QString &error) override;
+    RawFrame *exportBuffer(int index) override;
+
+private:
+    // The mapped file and its slots. Reference counted like the driver
+    // buffers of V4L2Source: exported frames keep the mapping alive past stop().
+    struct Mapping {
+        const uchar *data{nullptr};
+        size_t size{0};
+        RawFrame frames[Buffers];
+        bool busy[Buffers] = {};  // guarded by mutex
+        bool woken{false};        // guarded by mutex
+        std::mutex mutex;
+        std::condition_variable wake; // a slot was released, or wakeup()
+        std::atomic<int> refs{1};
+
+        ~Mapping();
+        void unref();
+        void release(int index);
+        static void releaseRawFrame(RawFrame *frame);
+    };
+
+    QString m_path;
+    double m_fps;
+    bool m_loop;
+    Mapping *m_map{nullptr};
+    std::mutex m_mapMutex; // m_map against wakeup() from other threads
+    int m_frameBytes{0};
+    int m_frameCount{0};
+
+    // capture thread only
+    int m_next{0};
+    uint32_t m_sequence{0};
+    qint64 m_due{0};  // when the next frame is due, paced replay only
+};
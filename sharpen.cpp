@@ -0,0 +1,211 @@
+#include "sharpen.h"
+#include "agc.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#define OWLET_SHARPEN_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OWLET_SHARPEN_NEON 1
+#endif
+
+static inline int clampRow(int r, int height)
+{
+    return r < 0 ? 0 : (r >= height ? height - 1 : r);
+}
+
+// binomial taps over 3 or 5 neighbours; the 5-tap sum of 5-tap sums is at
+// most 255 * 256, so everything fits in uint16
+static inline int taps3(int a, int b, int c) { return a + 2 * b + c; }
+static inline int taps5(int a, int b, int c, int d, int e) { return a + 4 * b + 6 * c + 4 * d + e; }
+
+static inline uint8_t combinePixel(int y, int vsum, int shift, int amount)
+{
+    const int blur = (vsum + (1 << (shift - 1))) >> shift;
+    const int out = y + (((y - blur) * amount + 16) >> 5);
+    return (uint8_t)(out < 0 ? 0 : (out > 255 ? 255 : out));
+}
+
+void LumaSharpener::begin(const uint8_t *plane, int pixelStep, int rowStride, int width, int height,
+                          int radius, int amount, int firstRow)
+{
+    m_plane = plane;
+    m_plane16 = nullptr;
+    m_step = pixelStep;
+    m_stride = rowStride;
+    m_width = width;
+    m_height = height;
+    m_radius = (radius >= 2) ? 2 : 1;
+    m_amount = amount < 0 ? 0 : (amount > MaxAmount ? (int)MaxAmount : amount);
+    m_taps = 2 * m_radius + 1;
+    m_nextRow = clampRow(firstRow - m_radius, height);
+
+    // grows on the first frame (or a wider one) only
+    const size_t lumaSize = (size_t)m_taps * (width + 2 * m_radius);
+    if (m_luma.size() < lumaSize) m_luma.resize(lumaSize);
+    if (m_hsum.size() < (size_t)m_taps * width) m_hsum.resize((size_t)m_taps * width);
+    if (m_out.size() < (size_t)width) m_out.resize(width);
+}
+
+void LumaSharpener::begin16(const uint16_t *plane, int rowStride, const uint8_t *agcTable, int maxValue,
+                            int width, int height, int radius, int amount, int firstRow)
+{
+    begin(nullptr, 1, rowStride, width, height, radius, amount, firstRow);
+    m_plane16 = plane;
+    m_agcTable = agcTable;
+    m_maxValue = maxValue;
+}
+
+void LumaSharpener::loadRow(int s)
+{
+    const int r = m_radius;
+    const int w = m_width;
+    const int slot = s % m_taps;
+    uint8_t *l = &m_luma[(size_t)slot * (w + 2 * r)];
+    uint16_t *h = &m_hsum[(size_t)slot * w];
+
+    // edge-padded copy of the source row
+    if (m_plane16) {
+        agcMapRow(m_plane16 + (size_t)s * m_stride, m_agcTable, m_maxValue, l + r, w);
+    } else {
+        const uint8_t *src = m_plane + (size_t)s * m_stride;
+        for (int x = 0; x < w; ++x) l[r + x] = src[x * m_step];
+    }
+    for (int i = 0; i < r; ++i) {
+        l[i] = l[r];
+        l[r + w + i] = l[r + w - 1];
+    }
+
+    int x = 0;
+#if defined(OWLET_SHARPEN_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    for (; x + 16 <= w; x += 16) {
+        __m128i lo, hi;
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + x));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + x + 1));
+        __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + x + 2));
+        if (r == 1) {
+            lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(c, zero)),
+                               _mm_slli_epi16(_mm_unpacklo_epi8(b, zero), 1));
+            hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(c, zero)),
+                               _mm_slli_epi16(_mm_unpackhi_epi8(b, zero), 1));
+        } else {
+            __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + x + 3));
+            __m128i e = _mm_loadu_si128(reinterpret_cast<const __m128i*>(l + x + 4));
+            __m128i cl = _mm_unpacklo_epi8(c, zero), ch = _mm_unpackhi_epi8(c, zero);
+            lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(e, zero)),
+                               _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(b, zero), _mm_unpacklo_epi8(d, zero)), cl), 2),
+                                             _mm_slli_epi16(cl, 1)));
+            hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(e, zero)),
+                               _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(b, zero), _mm_unpackhi_epi8(d, zero)), ch), 2),
+                                             _mm_slli_epi16(ch, 1)));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h + x), lo);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(h + x + 8), hi);
+    }
+#elif defined(OWLET_SHARPEN_NEON)
+    for (; x + 16 <= w; x += 16) {
+        uint8x16_t a = vld1q_u8(l + x), b = vld1q_u8(l + x + 1), c = vld1q_u8(l + x + 2);
+        uint16x8_t lo, hi;
+        if (r == 1) {
+            lo = vaddq_u16(vaddl_u8(vget_low_u8(a), vget_low_u8(c)), vshll_n_u8(vget_low_u8(b), 1));
+            hi = vaddq_u16(vaddl_u8(vget_high_u8(a), vget_high_u8(c)), vshll_n_u8(vget_high_u8(b), 1));
+        } else {
+            uint8x16_t d = vld1q_u8(l + x + 3), e = vld1q_u8(l + x + 4);
+            uint16x8_t cl = vmovl_u8(vget_low_u8(c)), ch = vmovl_u8(vget_high_u8(c));
+            lo = vaddq_u16(vaddl_u8(vget_low_u8(a), vget_low_u8(e)),
+                           vaddq_u16(vshlq_n_u16(vaddq_u16(vaddl_u8(vget_low_u8(b), vget_low_u8(d)), cl), 2), vshlq_n_u16(cl, 1)));
+            hi = vaddq_u16(vaddl_u8(vget_high_u8(a), vget_high_u8(e)),
+                           vaddq_u16(vshlq_n_u16(vaddq_u16(vaddl_u8(vget_high_u8(b), vget_high_u8(d)), ch), 2), vshlq_n_u16(ch, 1)));
+        }
+        vst1q_u16(h + x, lo);
+        vst1q_u16(h + x + 8, hi);
+    }
+#endif
+    for (; x < w; ++x) {
+        h[x] = (r == 1) ? taps3(l[x], l[x + 1], l[x + 2])
+                        : taps5(l[x], l[x + 1], l[x + 2], l[x + 3], l[x + 4]);
+    }
+}
+
+const uint8_t *LumaSharpener::row(int r)
+{
+    const int rad = m_radius;
+    const int w = m_width;
+    const int last = clampRow(r + rad, m_height);
+    while (m_nextRow <= last) loadRow(m_nextRow++);
+
+    const uint16_t *h[5];
+    for (int d = -rad; d <= rad; ++d) {
+        h[d + rad] = &m_hsum[(size_t)(clampRow(r + d, m_height) % m_taps) * w];
+    }
+    const uint8_t *y = &m_luma[(size_t)(r % m_taps) * (w + 2 * rad)] + rad;
+    uint8_t *out = m_out.data();
+    const int shift = 4 * rad;
+
+    int x = 0;
+#if defined(OWLET_SHARPEN_SSE2)
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi16((short)(1 << (shift - 1)));
+    const __m128i amount = _mm_set1_epi16((short)m_amount);
+    const __m128i k16 = _mm_set1_epi16(16);
+    const __m128i shiftCount = _mm_cvtsi32_si128(shift);
+    for (; x + 16 <= w; x += 16) {
+        __m128i res[2];
+        const __m128i yv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        for (int half = 0; half < 2; ++half) {
+            const int o = x + half * 8;
+            __m128i v;
+            if (rad == 1) {
+                v = _mm_add_epi16(_mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h[0] + o)),
+                                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(h[2] + o))),
+                                  _mm_slli_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h[1] + o)), 1));
+            } else {
+                const __m128i c = _mm_loadu_si128(reinterpret_cast<const __m128i*>(h[2] + o));
+                const __m128i bd = _mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h[1] + o)),
+                                                 _mm_loadu_si128(reinterpret_cast<const __m128i*>(h[3] + o)));
+                v = _mm_add_epi16(_mm_add_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(h[0] + o)),
+                                                _mm_loadu_si128(reinterpret_cast<const __m128i*>(h[4] + o))),
+                                  _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(bd, c), 2), _mm_slli_epi16(c, 1)));
+            }
+            const __m128i blur = _mm_srl_epi16(_mm_add_epi16(v, round), shiftCount);
+            const __m128i y16 = half ? _mm_unpackhi_epi8(yv, zero) : _mm_unpacklo_epi8(yv, zero);
+            const __m128i detail = _mm_srai_epi16(_mm_add_epi16(_mm_mullo_epi16(_mm_sub_epi16(y16, blur), amount), k16), 5);
+            res[half] = _mm_add_epi16(y16, detail);
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + x), _mm_packus_epi16(res[0], res[1]));
+    }
+#elif defined(OWLET_SHARPEN_NEON)
+    const int16x8_t amount = vdupq_n_s16((int16_t)m_amount);
+    const int16x8_t k16 = vdupq_n_s16(16);
+    const uint16x8_t round = vdupq_n_u16((uint16_t)(1 << (shift - 1)));
+    const int16x8_t negShift = vdupq_n_s16((int16_t)-shift);
+    for (; x + 16 <= w; x += 16) {
+        int16x8_t res[2];
+        const uint8x16_t yv = vld1q_u8(y + x);
+        for (int half = 0; half < 2; ++half) {
+            const int o = x + half * 8;
+            uint16x8_t v;
+            if (rad == 1) {
+                v = vaddq_u16(vaddq_u16(vld1q_u16(h[0] + o), vld1q_u16(h[2] + o)), vshlq_n_u16(vld1q_u16(h[1] + o), 1));
+            } else {
+                const uint16x8_t c = vld1q_u16(h[2] + o);
+                const uint16x8_t bd = vaddq_u16(vld1q_u16(h[1] + o), vld1q_u16(h[3] + o));
+                v = vaddq_u16(vaddq_u16(vld1q_u16(h[0] + o), vld1q_u16(h[4] + o)),
+                              vaddq_u16(vshlq_n_u16(vaddq_u16(bd, c), 2), vshlq_n_u16(c, 1)));
+            }
+            const int16x8_t blur = vreinterpretq_s16_u16(vshlq_u16(vaddq_u16(v, round), negShift));
+            const int16x8_t y16 = vreinterpretq_s16_u16(vmovl_u8(half ? vget_high_u8(yv) : vget_low_u8(yv)));
+            const int16x8_t detail = vshrq_n_s16(vaddq_s16(vmulq_s16(vsubq_s16(y16, blur), amount), k16), 5);
+            res[half] = vaddq_s16(y16, detail);
+        }
+        vst1q_u8(out + x, vcombine_u8(vqmovun_s16(res[0]), vqmovun_s16(res[1])));
+    }
+#endif
+    for (; x < w; ++x) {
+        const int v = (rad == 1) ? taps3(h[0][x], h[1][x], h[2][x])
+                                 : taps5(h[0][x], h[1][x], h[2][x], h[3][x], h[4][x]);
+        out[x] = combinePixel(y[x], v, shift, m_amount);
+    }
+    return out;
+}
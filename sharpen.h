@@ -0,0 +1,55 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+
+// Unsharp mask on luma: out = y + amount * (y - blur(y)), with blur a
+// separable binomial filter, [1 2 1] (3x3) or [1 4 6 4 1] (5x5).
+//
+// Rows are streamed one at a time through a rolling buffer that holds the
+// last 2 * radius + 1 source rows and their horizontal sums, so memory is
+// O(width) (about 15 KB at 1280 wide, inside L1) and there is no full-frame
+// temporary. Every pixel costs one horizontal and one vertical pass of
+// 2 * radius + 1 taps plus the combine, all in 16-bit lanes, 16 pixels per
+// SIMD step (SSE2 or NEON). Results are identical to the scalar code.
+//
+// One instance serves one band at a time; each conversion thread keeps its own.
+class LumaSharpener
+{
+public:
+    enum { MaxAmount = 128 }; // amount is in 1/32 steps: 32 = 1.0, 128 = 4.0
+
+    // plane: first luma byte of the frame; pixelStep 1 for planar luma, 2 for
+    // packed 4:2:2 (plane then points at the first luma byte); rowStride in bytes.
+    // radius: 1 (3x3) or 2 (5x5). firstRow: first row that will be requested.
+    void begin(const uint8_t *plane, int pixelStep, int rowStride, int width, int height,
+               int radius, int amount, int firstRow);
+    // the same for 16-bit radiometric input, brought to 8 bits through an AGC
+    // table (see agcMapRow) as rows enter the buffer; rowStride in pixels
+    void begin16(const uint16_t *plane, int rowStride, const uint8_t *agcTable, int maxValue,
+                 int width, int height, int radius, int amount, int firstRow);
+
+    // sharpened luma of row r; rows must be requested in increasing order.
+    // The returned row stays valid until the next call.
+    const uint8_t *row(int r);
+
+private:
+    void loadRow(int s);
+
+    const uint8_t *m_plane{nullptr};
+    const uint16_t *m_plane16{nullptr};
+    const uint8_t *m_agcTable{nullptr};
+    int m_maxValue{0};
+    int m_step{1};
+    int m_stride{0};
+    int m_width{0};
+    int m_height{0};
+    int m_radius{1};
+    int m_amount{0};
+    int m_taps{3};
+    int m_nextRow{0}; // next source row to load into the ring
+
+    std::vector<uint8_t> m_luma;   // taps rows of width + 2 * radius edge-padded luma
+    std::vector<uint16_t> m_hsum;  // taps rows of horizontal sums
+    std::vector<uint8_t> m_out;
+};
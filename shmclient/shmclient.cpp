@@ -0,0 +1,107 @@
+// Test reader for the frame export: connects to the app's socket (OWLET_SHM)
+// and prints one line per frame read, then a summary. --hold keeps each
+// frame for that long before checking it, to see how a slow reader fares:
+// the app never waits for it, it skips frames and its held frames go stale.
+//
+//   owlet_shmclient [--frames <n>] [--hold <ms>] <socket>
+
+#include <linux/videodev2.h>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <time.h>
+
+#include "shmframereader.h"
+
+static int64_t monotonicNs()
+{
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static std::string fourcc(uint32_t format)
+{
+    std::string s(4, ' ');
+    for (int i = 0; i < 4; ++i) s[i] = (char)((format >> (8 * i)) & 0xff);
+    return s;
+}
+
+// mean of the first plane, 16-bit formats in sensor counts
+static double meanLevel(const ShmFrameReader::Frame &frame)
+{
+    const bool narrow = frame.pixelFormat == V4L2_PIX_FMT_NV12 || frame.pixelFormat == V4L2_PIX_FMT_NV21
+        || frame.pixelFormat == V4L2_PIX_FMT_GREY;
+    uint64_t sum = 0;
+    for (int y = 0; y < frame.height; ++y) {
+        const uint8_t *row = frame.planes[0] + (size_t)y * frame.bytesPerLine[0];
+        if (narrow) {
+            for (int x = 0; x < frame.width; ++x) sum += row[x];
+        } else {
+            const uint16_t *wide = reinterpret_cast<const uint16_t*>(row);
+            for (int x = 0; x < frame.width; ++x) sum += wide[x];
+        }
+    }
+    const uint64_t pixels = (uint64_t)frame.width * frame.height;
+    return pixels ? (double)sum / pixels : 0.0;
+}
+
+int main(int argc, char **argv)
+{
+    long frames = 0;
+    int holdMs = 0;
+    std::string path;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+            frames = atol(argv[++i]);
+        } else if (!strcmp(argv[i], "--hold") && i + 1 < argc) {
+            holdMs = atoi(argv[++i]);
+        } else if (argv[i][0] != '-' && path.empty()) {
+            path = argv[i];
+        } else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty()) {
+        fprintf(stderr, "usage: %s [--frames <n>] [--hold <ms>] <socket>\n", argv[0]);
+        return 2;
+    }
+
+    ShmFrameReader reader;
+    std::string error;
+    if (!reader.connect(path, error)) {
+        fprintf(stderr, "%s\n", error.c_str());
+        return 1;
+    }
+
+    long read = 0;
+    long torn = 0;
+    ShmFrameReader::Frame frame;
+    while (!frames || read < frames) {
+        if (!reader.wait(2000)) {
+            if (!reader.connected()) {
+                fprintf(stderr, "exporter went away\n");
+                break;
+            }
+            fprintf(stderr, "no frames for 2 s\n");
+            continue;
+        }
+        if (!reader.acquire(frame)) continue;
+        const double latencyMs = (monotonicNs() - frame.timestampNs) / 1e6;
+        const double mean = meanLevel(frame);
+        if (holdMs) std::this_thread::sleep_for(std::chrono::milliseconds(holdMs));
+        const bool intact = reader.valid(frame);
+        torn += !intact;
+        ++read;
+        printf("frame %llu seq %u %s %dx%d latency %.2f ms mean %.1f%s\n",
+               (unsigned long long)frame.number, frame.sequence, fourcc(frame.pixelFormat).c_str(),
+               frame.width, frame.height, latencyMs, mean, intact ? "" : " (overwritten)");
+    }
+    printf("%ld frames read, %llu skipped, %ld overwritten while held\n",
+           read, (unsigned long long)reader.skipped(), torn);
+    return 0;
+}
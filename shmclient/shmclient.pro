@@ -0,0 +1,9 @@
+CONFIG += c++11 console
+CONFIG -= app_bundle qt
+INCLUDEPATH += ..
+SOURCES += shmclient.cpp \
+           ../shmframereader.cpp
+HEADERS += ../shmframereader.h \
+           ../shmframes.h
+TARGET = owlet_shmclient
+TEMPLATE = app
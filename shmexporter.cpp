@@ -0,0 +1,279 @@
+#include "shmexporter.h"
+#include "rawrecorder.h"
+#include <linux/videodev2.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <errno.h>
+#include <QDebug>
+
+ShmExporter::ShmExporter(int slotCount, size_t slotBytes)
+    : m_slots(qBound(1, slotCount, (int)ShmFrameMaxSlots)), m_slotBytes(slotBytes)
+{
+}
+
+ShmExporter::~ShmExporter()
+{
+    stop();
+}
+
+bool ShmExporter::start(const QString &socketPath, QString &error)
+{
+    if (m_header) return true;
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    m_slotBytes = (m_slotBytes + page - 1) / page * page;
+    const size_t headerBytes = (sizeof(ShmFrameHeader) + page - 1) / page * page;
+    m_mapBytes = headerBytes + m_slots * m_slotBytes;
+
+    // sealed, so a reader can map it without fearing it shrinks under them
+    m_memfd = memfd_create("owlet-frames", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+    if (m_memfd < 0) {
+        error = QString("memfd_create failed: %1").arg(strerror(errno));
+        return false;
+    }
+    if (ftruncate(m_memfd, (off_t)m_mapBytes) == -1
+        || fcntl(m_memfd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) == -1) {
+        error = QString("Sizing the frame ring failed: %1").arg(strerror(errno));
+        stop();
+        return false;
+    }
+    void *map = mmap(nullptr, m_mapBytes, PROT_READ | PROT_WRITE, MAP_SHARED, m_memfd, 0);
+    if (map == MAP_FAILED) {
+        error = QString("mmap of the frame ring failed: %1").arg(strerror(errno));
+        stop();
+        return false;
+    }
+    m_map = static_cast<uchar*>(map);
+    // a fresh memfd reads as zeros: every seq and published start at 0
+    m_header = reinterpret_cast<ShmFrameHeader*>(m_map);
+    m_header->magic = ShmFrameMagic;
+    m_header->version = ShmFrameVersion;
+    m_header->slotCount = m_slots;
+    m_header->headerBytes = (uint32_t)headerBytes;
+    m_header->slotBytes = m_slotBytes;
+    m_next = 0;
+
+    const QByteArray path = socketPath.toLocal8Bit();
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ((size_t)path.size() >= sizeof(addr.sun_path)) {
+        error = QString("Socket path %1 is too long").arg(socketPath);
+        stop();
+        return false;
+    }
+    memcpy(addr.sun_path, path.constData(), path.size());
+    // a socket left behind by a previous run would make bind() fail; anything
+    // else at that path is not ours to remove
+    struct stat st;
+    if (lstat(addr.sun_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            error = QString("%1 exists and is not a socket").arg(socketPath);
+            stop();
+            return false;
+        }
+        unlink(addr.sun_path);
+    }
+    m_listenFd = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (m_listenFd < 0 || bind(m_listenFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1
+        || listen(m_listenFd, 8) == -1) {
+        error = QString("Listening on %1 failed: %2").arg(socketPath).arg(strerror(errno));
+        stop();
+        return false;
+    }
+    m_socketPath = socketPath;
+
+    m_stopFd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = m_listenFd;
+    const bool listenOk = m_epollFd >= 0 && epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_listenFd, &ev) == 0;
+    ev.data.fd = m_stopFd;
+    if (m_stopFd < 0 || !listenOk || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_stopFd, &ev) == -1) {
+        error = QString("Setting up the frame export failed: %1").arg(strerror(errno));
+        stop();
+        return false;
+    }
+    m_thread = std::thread(&ShmExporter::loop, this);
+    qDebug() << "Exporting frames on" << socketPath << ":" << m_slots << "slots of"
+             << m_slotBytes / 1024 << "KiB";
+    return true;
+}
+
+void ShmExporter::stop()
+{
+    if (m_thread.joinable()) {
+        const uint64_t one = 1;
+        if (::write(m_stopFd, &one, sizeof(one)) < 0) qWarning() << "eventfd write failed:" << strerror(errno);
+        m_thread.join();
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_readerMutex);
+        for (const Reader &reader : m_readers) {
+            ::close(reader.eventFd);
+            ::close(reader.socket);
+        }
+        m_readers.clear();
+        m_readerCount = 0;
+    }
+    if (m_epollFd >= 0) ::close(m_epollFd);
+    if (m_stopFd >= 0) ::close(m_stopFd);
+    if (m_listenFd >= 0) ::close(m_listenFd);
+    m_epollFd = m_stopFd = m_listenFd = -1;
+    if (!m_socketPath.isEmpty()) unlink(m_socketPath.toLocal8Bit().constData());
+    m_socketPath.clear();
+    // readers keep their own mappings of the memfd
+    if (m_map) munmap(m_map, m_mapBytes);
+    m_map = nullptr;
+    m_header = nullptr;
+    if (m_memfd >= 0) ::close(m_memfd);
+    m_memfd = -1;
+}
+
+// export thread: new readers and hang-ups
+void ShmExporter::loop()
+{
+    for (;;) {
+        epoll_event events[8];
+        const int n = epoll_wait(m_epollFd, events, 8, -1);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            qWarning() << "Frame export: epoll_wait failed:" << strerror(errno);
+            return;
+        }
+        for (int i = 0; i < n; ++i) {
+            const int fd = events[i].data.fd;
+            if (fd == m_stopFd) return;
+            if (fd == m_listenFd) {
+                acceptReader();
+                continue;
+            }
+            // readers send nothing: anything readable is the end of them
+            char byte;
+            const ssize_t got = recv(fd, &byte, 1, MSG_DONTWAIT);
+            if (got <= 0 && !(got < 0 && errno == EAGAIN)) dropReader(fd);
+        }
+    }
+}
+
+void ShmExporter::acceptReader()
+{
+    const int sock = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC | SOCK_NONBLOCK);
+    if (sock < 0) return;
+    const int efd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (efd < 0) {
+        ::close(sock);
+        return;
+    }
+
+    // the hello carries the ring and the reader's own eventfd
+    ShmFrameHello hello;
+    hello.magic = ShmFrameMagic;
+    hello.version = ShmFrameVersion;
+    hello.mapBytes = m_mapBytes;
+    iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        cmsghdr align;
+    } control;
+    memset(&control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(2 * sizeof(int));
+    const int fds[2] = { m_memfd, efd };
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN | EPOLLRDHUP;
+    ev.data.fd = sock;
+    if (sendmsg(sock, &msg, MSG_NOSIGNAL) != (ssize_t)sizeof(hello)
+        || epoll_ctl(m_epollFd, EPOLL_CTL_ADD, sock, &ev) == -1) {
+        ::close(efd);
+        ::close(sock);
+        return;
+    }
+    std::lock_guard<std::mutex> lock(m_readerMutex);
+    m_readers.push_back({ sock, efd });
+    m_readerCount = (int)m_readers.size();
+    qDebug() << "Frame export: reader connected," << m_readers.size() << "reading";
+}
+
+void ShmExporter::dropReader(int socket)
+{
+    epoll_ctl(m_epollFd, EPOLL_CTL_DEL, socket, nullptr);
+    std::lock_guard<std::mutex> lock(m_readerMutex);
+    auto it = std::find_if(m_readers.begin(), m_readers.end(),
+                           [socket](const Reader &reader) { return reader.socket == socket; });
+    if (it == m_readers.end()) return;
+    ::close(it->eventFd);
+    ::close(it->socket);
+    m_readers.erase(it);
+    m_readerCount = (int)m_readers.size();
+    qDebug() << "Frame export: reader left," << m_readers.size() << "reading";
+}
+
+void ShmExporter::submit(const RawFrame &frame, uint32_t sequence, qint64 timestampNs)
+{
+    if (!m_header || !readers()) return;
+    const int bytes = rawFrameBytes(frame);
+    if (!bytes) return;
+    if ((size_t)bytes > m_slotBytes) {
+        if (!m_warnedSize) qWarning() << "Frame export:" << bytes << "byte frames do not fit the ring's slots";
+        m_warnedSize = true;
+        return;
+    }
+
+    const uint64_t n = m_next++;
+    const int index = (int)(n % m_slots);
+    ShmFrameSlot &slot = m_header->ring[index];
+    uchar *data = m_map + m_header->headerBytes + (size_t)index * m_slotBytes;
+    // odd: readers of the frame this slot held see it is gone
+    slot.seq.store(2 * n + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    packRawFrame(frame, data);
+    const bool semiPlanar = (frame.pixelFormat == V4L2_PIX_FMT_NV12 || frame.pixelFormat == V4L2_PIX_FMT_NV21);
+    const bool wide = !semiPlanar && frame.pixelFormat != V4L2_PIX_FMT_GREY;
+    slot.sequence = sequence;
+    slot.pixelFormat = frame.pixelFormat;
+    slot.width = frame.width;
+    slot.height = frame.height;
+    slot.planeCount = semiPlanar ? 2 : 1;
+    slot.bytesPerLine[0] = frame.width * (wide ? 2 : 1);
+    slot.planeOffset[0] = 0;
+    slot.bytesPerLine[1] = semiPlanar ? frame.width : 0;
+    slot.planeOffset[1] = semiPlanar ? (uint32_t)frame.width * frame.height : 0;
+    slot.bytes = bytes;
+    slot.timestampNs = timestampNs;
+
+    slot.seq.store(2 * n + 2, std::memory_order_release);
+    m_header->published.store(n + 1, std::memory_order_release);
+
+    // a full or lagging eventfd only means the reader has frames to catch up on
+    const uint64_t one = 1;
+    std::lock_guard<std::mutex> lock(m_readerMutex);
+    for (const Reader &reader : m_readers) {
+        if (::write(reader.eventFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+            qWarning() << "Frame export: eventfd write failed:" << strerror(errno);
+        }
+    }
+}
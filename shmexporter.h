@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QString>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "shmframes.h"
+#include "videoframe.h"
+
+// Publishes raw frames to other local processes through a memfd ring (see
+// shmframes.h), so analytics and recording can run beside the app without
+// opening the camera themselves. The capture thread copies each frame into
+// the next slot and pokes every reader's eventfd; it never waits for a
+// reader. A thread of its own accepts readers on a Unix socket and drops
+// them when they hang up. Frames are only copied while someone is reading.
+class ShmExporter
+{
+public:
+    explicit ShmExporter(int slotCount = 4, size_t slotBytes = 8 << 20);
+    ~ShmExporter();
+
+    // creates the ring and listens on socketPath; false with error set on
+    // failure. Frames larger than a slot are skipped.
+    bool start(const QString &socketPath, QString &error);
+    void stop();
+
+    int readers() const { return m_readerCount.load(std::memory_order_relaxed); }
+
+    // capture thread
+    void submit(const RawFrame &frame, uint32_t sequence, qint64 timestampNs);
+
+private:
+    struct Reader {
+        int socket;
+        int eventFd;
+    };
+
+    void loop();
+    void acceptReader();
+    void dropReader(int socket);
+
+    int m_slots;
+    size_t m_slotBytes;
+    size_t m_mapBytes{0};
+    int m_memfd{-1};
+    ShmFrameHeader *m_header{nullptr};
+    uchar *m_map{nullptr};
+    uint64_t m_next{0}; // capture thread: number of the next frame
+    bool m_warnedSize{false};
+
+    QString m_socketPath;
+    int m_listenFd{-1};
+    int m_epollFd{-1};
+    int m_stopFd{-1};
+    std::thread m_thread;
+
+    std::mutex m_readerMutex; // m_readers, against submit()
+    std::vector<Reader> m_readers;
+    std::atomic<int> m_readerCount{0};
+};
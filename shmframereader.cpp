@@ -0,0 +1,173 @@
+#include "shmframereader.h"
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+#include <unistd.h>
+#include <cstring>
+#include <errno.h>
+
+ShmFrameReader::~ShmFrameReader()
+{
+    close();
+}
+
+bool ShmFrameReader::connect(const std::string &socketPath, std::string &error)
+{
+    close();
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (socketPath.size() >= sizeof(addr.sun_path)) {
+        error = "socket path " + socketPath + " is too long";
+        return false;
+    }
+    memcpy(addr.sun_path, socketPath.data(), socketPath.size());
+    m_socket = socket(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0);
+    if (m_socket < 0 || ::connect(m_socket, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) == -1) {
+        error = "cannot connect to " + socketPath + ": " + strerror(errno);
+        close();
+        return false;
+    }
+
+    // the hello carries the memfd and our eventfd
+    ShmFrameHello hello;
+    iovec iov;
+    iov.iov_base = &hello;
+    iov.iov_len = sizeof(hello);
+    union {
+        char buf[CMSG_SPACE(2 * sizeof(int))];
+        cmsghdr align;
+    } control;
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.buf;
+    msg.msg_controllen = sizeof(control.buf);
+    const ssize_t got = recvmsg(m_socket, &msg, MSG_CMSG_CLOEXEC);
+    int fds[2] = { -1, -1 };
+    const cmsghdr *cmsg = got > 0 ? CMSG_FIRSTHDR(&msg) : nullptr;
+    if (cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS
+        && cmsg->cmsg_len == CMSG_LEN(sizeof(fds))) {
+        memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    }
+    const int memfd = fds[0];
+    m_eventFd = fds[1];
+    if (got != (ssize_t)sizeof(hello) || memfd < 0 || m_eventFd < 0
+        || hello.magic != ShmFrameMagic || hello.version != ShmFrameVersion
+        || hello.mapBytes < sizeof(ShmFrameHeader)) {
+        error = got < 0 ? std::string("receiving the handshake failed: ") + strerror(errno)
+                        : std::string("not a compatible frame exporter: ") + socketPath;
+        if (memfd >= 0) ::close(memfd);
+        close();
+        return false;
+    }
+
+    void *map = mmap(nullptr, hello.mapBytes, PROT_READ, MAP_SHARED, memfd, 0);
+    ::close(memfd); // the mapping keeps the ring alive
+    if (map == MAP_FAILED) {
+        error = std::string("mmap of the frame ring failed: ") + strerror(errno);
+        close();
+        return false;
+    }
+    m_map = static_cast<const uint8_t*>(map);
+    m_mapBytes = hello.mapBytes;
+    const ShmFrameHeader *header = reinterpret_cast<const ShmFrameHeader*>(m_map);
+    if (header->magic != ShmFrameMagic || header->slotCount == 0 || header->slotCount > ShmFrameMaxSlots
+        || header->headerBytes + header->slotCount * header->slotBytes > m_mapBytes) {
+        error = "the frame ring has a bad header";
+        close();
+        return false;
+    }
+    m_header = header;
+    // frames from before we came are not ours to count as skipped
+    m_next = m_header->published.load(std::memory_order_acquire);
+    m_skipped = 0;
+    return true;
+}
+
+void ShmFrameReader::close()
+{
+    if (m_map) munmap(const_cast<uint8_t*>(m_map), m_mapBytes);
+    m_map = nullptr;
+    m_header = nullptr;
+    if (m_eventFd >= 0) ::close(m_eventFd);
+    if (m_socket >= 0) ::close(m_socket);
+    m_eventFd = m_socket = -1;
+}
+
+bool ShmFrameReader::wait(int timeoutMs)
+{
+    if (!m_header) return false;
+    if (m_header->published.load(std::memory_order_acquire) > m_next) return true;
+    for (;;) {
+        pollfd fds[2];
+        fds[0].fd = m_eventFd;
+        fds[0].events = POLLIN;
+        fds[1].fd = m_socket;
+        fds[1].events = POLLIN | POLLRDHUP;
+        fds[0].revents = fds[1].revents = 0;
+        const int n = poll(fds, 2, timeoutMs);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return false;
+        // the exporter never writes to the socket: readable means it is gone
+        if (fds[1].revents) {
+            close();
+            return false;
+        }
+        uint64_t count;
+        if (read(m_eventFd, &count, sizeof(count)) < 0 && errno != EAGAIN) return false;
+        return true;
+    }
+}
+
+bool ShmFrameReader::acquire(Frame &frame)
+{
+    if (!m_header) return false;
+    const uint32_t slots = m_header->slotCount;
+    // a few tries: the newest frame's slot is only rewritten once the
+    // producer has lapped the ring since reading published
+    for (int attempt = 0; attempt < 4; ++attempt) {
+        const uint64_t published = m_header->published.load(std::memory_order_acquire);
+        if (published <= m_next) return false;
+        const uint64_t n = published - 1;
+        const uint32_t index = (uint32_t)(n % slots);
+        const ShmFrameSlot &slot = m_header->ring[index];
+        if (slot.seq.load(std::memory_order_acquire) != 2 * n + 2) continue;
+
+        const uint8_t *data = m_map + m_header->headerBytes + index * m_header->slotBytes;
+        Frame f;
+        f.number = n;
+        f.sequence = slot.sequence;
+        f.timestampNs = slot.timestampNs;
+        f.pixelFormat = slot.pixelFormat;
+        f.width = slot.width;
+        f.height = slot.height;
+        f.planeCount = slot.planeCount;
+        f.bytes = slot.bytes;
+        bool sane = f.planeCount >= 1 && f.planeCount <= 3 && f.bytes <= m_header->slotBytes;
+        for (int p = 0; sane && p < f.planeCount; ++p) {
+            sane = slot.planeOffset[p] < f.bytes;
+            f.planes[p] = data + slot.planeOffset[p];
+            f.bytesPerLine[p] = slot.bytesPerLine[p];
+        }
+        // the metadata read above is only good if the slot did not move on
+        if (!sane || !valid(f)) continue;
+
+        m_skipped += n - m_next;
+        m_next = n + 1;
+        frame = f;
+        return true;
+    }
+    ++m_skipped;
+    return false;
+}
+
+bool ShmFrameReader::valid(const Frame &frame) const
+{
+    if (!m_header) return false;
+    const ShmFrameSlot &slot = m_header->ring[frame.number % m_header->slotCount];
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return slot.seq.load(std::memory_order_relaxed) == 2 * frame.number + 2;
+}
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+#include "shmframes.h"
+
+// Reading side of the frame export (see shmframes.h), for programs that run
+// beside the app. Plain C++ and POSIX, no Qt. Frames are read in place from
+// the mapped ring: acquire() hands out pointers into it and valid() says
+// whether the producer has started overwriting them since.
+//
+//     ShmFrameReader reader;
+//     std::string error;
+//     if (!reader.connect("/run/owlet/frames", error)) ...
+//     ShmFrameReader::Frame frame;
+//     while (reader.wait(-1)) {
+//         if (!reader.acquire(frame)) continue;
+//         ... use frame.planes ...
+//         if (!reader.valid(frame)) ... the result is torn, drop it ...
+//     }
+class ShmFrameReader
+{
+public:
+    struct Frame {
+        uint64_t number{0};     // counted from 0 since the exporter started
+        uint32_t sequence{0};   // v4l2_buffer.sequence
+        int64_t timestampNs{0}; // CLOCK_MONOTONIC capture time
+        uint32_t pixelFormat{0};
+        int width{0};
+        int height{0};
+        int planeCount{0};
+        const uint8_t *planes[3]{};
+        int bytesPerLine[3]{};
+        uint32_t bytes{0};
+    };
+
+    ShmFrameReader() {}
+    ~ShmFrameReader();
+    ShmFrameReader(const ShmFrameReader&) = delete;
+    ShmFrameReader &operator=(const ShmFrameReader&) = delete;
+
+    // connects to the exporter's socket and maps the ring; false with error
+    // set on failure
+    bool connect(const std::string &socketPath, std::string &error);
+    void close();
+    bool connected() const { return m_header != nullptr; }
+
+    // readable while frames have been published since the last wait(), for
+    // readers with a poll loop of their own
+    int eventFd() const { return m_eventFd; }
+    // up to timeoutMs (-1: no limit) for a new frame; false on timeout, and
+    // when the exporter has gone away (connected() is then false)
+    bool wait(int timeoutMs);
+
+    // the newest frame, if it is newer than the last one acquired
+    bool acquire(Frame &frame);
+    // whether frame's data is still the frame acquired
+    bool valid(const Frame &frame) const;
+
+    // frames published but never acquired, and acquires lost to the producer
+    uint64_t skipped() const { return m_skipped; }
+
+private:
+    int m_socket{-1};
+    int m_eventFd{-1};
+    const uint8_t *m_map{nullptr};
+    size_t m_mapBytes{0};
+    const ShmFrameHeader *m_header{nullptr};
+    uint64_t m_next{0}; // number of the first frame not yet acquired
+    uint64_t m_skipped{0};
+};
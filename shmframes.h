@@ -0,0 +1,64 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+// Layout of the shared-memory frame ring that ShmExporter writes and
+// ShmFrameReader maps, shared by both sides. No Qt: readers are separate
+// programs.
+//
+// The ring is a sealed memfd: a ShmFrameHeader, then slotCount slots of
+// slotBytes each, the first at headerBytes. Frames are stored unpadded,
+// planes in order (NV12: luma, then interleaved chroma), as RawRecorder
+// stores them.
+//
+// Every slot is a seqlock. The producer numbers frames 0, 1, 2, ... and puts
+// frame n into slot n % slotCount: it sets seq to 2n + 1, writes data and
+// metadata, sets seq to 2n + 2, then sets published to n + 1. A reader takes
+// frame published - 1, checks that its slot's seq is 2n + 2 before and
+// after using the data, and discards it otherwise. The producer never waits
+// for readers; a reader that holds on to a frame for longer than
+// slotCount - 1 frame intervals just sees it fail the second check.
+//
+// Readers connect to the exporter's Unix socket and receive, with
+// SCM_RIGHTS, the memfd and an eventfd of their own that counts frames
+// published since they last read it. The message payload is a
+// ShmFrameHello.
+
+enum {
+    ShmFrameMagic = 0x464c574f, // "OWLF"
+    ShmFrameVersion = 1,
+    ShmFrameMaxSlots = 16
+};
+
+struct ShmFrameSlot
+{
+    std::atomic<uint64_t> seq;
+    uint32_t sequence;      // v4l2_buffer.sequence
+    uint32_t pixelFormat;   // V4L2_PIX_FMT_*
+    int32_t width;
+    int32_t height;
+    int32_t planeCount;
+    int32_t bytesPerLine[3];
+    uint32_t planeOffset[3]; // from the start of the slot
+    uint32_t bytes;
+    int64_t timestampNs;    // CLOCK_MONOTONIC capture time
+};
+
+struct ShmFrameHeader
+{
+    uint32_t magic;
+    uint32_t version;
+    uint32_t slotCount;
+    uint32_t headerBytes;   // offset of slot 0, page aligned
+    uint64_t slotBytes;     // page aligned
+    std::atomic<uint64_t> published; // frames completed since the exporter started
+    ShmFrameSlot ring[ShmFrameMaxSlots];
+};
+
+struct ShmFrameHello
+{
+    uint32_t magic;
+    uint32_t version;
+    uint64_t mapBytes;      // size of the memfd
+};
@@ -0,0 +1,52 @@
+#include "toneadjust.h"
+#include "palette.h"
+#include <cmath>
+#include <cstring>
+
+bool ToneSettings::isIdentity() const
+{
+    return !negative && contrast == 1.0 && brightness == 0 && gamma == 1.0;
+}
+
+static uint8_t toneValue(const ToneSettings &s, int y)
+{
+    double v = (y - 128) * s.contrast + 128 + s.brightness;
+    if (v < 0) v = 0;
+    if (v > 255) v = 255;
+    if (s.gamma != 1.0 && s.gamma > 0) v = 255.0 * std::pow(v / 255.0, 1.0 / s.gamma);
+    int out = (int)std::lround(v);
+    if (out > 255) out = 255;
+    return (uint8_t)(s.negative ? 255 - out : out);
+}
+
+void buildPixelLut(const ToneSettings &settings, const Palette *palette, PixelLut &out)
+{
+    out.identity = settings.isIdentity() && !palette;
+    out.mapped = (palette != nullptr);
+    for (int y = 0; y < 256; ++y) {
+        out.curve[y] = toneValue(settings, y);
+        if (palette) {
+            out.rgb[y] = palette->lut[out.curve[y]];
+        } else {
+            // grey sources have no chroma to keep: their curve goes through rgb[]
+            const uint8_t rgbx[4] = { out.curve[y], out.curve[y], out.curve[y], 0 };
+            memcpy(&out.rgb[y], rgbx, 4);
+        }
+    }
+}
+
+void PixelLutExchange::publish()
+{
+    int prev = m_state.exchange(m_back | FreshBit, std::memory_order_acq_rel);
+    m_back = prev & ~FreshBit;
+}
+
+const PixelLut &PixelLutExchange::current()
+{
+    if (m_state.load(std::memory_order_acquire) & FreshBit) {
+        int prev = m_state.exchange(m_front, std::memory_order_acq_rel);
+        m_front = prev & ~FreshBit;
+        ++m_generation;
+    }
+    return m_slots[m_front];
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+
+struct Palette;
+
+// Point operations of the "Контраст" and "Кадр" menus, applied to luma in
+// this order: contrast around mid-grey, brightness offset, gamma, negative.
+struct ToneSettings
+{
+    bool negative{false};
+    double contrast{1.0};   // gain, 1 = unchanged
+    int brightness{0};      // offset in 8-bit steps, -255..255
+    double gamma{1.0};      // out = in^(1/gamma), 1 = unchanged
+
+    bool isIdentity() const;
+};
+
+// Every point operation of one frame folded into lookup tables, so the
+// conversion pays a single lookup per pixel however many are active.
+struct PixelLut
+{
+    // nothing to apply: plain colour conversion, tables unused
+    bool identity{true};
+    // a palette (or a tone curve on a grey source) is active: pixels come
+    // from rgb[], chroma is ignored. Otherwise only luma goes through curve[]
+    // and the colour conversion keeps chroma.
+    bool mapped{false};
+    uint8_t curve[256];
+    uint32_t rgb[256]; // R, G, B, 0 bytes in memory order, as Palette::lut
+};
+
+void buildPixelLut(const ToneSettings &settings, const Palette *palette, PixelLut &out);
+
+// Hands PixelLut snapshots from the GUI thread (single writer) to the capture
+// thread (single reader) without locks, with the same triple-buffer exchange
+// as FrameMailbox: the writer fills a slot the reader cannot be looking at,
+// the reader swaps the newest one in between frames.
+class PixelLutExchange
+{
+public:
+    // writer: slot to fill, then publish() it
+    PixelLut &edit() { return m_slots[m_back]; }
+    void publish();
+
+    // reader: newest published snapshot; stays valid until the next call
+    const PixelLut &current();
+    // reader: bumped whenever current() moves on to a new snapshot
+    unsigned generation() const { return m_generation; }
+
+private:
+    static const int FreshBit = 4;
+
+    PixelLut m_slots[3];
+    int m_back{0};   // owned by the writer
+    int m_front{2};  // owned by the reader
+    unsigned m_generation{0}; // owned by the reader
+    std::atomic<int> m_state{1};
+};
@@ -1,29 +1,51 @@
 #include "v4l2camera.h"
+#include "palette.h"
+#include "sharpen.h"
+#include "hotspottracker.h"
+#include "framestats.h"
+#include "v4l2source.h"
+#include "rawrecorder.h"
+#include "framehistory.h"
+#include "shmexporter.h"
 #include <linux/videodev2.h>
-#include <sys/ioctl.h>
-#include <sys/mman.h>
-#include <sys/select.h>
-#include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
-#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
 #include <cstring>
-#include <errno.h>
+#include <cmath>
+#include <algorithm>
 #include <QDebug>
 
-// helper ioctl loop
-static int xioctl(int fd, unsigned long request, void *arg)
+// dequeue stamps of a buffer while stats are on
+static FrameTiming dequeueTiming(const SourceBuffer &buf, FrameStats *stats)
 {
-    int r;
-    do {
-        r = ioctl(fd, request, arg);
-    } while (r == -1 && errno == EINTR);
-    return r;
+    FrameTiming timing;
+    if (!stats->enabled()) return timing;
+    timing.dequeueNs = monotonicNs();
+    timing.sequence = buf.sequence;
+    timing.driverNs = buf.timestampNs;
+    stats->noteSequence(buf.sequence);
+    return timing;
+}
+
+// significant bits of the radiometric grey formats, 0 for everything else.
+// All of them carry one little-endian 16-bit word per pixel.
+static int radiometricBits(uint32_t pixfmt)
+{
+    switch (pixfmt) {
+    case V4L2_PIX_FMT_Y16: return 16;
+    case V4L2_PIX_FMT_Y14: return 14;
+    case V4L2_PIX_FMT_Y12: return 12;
+    case V4L2_PIX_FMT_Y10: return 10;
+    default: return 0;
+    }
 }
 
 V4L2Camera::V4L2Camera(const QString &device, int width, int height, QObject *parent)
-    : QThread(parent), m_device(device), m_width(width), m_height(height)
+    : QThread(parent), m_device(device), m_width(width), m_height(height), m_kernels(&yuvRowKernels())
+    , m_source(new V4L2Source(device))
+    , m_stats(new FrameStats(&m_mailbox, this))
 {
+    qDebug() << "YUV row kernels:" << m_kernels->name;
 }
 
 V4L2Camera::~V4L2Camera()
@@ -35,538 +57,1327 @@ V4L2Camera::~V4L2Camera()
 void V4L2Camera::stopCapture()
 {
     m_running = false;
+    // a capture thread waiting for the next frame sees the flag right away
+    m_source->wakeup();
 }
 
-void V4L2Camera::run()
+void V4L2Camera::setSource(FrameSource *source)
 {
-    if (!openDevice()) {
-        emit errorOccurred(QString("Cannot open %1").arg(m_device));
-        return;
+    m_source.reset(source);
+    m_device = m_source->name();
+}
+
+void V4L2Camera::setConversionThreads(int threads)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        m_convThreads = threads > 0 ? threads : 1;
     }
-    if (!queryCaps()) {
-        closeDevice();
-        return;
+    m_reconfigure = true;
+    m_source->wakeup();
+}
+
+void V4L2Camera::setConversionCpus(const std::vector<int> &cpus)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        m_convCpus = cpus;
     }
-    if (!initFormat()) {
-        closeDevice();
-        return;
+    m_reconfigure = true;
+    m_source->wakeup();
+}
+
+int V4L2Camera::conversionThreads() const
+{
+    std::lock_guard<std::mutex> lock(m_configMutex);
+    return m_convThreads;
+}
+
+void V4L2Camera::setCrop(const QRectF &crop, qreal aspect)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        if (m_crop == crop && m_cropAspect == aspect) return;
+        m_crop = crop;
+        m_cropAspect = aspect;
     }
-    if (!initMmap()) {
-        closeDevice();
-        return;
+    m_layoutChanged = true;
+}
+
+QRectF V4L2Camera::crop() const
+{
+    std::lock_guard<std::mutex> lock(m_configMutex);
+    return m_crop;
+}
+
+void V4L2Camera::setOutputSize(const QSize &size)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        if (m_outputSize == size) return;
+        m_outputSize = size;
     }
-    if (!startStreaming()) {
-        uninitMmap();
-        closeDevice();
-        return;
+    m_layoutChanged = true;
+}
+
+QSize V4L2Camera::outputSize() const
+{
+    std::lock_guard<std::mutex> lock(m_configMutex);
+    return m_outputSize;
+}
+
+void V4L2Camera::setCaptureScheduling(int fifoPriority, int cpu)
+{
+    m_captureFifo = fifoPriority;
+    m_captureCpu = cpu;
+}
+
+void V4L2Camera::setFramePoolSize(int buffers)
+{
+    m_framePoolSize = qBound(1, buffers, (int)FramePool::MaxBuffers);
+}
+
+void V4L2Camera::setPalette(const QString &name)
+{
+    if (m_paletteName == name) return;
+    const Palette *p = findPalette(name.toLatin1().constData());
+    if (!p && !name.isEmpty()) {
+        qWarning() << "Unknown palette" << name << ", using plain colour";
     }
+    m_paletteName = p ? name : QString();
+    m_paletteTable = p;
+    updatePixelLut();
+    emit paletteChanged();
+}
 
-    m_running = true;
-    while (m_running) {
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(m_fd, &fds);
-        timeval tv{};
-        tv.tv_sec = 2;
-        tv.tv_usec = 0;
-        int r = select(m_fd + 1, &fds, nullptr, nullptr, &tv);
-        if (r == -1) {
-            if (errno == EINTR) continue;
-            emit errorOccurred(QString("select error: %1").arg(strerror(errno)));
-            break;
-        } else if (r == 0) {
-            // timeout, continue
-            continue;
-        }
+void V4L2Camera::setNegative(bool negative)
+{
+    if (m_tone.negative == negative) return;
+    m_tone.negative = negative;
+    updatePixelLut();
+    emit adjustmentsChanged();
+}
 
-        if (!readOneFrame()) {
-            // small sleep to avoid busy looping if EAGAIN
-            msleep(2);
+void V4L2Camera::setContrast(double contrast)
+{
+    contrast = qBound(0.0, contrast, 8.0);
+    if (m_tone.contrast == contrast) return;
+    m_tone.contrast = contrast;
+    updatePixelLut();
+    emit adjustmentsChanged();
+}
+
+void V4L2Camera::setBrightness(int brightness)
+{
+    brightness = qBound(-255, brightness, 255);
+    if (m_tone.brightness == brightness) return;
+    m_tone.brightness = brightness;
+    updatePixelLut();
+    emit adjustmentsChanged();
+}
+
+void V4L2Camera::setGamma(double gamma)
+{
+    gamma = qBound(0.1, gamma, 10.0);
+    if (m_tone.gamma == gamma) return;
+    m_tone.gamma = gamma;
+    updatePixelLut();
+    emit adjustmentsChanged();
+}
+
+void V4L2Camera::setSharpen(double strength)
+{
+    strength = qBound(0.0, strength, 4.0);
+    if (m_sharpenStrength == strength) return;
+    m_sharpenStrength = strength;
+    updateSharpen();
+    emit sharpenChanged();
+}
+
+void V4L2Camera::setSharpenRadius(int radius)
+{
+    radius = qBound(1, radius, 2);
+    if (m_sharpenRadius == radius) return;
+    m_sharpenRadius = radius;
+    updateSharpen();
+    emit sharpenChanged();
+}
+
+void V4L2Camera::setDenoise(double strength)
+{
+    strength = qBound(0.0, strength, 1.0);
+    if (m_denoiseStrength == strength) return;
+    m_denoiseStrength = strength;
+    updateDenoise();
+    emit denoiseChanged();
+}
+
+void V4L2Camera::setDenoiseThreshold(int threshold)
+{
+    threshold = qBound(1, threshold, (int)TemporalDenoiser::MaxThreshold);
+    if (m_denoiseThreshold == threshold) return;
+    m_denoiseThreshold = threshold;
+    updateDenoise();
+    emit denoiseChanged();
+}
+
+void V4L2Camera::setCalibrationFile(const QString &path)
+{
+    // the same path again drops flat-field offsets for the file's own
+    if (path == m_calibrationFile && !calibrationModified()) return;
+    // mapped and checked here, so capture only has to swap it in
+    std::unique_ptr<Calibration> calibration;
+    if (!path.isEmpty()) {
+        QString error;
+        calibration.reset(Calibration::load(path, error));
+        if (!calibration) {
+            emit errorOccurred(error);
+            return;
         }
     }
+    m_calibrationFile = path;
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        m_pendingCalibration = std::move(calibration);
+    }
+    m_calibrationChanged = true;
+    emit calibrationChanged();
+}
 
-    stopStreaming();
-    uninitMmap();
-    closeDevice();
+void V4L2Camera::captureFlatField(int frames)
+{
+    m_flatFieldRequest.store(qBound(1, frames, 1024), std::memory_order_relaxed);
 }
 
-bool V4L2Camera::openDevice()
+bool V4L2Camera::saveCalibration(const QString &path)
 {
-    m_fd = ::open(m_device.toLocal8Bit().constData(), O_RDWR | O_NONBLOCK, 0);
-    if (m_fd < 0) {
-        emit errorOccurred(QString("open(%1) failed: %2").arg(m_device).arg(strerror(errno)));
+    // a private copy, so writing the file does not hold up conversion
+    std::unique_ptr<Calibration> copy;
+    bool modified = false;
+    {
+        std::lock_guard<std::mutex> lock(m_convertMutex);
+        if (m_calibration) {
+            copy.reset(m_calibration->clone());
+            modified = m_calibrationModified.exchange(false);
+        }
+    }
+    QString error = "No calibration to save";
+    if (!copy || !copy->save(path, error)) {
+        if (modified) {
+            // the offsets are still not on disk
+            std::lock_guard<std::mutex> lock(m_convertMutex);
+            m_calibrationModified = true;
+        }
+        emit errorOccurred(error);
         return false;
     }
+    // what is applied is now what the file holds
+    m_calibrationFile = path;
+    emit calibrationChanged();
     return true;
 }
 
-void V4L2Camera::closeDevice()
+void V4L2Camera::setAgcMode(AgcMode mode)
 {
-    if (m_fd >= 0) {
-        ::close(m_fd);
-        m_fd = -1;
+    if (m_agcMode.exchange(mode, std::memory_order_relaxed) == mode) return;
+    emit agcModeChanged();
+}
+
+void V4L2Camera::updateSharpen()
+{
+    // amount and radius travel in one word so capture never sees a mix
+    const int amount = qRound(m_sharpenStrength * 32);
+    m_sharpen.store(amount ? (amount | m_sharpenRadius << 8) : 0, std::memory_order_relaxed);
+    // sharpening needs full-resolution rows
+    m_layoutChanged = true;
+}
+
+void V4L2Camera::updateDenoise()
+{
+    // strength and threshold travel in one word, as the sharpening settings do
+    const int strength = qRound(m_denoiseStrength * TemporalDenoiser::MaxStrength);
+    const int word = strength ? (strength | m_denoiseThreshold << 8) : 0;
+    // frames in between may have gone out unconverted (GPU, lazy), which
+    // never reach the reset in convertFrame: turning the filter on restarts it
+    if (!m_denoise.exchange(word, std::memory_order_relaxed) && word) m_denoiseRestart = true;
+}
+
+void V4L2Camera::updatePixelLut()
+{
+    // settings the source does in hardware are left out of the tables
+    const int hardware = m_sourceControls.load(std::memory_order_relaxed);
+    ToneSettings software = m_tone;
+    if (hardware & (1 << FrameSource::Brightness)) software.brightness = 0;
+    if (hardware & (1 << FrameSource::Contrast)) software.contrast = 1.0;
+    if (hardware & (1 << FrameSource::Gamma)) software.gamma = 1.0;
+    // 256 entries per table: rebuilding on every change is cheap
+    buildPixelLut(software, m_paletteTable, m_pixelLuts.edit());
+    m_pixelLuts.publish();
+
+    if (hardware) {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        m_controlMask = hardware;
+        m_controlValues[FrameSource::Brightness] = m_tone.brightness;
+        m_controlValues[FrameSource::Contrast] = m_tone.contrast;
+        m_controlValues[FrameSource::Gamma] = m_tone.gamma;
+        m_controlsChanged = true;
+    }
+    if (hardware != m_hardwareTone) {
+        m_hardwareTone = hardware;
+        qDebug() << "Adjustments:" << adjustmentPaths();
+        emit adjustmentPathsChanged();
     }
 }
 
-bool V4L2Camera::queryCaps()
+QVariantMap V4L2Camera::adjustmentPaths() const
 {
-    v4l2_capability cap;
-    if (xioctl(m_fd, VIDIOC_QUERYCAP, &cap) == -1) {
-        emit errorOccurred(QString("VIDIOC_QUERYCAP failed: %1").arg(strerror(errno)));
-        return false;
+    auto path = [this](FrameSource::Control control) {
+        return QString((m_hardwareTone & (1 << control)) ? "sensor" : "software");
+    };
+    QVariantMap paths;
+    paths["brightness"] = path(FrameSource::Brightness);
+    paths["contrast"] = path(FrameSource::Contrast);
+    paths["gamma"] = path(FrameSource::Gamma);
+    return paths;
+}
+
+// capture thread: publishes what the source can do; the GUI thread then
+// moves settings between the tables and the source
+void V4L2Camera::setSourceControls(int controls)
+{
+    if (m_sourceControls.exchange(controls) == controls) return;
+    QMetaObject::invokeMethod(this, "updatePixelLut", Qt::QueuedConnection);
+}
+
+// capture thread: every control change since the last frame in one batch;
+// a refused control goes back to software
+void V4L2Camera::applyControls()
+{
+    int mask;
+    double values[FrameSource::ControlCount];
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        mask = m_controlMask;
+        std::copy(m_controlValues, m_controlValues + FrameSource::ControlCount, values);
     }
-    if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
-        m_is_mplane = true;
-    } else if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) {
-        m_is_mplane = false;
-    } else {
-        emit errorOccurred("Device does not support video capture");
-        return false;
+    const int available = m_sourceControls.load(std::memory_order_relaxed);
+    mask &= available;
+    if (!mask) return;
+    QString error;
+    const int failed = m_source->setControls(mask, values, error);
+    if (failed) {
+        qWarning() << error << ", adjusting in software instead";
+        setSourceControls(available & ~failed);
     }
+}
 
-    if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
-        emit errorOccurred("Device does not support streaming I/O");
-        return false;
+// capture thread: realtime priority and pinning as configured; both need
+// privileges the process may not have, capture runs on regardless
+void V4L2Camera::applyCaptureScheduling()
+{
+    if (m_captureFifo > 0) {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = qBound(sched_get_priority_min(SCHED_FIFO), m_captureFifo,
+                                      sched_get_priority_max(SCHED_FIFO));
+        int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+        if (err) {
+            qWarning() << "Capture thread: SCHED_FIFO" << param.sched_priority << "failed:" << strerror(err);
+        } else {
+            qDebug() << "Capture thread: SCHED_FIFO priority" << param.sched_priority;
+        }
+    }
+    if (m_captureCpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(m_captureCpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err) {
+            qWarning() << "Capture thread: pinning to CPU" << m_captureCpu << "failed:" << strerror(err);
+        }
     }
-    return true;
 }
 
-bool V4L2Camera::trySetFormatSingle(uint32_t pixfmt)
+// (re)creates the conversion workers from the current settings; capture thread only
+void V4L2Camera::createWorkerPool()
 {
-    v4l2_format fmt;
-    memset(&fmt, 0, sizeof(fmt));
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    fmt.fmt.pix.width = m_width;
-    fmt.fmt.pix.height = m_height;
-    fmt.fmt.pix.pixelformat = pixfmt;
-    fmt.fmt.pix.field = V4L2_FIELD_ANY;
+    std::lock_guard<std::mutex> convertLock(m_convertMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        m_pool.reset();
+        m_pool.reset(new WorkerPool(m_convThreads, m_convCpus));
+    }
+    qDebug() << "Conversion threads:" << m_pool->threadCount();
+    // per-band histograms follow the band count
+    if (m_sensorBits) m_agc.configure(m_sensorBits, m_pool->threadCount());
+}
 
-    if (xioctl(m_fd, VIDIOC_S_FMT, &fmt) == -1) {
-        return false;
+// the requested crop in pixels, on even coordinates so chroma pairs and
+// 4:2:2 macropixels stay whole
+QRect V4L2Camera::cropPixels() const
+{
+    QRectF crop;
+    qreal aspect;
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        crop = m_crop.intersected(QRectF(0, 0, 1, 1));
+        aspect = m_cropAspect;
     }
-    m_width = fmt.fmt.pix.width;
-    m_height = fmt.fmt.pix.height;
-    m_pixfmt = fmt.fmt.pix.pixelformat;
-    m_num_planes = 1;
-    qDebug() << "Selected single-planar format" << m_pixfmt << " size " << m_width << "x" << m_height;
-    return true;
+    if (crop.isEmpty()) crop = QRectF(0, 0, 1, 1);
+    if (crop == QRectF(0, 0, 1, 1) && aspect <= 0) return QRect(0, 0, m_width, m_height);
+    QRectF px(crop.x() * m_width, crop.y() * m_height, crop.width() * m_width, crop.height() * m_height);
+    if (aspect > 0) {
+        const QPointF centre = px.center();
+        if (px.width() > px.height() * aspect) px.setWidth(px.height() * aspect);
+        else px.setHeight(px.width() / aspect);
+        px.moveCenter(centre);
+    }
+
+    // never below a few thumbnail blocks
+    const int minSize = 4 * HotSpotTracker::ThumbnailScale;
+    const int w = qBound(qMin(minSize, m_width & ~1), (int)std::lround(px.width()) & ~1, m_width & ~1);
+    const int h = qBound(qMin(minSize, m_height & ~1), (int)std::lround(px.height()) & ~1, m_height & ~1);
+    const int x = qBound(0, (int)std::lround(px.center().x() - w / 2.0), m_width - w) & ~1;
+    const int y = qBound(0, (int)std::lround(px.center().y() - h / 2.0), m_height - h) & ~1;
+    return QRect(x, y, w, h);
 }
 
-bool V4L2Camera::trySetFormatMPlane(uint32_t pixfmt)
+// capture thread: switches conversion to the current crop and box factor;
+// the output pools follow the output size, frames still held downstream
+// keep their old buffers
+void V4L2Camera::applyLayout()
 {
-    v4l2_format fmt;
-    memset(&fmt, 0, sizeof(fmt));
-    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-    fmt.fmt.pix_mp.width = m_width;
-    fmt.fmt.pix_mp.height = m_height;
-    fmt.fmt.pix_mp.pixelformat = pixfmt;
-    fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+    const QRect rect = cropPixels();
+    QSize target;
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        target = m_outputSize;
+    }
+    int scale = 1;
+    if (!target.isEmpty() && !sharpening()) {
+        scale = qMin(rect.width() / target.width(), rect.height() / target.height());
+        scale = qBound(1, scale, (int)MaxBoxFactor);
+    }
+    // chroma pairs stay whole at the output size too
+    const QSize out = scale > 1 ? QSize((rect.width() / scale) & ~1, rect.height() / scale) : rect.size();
+    std::lock_guard<std::mutex> convertLock(m_convertMutex);
+    if (rect == m_cropRect && scale == m_scale && m_framePool) return;
 
-    if (xioctl(m_fd, VIDIOC_S_FMT, &fmt) == -1) {
-        return false;
+    const bool resized = !m_framePool || out != QSize(m_framePool->width(), m_framePool->height());
+    m_cropRect = rect;
+    m_scale = scale;
+    // the accumulator holds another part of the picture now
+    m_denoiser.reset();
+    if (resized) {
+        m_framePool.reset(new FramePool(out.width(), out.height(), QImage::Format_RGB888, m_framePoolSize));
+        m_thumbPool.reset();
+        if (out.width() >= HotSpotTracker::ThumbnailScale && out.height() >= HotSpotTracker::ThumbnailScale) {
+            m_thumbPool.reset(new FramePool(out.width() / HotSpotTracker::ThumbnailScale, out.height() / HotSpotTracker::ThumbnailScale,
+                                            QImage::Format_Grayscale8, 3));
+        }
+    }
+    if (rect.size() != QSize(m_width, m_height) || scale > 1) {
+        qDebug() << "Converting" << rect.width() << "x" << rect.height() << "at" << rect.x() << "," << rect.y()
+                 << "of" << m_width << "x" << m_height << "to" << out.width() << "x" << out.height();
     }
-    m_width = fmt.fmt.pix_mp.width;
-    m_height = fmt.fmt.pix_mp.height;
-    m_pixfmt = fmt.fmt.pix_mp.pixelformat;
-    m_num_planes = fmt.fmt.pix_mp.num_planes;
-    if (m_num_planes <= 0) m_num_planes = 2; // safe default
-    qDebug() << "Selected mplane format" << m_pixfmt << " size " << m_width << "x" << m_height << " planes=" << m_num_planes;
-    return true;
 }
 
-bool V4L2Camera::initFormat()
+void V4L2Camera::run()
 {
-    // try common formats (NV12, NV21, UYVY, YUYV)
-    const uint32_t preferred[] = {
-        V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_YUYV
-    };
+    applyCaptureScheduling();
 
-    if (m_is_mplane) {
-        for (uint32_t f : preferred) {
-            if (trySetFormatMPlane(f)) return true;
-        }
-        // fallback: get current format
-        v4l2_format fmt;
-        memset(&fmt,0,sizeof(fmt));
-        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-        if (xioctl(m_fd, VIDIOC_G_FMT, &fmt) == -1) {
-            emit errorOccurred("VIDIOC_G_FMT (mplane) failed");
-            return false;
-        }
-        m_width = fmt.fmt.pix_mp.width;
-        m_height = fmt.fmt.pix_mp.height;
-        m_pixfmt = fmt.fmt.pix_mp.pixelformat;
-        m_num_planes = fmt.fmt.pix_mp.num_planes;
-        if (m_num_planes <= 0) m_num_planes = 2;
-        qDebug() << "Fallback mplane format" << m_pixfmt << " size " << m_width << "x" << m_height << " planes=" << m_num_planes;
-        return true;
+    QString error;
+    if (!m_source->start(m_width, m_height, error)) {
+        emit errorOccurred(error);
+        return;
+    }
+    m_width = m_source->width();
+    m_height = m_source->height();
+    m_pixfmt = m_source->pixelFormat();
+
+    m_cropRect = QRect();
+    m_scale = 1;
+    m_framePool.reset();
+    m_layoutChanged = false;
+    applyLayout();
+    m_sensorBits = radiometricBits(m_pixfmt);
+    if (m_sensorBits) qDebug() << "Radiometric input," << m_sensorBits << "bits, AGC on";
+    // the calibration carries over from the last stream unless a new one is waiting
+    if (m_calibrationChanged.exchange(false)) {
+        applyCalibration();
     } else {
-        for (uint32_t f : preferred) {
-            if (trySetFormatSingle(f)) return true;
+        std::lock_guard<std::mutex> lock(m_convertMutex);
+        checkCalibration();
+    }
+    m_reconfigure = false;
+    createWorkerPool();
+    m_controlsChanged = false;
+    setSourceControls(m_sensorBits ? 0 : m_source->controls());
+
+    m_running = true;
+    while (m_running) {
+        if (m_reconfigure.exchange(false)) createWorkerPool();
+        if (m_layoutChanged.exchange(false)) applyLayout();
+        if (m_controlsChanged.exchange(false)) applyControls();
+        if (m_calibrationChanged.exchange(false)) applyCalibration();
+
+        // sleeps until a frame is ready or stopCapture()/reconfiguration wakes us
+        SourceBuffer buf;
+        const FrameSource::Status status = m_source->dequeue(buf, -1, error);
+        if (status == FrameSource::Again) {
+            // woken up: recheck running and reconfigure
+            continue;
+        } else if (status == FrameSource::Finished) {
+            if (!error.isEmpty()) emit errorOccurred(error);
+            break;
+        } else if (status == FrameSource::Failed) {
+            emit errorOccurred(error);
+            // small sleep to avoid busy looping on a failing device
+            msleep(2);
+            continue;
         }
-        // fallback: get current single-planar format
-        v4l2_format fmt;
-        memset(&fmt,0,sizeof(fmt));
-        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        if (xioctl(m_fd, VIDIOC_G_FMT, &fmt) == -1) {
-            emit errorOccurred("VIDIOC_G_FMT failed");
-            return false;
+
+        // a raw hand-off requeues the buffer when its consumer releases it
+        FrameTiming timing = dequeueTiming(buf, m_stats);
+        recordBuffer(buf);
+        accumulateFlatField(buf);
+        // frozen: the live frame only goes to the recorder and the history,
+        // the display keeps getting the pinned one
+        FrameHistory *history = m_history.load(std::memory_order_acquire);
+        SourceBuffer pinned;
+        if (history && history->pinned(m_pixfmt, m_width, m_height, pinned)) {
+            processFrozen(buf, pinned, timing);
+        } else {
+            if (!m_frozen.image.isNull()) m_frozen = FrozenFrame();
+            if (!processBuffer(buf, timing)) continue;
         }
-        m_width = fmt.fmt.pix.width;
-        m_height = fmt.fmt.pix.height;
-        m_pixfmt = fmt.fmt.pix.pixelformat;
-        m_num_planes = 1;
-        qDebug() << "Fallback single-planar format" << m_pixfmt << " size " << m_width << "x" << m_height;
-        return true;
+        if (!m_source->requeue(buf.index, error)) emit errorOccurred(error);
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_convertMutex);
+        m_pool.reset();
+        // images still held by the GUI keep their buffers alive past this point
+        m_framePool.reset();
+        m_thumbPool.reset();
+        m_corrected = std::vector<uint16_t>();
+        m_frozen = FrozenFrame();
     }
+    if (m_flatField.running()) {
+        m_flatField.cancel();
+        m_flatFieldRunning = false;
+        emit calibrationChanged();
+    }
+    setSourceControls(0);
+    m_source->stop();
 }
 
-bool V4L2Camera::initMmap()
+// a pooled frame when the pool has that size: a deferred frame can predate
+// the current layout
+QImage V4L2Camera::acquireOutputImage(int width, int height)
 {
-    v4l2_requestbuffers req;
-    memset(&req,0,sizeof(req));
-    req.count = 4;
-    req.memory = V4L2_MEMORY_MMAP;
-    req.type = m_is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (width != m_framePool->width() || height != m_framePool->height()) {
+        return QImage(width, height, QImage::Format_RGB888);
+    }
+    QImage img = m_framePool->acquire();
+    if (!img.isNull()) return img;
 
-    if (xioctl(m_fd, VIDIOC_REQBUFS, &req) == -1) {
-        emit errorOccurred(QString("VIDIOC_REQBUFS failed: %1").arg(strerror(errno)));
-        return false;
+    // every pooled buffer is still referenced downstream; fall back to a heap image
+    quint64 n = ++m_framePoolExhausted;
+    if ((n & (n - 1)) == 0) {
+        qWarning() << "Frame pool ran dry" << n << "times (" << m_framePool->count() << "buffers )";
     }
-    if (req.count < 2) {
-        emit errorOccurred("Insufficient buffer memory");
-        return false;
+    return QImage(width, height, QImage::Format_RGB888);
+}
+
+void V4L2Camera::addFrameListener(FrameListener *listener)
+{
+    std::lock_guard<std::mutex> lock(m_listenerMutex);
+    m_listeners.push_back(listener);
+    m_listenerCount.store((int)m_listeners.size(), std::memory_order_release);
+}
+
+void V4L2Camera::removeFrameListener(FrameListener *listener)
+{
+    std::lock_guard<std::mutex> lock(m_listenerMutex);
+    m_listeners.erase(std::remove(m_listeners.begin(), m_listeners.end(), listener), m_listeners.end());
+    m_listenerCount.store((int)m_listeners.size(), std::memory_order_release);
+}
+
+void V4L2Camera::publishFrame(VideoFrame &frame)
+{
+    if (frame.timing.valid()) frame.timing.publishNs = monotonicNs();
+    if (!frame.deferred() && m_listenerCount.load(std::memory_order_acquire)) {
+        std::lock_guard<std::mutex> lock(m_listenerMutex);
+        for (FrameListener *listener : m_listeners) listener->frameCaptured(frame);
+    }
+    const FrameTiming timing = frame.timing;
+    if (m_mailbox.publish(frame)) {
+        emit frameAvailable();
     }
+    m_stats->recordCapture(timing);
+}
+
+bool V4L2Camera::rawOutputSupported() const
+{
+    return m_pixfmt == V4L2_PIX_FMT_NV12 || m_pixfmt == V4L2_PIX_FMT_NV21
+        || m_pixfmt == V4L2_PIX_FMT_UYVY || m_pixfmt == V4L2_PIX_FMT_YUYV;
+}
 
-    m_buffers.clear();
-    m_buffers.resize(req.count);
+// deferredScale 0 publishes the buffer for the GPU, otherwise for
+// convertDeferred() at that box factor
+bool V4L2Camera::publishRawFrame(const SourceBuffer &buf, int deferredScale, const FrameTiming &timing)
+{
+    const bool semiPlanar = (m_pixfmt == V4L2_PIX_FMT_NV12 || m_pixfmt == V4L2_PIX_FMT_NV21);
+    if (!buf.planeCount || (semiPlanar && buf.planeCount < 2)) return false;
+    RawFrame &raw = *m_source->exportBuffer(buf.index);
+    cropPlanes(buf, m_cropRect, raw);
 
-    for (uint32_t i = 0; i < (uint32_t)req.count; ++i) {
-        if (m_is_mplane) {
-            // multi-planar: query buffer with plane info
-            v4l2_buffer buf;
-            memset(&buf, 0, sizeof(buf));
-            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-            buf.memory = V4L2_MEMORY_MMAP;
-            buf.index = i;
+    VideoFrame frame;
+    frame.raw = RawFrameRef(&raw);
+    frame.timing = timing;
+    frame.deferredScale = deferredScale;
+    publishFrame(frame);
+    return true;
+}
 
-            // prepare planes array to receive info
-            v4l2_plane planes[VIDEO_MAX_PLANES];
-            memset(planes, 0, sizeof(planes));
-            buf.m.planes = planes;
-            buf.length = VIDEO_MAX_PLANES;
+// luma pixels tone-mapped per step before a colour kernel; the scratch row
+// stays in L1 and keeps chroma pairs intact (even length)
+static const int CurveChunk = 512;
 
-            if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) == -1) {
-                emit errorOccurred(QString("VIDIOC_QUERYBUF (mplane) failed: %1").arg(strerror(errno)));
-                return false;
-            }
+// packed 4:2:2 row with its luma bytes replaced by luma[], mapped through
+// curve when there is one
+static void replacePackedLuma(const uint8_t *src, int lumaOffset, const uint8_t *luma,
+                              const uint8_t *curve, uint8_t *out, int width)
+{
+    for (int x = 0; x < width; ++x) {
+        out[x * 2 + lumaOffset] = curve ? curve[luma[x]] : luma[x];
+        out[x * 2 + 1 - lumaOffset] = src[x * 2 + 1 - lumaOffset];
+    }
+}
 
-            // number of planes filled by driver is in buf.length OR m_num_planes; use min
-            int planes_count = buf.length;
-            if (planes_count <= 0) planes_count = m_num_planes;
-            if (planes_count > VIDEO_MAX_PLANES) planes_count = VIDEO_MAX_PLANES;
-
-            m_buffers[i].starts.resize(planes_count);
-            m_buffers[i].lengths.resize(planes_count);
-
-            for (int p = 0; p < planes_count; ++p) {
-                size_t len = planes[p].length;
-                off_t off = planes[p].m.mem_offset;
-                void *start = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, off);
-                if (start == MAP_FAILED) {
-                    emit errorOccurred(QString("mmap plane %1 failed: %2").arg(p).arg(strerror(errno)));
-                    // unmap previously mapped planes for this buffer
-                    for (int q = 0; q < p; ++q) {
-                        if (m_buffers[i].starts[q]) munmap(m_buffers[i].starts[q], m_buffers[i].lengths[q]);
-                        m_buffers[i].starts[q] = nullptr;
-                        m_buffers[i].lengths[q] = 0;
-                    }
-                    return false;
-                }
-                m_buffers[i].starts[p] = start;
-                m_buffers[i].lengths[p] = len;
-            }
+// feeds one converted row into the tracker thumbnail: max-pooled luma
+void V4L2Camera::thumbnailRow(const ConvertJob &job, int row, const uchar *src, const uchar *luma)
+{
+    if (!job.thumb || row / HotSpotTracker::ThumbnailScale >= job.thumbHeight) return;
+    const bool packed = (job.kind == ConvertJob::Packed || job.kind == ConvertJob::PackedLut);
+    uchar *thumbRow = job.thumb + (row / HotSpotTracker::ThumbnailScale) * job.thumbStride;
+    const bool first = (row % HotSpotTracker::ThumbnailScale) == 0;
+    if (luma || !packed) {
+        thumbnailMaxRow(luma ? luma : src, 1, thumbRow, job.thumbWidth, first);
+    } else {
+        thumbnailMaxRow(src + job.lumaOffset, 2, thumbRow, job.thumbWidth, first);
+    }
+}
+
+// one RGB row of job.width pixels: src is the luma or packed 4:2:2 row, uv
+// the chroma row (semi-planar only), luma prepared 8-bit luma that stands in
+// for the luma of src, or null
+void V4L2Camera::convertRow(const ConvertJob &job, const uchar *src, const uchar *uv, const uchar *luma,
+                            uchar *dst, uint8_t *packedScratch)
+{
+    uint8_t scratch[CurveChunk * 2];
+    switch (job.kind) {
+    case ConvertJob::SemiPlanar: {
+        const uchar *y = luma ? luma : src;
+        if (!job.curve) {
+            job.semiPlanarRow(y, uv, dst, job.width);
+            break;
+        }
+        for (int x = 0; x < job.width; x += CurveChunk) {
+            const int n = qMin(CurveChunk, job.width - x);
+            curveRowPlanar(y + x, job.curve, scratch, n);
+            job.semiPlanarRow(scratch, uv + x, dst + x * 3, n);
+        }
+        break;
+    }
+    case ConvertJob::Packed:
+        if (luma) {
+            replacePackedLuma(src, job.lumaOffset, luma, job.curve, packedScratch, job.width);
+            job.packedRow(packedScratch, dst, job.width);
+            break;
+        }
+        if (!job.curve) {
+            job.packedRow(src, dst, job.width);
+            break;
+        }
+        for (int x = 0; x < job.width; x += CurveChunk) {
+            const int n = qMin(CurveChunk, job.width - x);
+            curveRowPacked(src + x * 2, job.lumaOffset, job.curve, scratch, n);
+            job.packedRow(scratch, dst + x * 3, n);
+        }
+        break;
+    case ConvertJob::Grey:
+        job.greyRow(luma ? luma : src, dst, job.width);
+        break;
+    case ConvertJob::PlanarLut:
+        lutRowPlanar(luma ? luma : src, job.lut, dst, job.width);
+        break;
+    case ConvertJob::PackedLut:
+        if (luma) {
+            lutRowPlanar(luma, job.lut, dst, job.width);
         } else {
-            // single-planar
-            v4l2_buffer buf;
-            memset(&buf, 0, sizeof(buf));
-            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            buf.memory = V4L2_MEMORY_MMAP;
-            buf.index = i;
-
-            if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) == -1) {
-                emit errorOccurred(QString("VIDIOC_QUERYBUF failed: %1").arg(strerror(errno)));
-                return false;
+            lutRowPacked(src, job.lumaOffset, job.lut, dst, job.width);
+        }
+        break;
+    }
+}
+
+void V4L2Camera::convertRows(void *ctx, int rowBegin, int rowEnd)
+{
+    const ConvertJob &job = *static_cast<const ConvertJob*>(ctx);
+    if (job.scale > 1) {
+        convertRowsScaled(job, rowBegin, rowEnd);
+        return;
+    }
+    const bool packed = (job.kind == ConvertJob::Packed || job.kind == ConvertJob::PackedLut);
+    const int srcStride = job.srcStride;
+
+    // every conversion thread streams its band through its own line buffers;
+    // they only grow on the first sharpened or denoised frame
+    static thread_local LumaSharpener sharpener;
+    static thread_local std::vector<uint8_t> sharpPacked;
+    static thread_local std::vector<uint8_t> agcLuma;
+    static thread_local std::vector<uint8_t> sharpLuma;
+    const bool sharpen = job.sharpenAmount > 0;
+    // rows wait for the rest of their strip while denoising, so prepared
+    // luma needs a line per strip row
+    const int strip = job.denoiser ? (int)TemporalDenoiser::BlockSize : 1;
+    if (sharpen && job.src16) {
+        sharpener.begin16(job.src16, srcStride / 2, job.agc->table(), job.agc->maxValue(),
+                          job.width, job.height, job.sharpenRadius, job.sharpenAmount, rowBegin);
+    } else if (sharpen) {
+        sharpener.begin(job.src + (packed ? job.lumaOffset : 0), packed ? 2 : 1, srcStride,
+                        job.width, job.height, job.sharpenRadius, job.sharpenAmount, rowBegin);
+    }
+    if (packed && (sharpen || job.denoiser) && sharpPacked.size() < (size_t)job.width * 2) {
+        sharpPacked.resize(job.width * 2);
+    }
+    if (sharpen && job.denoiser && sharpLuma.size() < (size_t)job.width * strip) {
+        sharpLuma.resize((size_t)job.width * strip);
+    }
+    uint32_t *hist = nullptr;
+    if (job.src16) {
+        hist = job.agc->bandHistogram(rowBegin / job.bandRows);
+        if (agcLuma.size() < (size_t)job.width * strip) agcLuma.resize((size_t)job.width * strip);
+    }
+
+    RowStrip rows;
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        const int slot = (row - rowBegin) % strip;
+        const uchar *src = job.src + row * srcStride;
+        // prepared 8-bit luma (sharpened and/or AGC-mapped) stands in for the
+        // source luma of this row; null when the kernels read src directly
+        const uchar *luma = sharpen ? sharpener.row(row) : nullptr;
+        if (job.src16) {
+            // 16-bit rows are counted for the next frame's AGC and, unless the
+            // sharpener has mapped them already, mapped right here
+            const uint16_t *src16 = job.src16 + row * (srcStride / 2);
+            const int maxValue = job.agc->maxValue();
+            if (sharpen) {
+                agcHistogramRow(src16, maxValue, job.agc->binShift(), hist, job.width);
+            } else {
+                uint8_t *mapped = agcLuma.data() + (size_t)slot * job.width;
+                agcRow(src16, job.agc->table(), maxValue, job.agc->binShift(), hist, mapped, job.width);
+                luma = mapped;
             }
+        }
+        if (sharpen && job.denoiser) {
+            // the sharpener's row is only good until its next one
+            uint8_t *kept = sharpLuma.data() + (size_t)slot * job.width;
+            memcpy(kept, luma, job.width);
+            luma = kept;
+        }
+        rows.src[slot] = src;
+        rows.uv[slot] = job.uv ? job.uv + (row / 2) * job.uvStride : nullptr;
+        rows.luma[slot] = luma;
+        if (slot == strip - 1 || row == rowEnd - 1) finishRows(job, row - slot, slot + 1, rows, sharpPacked.data());
+    }
+}
 
-            m_buffers[i].starts.resize(1);
-            m_buffers[i].lengths.resize(1);
-            m_buffers[i].lengths[0] = buf.length;
-            m_buffers[i].starts[0] = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
-            if (m_buffers[i].starts[0] == MAP_FAILED) {
-                emit errorOccurred(QString("mmap failed: %1").arg(strerror(errno)));
-                return false;
+// The rest of the way for rows whose luma is ready: the temporal filter over
+// the strip, then the tracker thumbnail and the colour conversion row by row.
+// A strip is at most BlockSize rows, so its source rows are still in cache
+// when the filter has done with them.
+void V4L2Camera::finishRows(const ConvertJob &job, int firstRow, int count, const RowStrip &rows,
+                            uint8_t *packedScratch)
+{
+    const uchar *luma[TemporalDenoiser::BlockSize];
+    for (int i = 0; i < count; ++i) luma[i] = rows.luma[i];
+    if (job.denoiser) {
+        static thread_local std::vector<uint8_t> packedLuma;
+        static thread_local std::vector<uint8_t> filtered;
+        const size_t stripBytes = (size_t)job.width * TemporalDenoiser::BlockSize;
+        if (filtered.size() < stripBytes) filtered.resize(stripBytes);
+        const bool packed = (job.kind == ConvertJob::Packed || job.kind == ConvertJob::PackedLut);
+        for (int i = 0; i < count; ++i) {
+            if (luma[i]) continue;
+            if (!packed) {
+                luma[i] = rows.src[i];
+                continue;
             }
+            // the filter reads planar luma
+            if (packedLuma.size() < stripBytes) packedLuma.resize(stripBytes);
+            uint8_t *y = packedLuma.data() + (size_t)i * job.width;
+            const uchar *src = rows.src[i] + job.lumaOffset;
+            for (int x = 0; x < job.width; ++x) y[x] = src[x * 2];
+            luma[i] = y;
         }
+        job.denoiser->filterRows(luma, firstRow, count, filtered.data(), job.width);
+        for (int i = 0; i < count; ++i) luma[i] = filtered.data() + (size_t)i * job.width;
+    }
+    for (int i = 0; i < count; ++i) {
+        const int row = firstRow + i;
+        thumbnailRow(job, row, rows.src[i], luma[i]);
+        if (!job.dst) continue; // thumbnail only
+        convertRow(job, rows.src[i], rows.uv[i], luma[i], job.dst + row * job.dstStride, packedScratch);
+    }
+}
+
+// Rows of a box-downscaled frame: the scale x scale source block behind each
+// output pixel is averaged on the way in, then the reduced row goes through
+// the same kernels as a full-size one. Rows are output rows.
+void V4L2Camera::convertRowsScaled(const ConvertJob &job, int rowBegin, int rowEnd)
+{
+    const int k = job.scale;
+    const int w = job.width;
+    const bool packed = (job.kind == ConvertJob::Packed || job.kind == ConvertJob::PackedLut);
+    const int srcBytes = w * k * (packed ? 2 : 1); // source bytes behind one output row
+
+    static thread_local std::vector<uint16_t> acc;
+    static thread_local std::vector<uint32_t> acc16;
+    static thread_local std::vector<uint8_t> reduced;
+    static thread_local std::vector<uint8_t> reducedUv;
+    static thread_local std::vector<uint16_t> reduced16;
+    static thread_local std::vector<uint8_t> agcLuma;
+    static thread_local std::vector<uint8_t> packedScratch;
+    // reduced rows wait for the rest of their strip while denoising
+    const int strip = job.denoiser ? (int)TemporalDenoiser::BlockSize : 1;
+    uint32_t *hist = nullptr;
+    if (job.src16) {
+        hist = job.agc->bandHistogram(rowBegin / job.bandRows);
+        if (acc16.size() < (size_t)w * k) acc16.resize((size_t)w * k);
+        if (reduced16.size() < (size_t)w) reduced16.resize(w);
+        if (agcLuma.size() < (size_t)w * strip) agcLuma.resize((size_t)w * strip);
+    } else {
+        if (acc.size() < (size_t)srcBytes) acc.resize(srcBytes);
+        if (reduced.size() < (size_t)w * 2 * strip) reduced.resize((size_t)w * 2 * strip);
+        if (reducedUv.size() < (size_t)w * strip) reducedUv.resize((size_t)w * strip);
     }
+    if (packed && job.denoiser && packedScratch.size() < (size_t)w * 2) packedScratch.resize((size_t)w * 2);
 
-    // queue buffers
-    for (uint32_t i = 0; i < (uint32_t)m_buffers.size(); ++i) {
-        if (m_is_mplane) {
-            v4l2_buffer buf;
-            memset(&buf, 0, sizeof(buf));
-            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-            buf.memory = V4L2_MEMORY_MMAP;
-            buf.index = i;
-
-            // prepare empty planes array; driver doesn't require mem_offset here for mmap requeue
-            v4l2_plane planes[VIDEO_MAX_PLANES];
-            memset(planes,0,sizeof(planes));
-            buf.m.planes = planes;
-            buf.length = m_num_planes;
-
-            if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1) {
-                emit errorOccurred(QString("VIDIOC_QBUF (mplane) failed: %1").arg(strerror(errno)));
-                return false;
+    RowStrip rows;
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        const int slot = (row - rowBegin) % strip;
+        const int srcRow = row * k;
+        uchar *reducedRow = reduced.data() + (size_t)slot * w * 2;
+        const uchar *src = reducedRow;
+        const uchar *uv = nullptr;
+        const uchar *luma = nullptr;
+        if (job.src16) {
+            // averaged words go through the AGC, and into its histogram, like full-size ones
+            const int stride16 = job.srcStride / 2;
+            for (int i = 0; i < k; ++i) {
+                boxAccumulateRow16(job.src16 + (srcRow + i) * stride16, acc16.data(), w * k, i == 0);
             }
+            boxReduceRow16(acc16.data(), k, k * k, reduced16.data(), w);
+            uint8_t *mapped = agcLuma.data() + (size_t)slot * w;
+            agcRow(reduced16.data(), job.agc->table(), job.agc->maxValue(), job.agc->binShift(), hist, mapped, w);
+            luma = mapped;
         } else {
-            v4l2_buffer buf;
-            memset(&buf, 0, sizeof(buf));
-            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-            buf.memory = V4L2_MEMORY_MMAP;
-            buf.index = i;
-            if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1) {
-                emit errorOccurred(QString("VIDIOC_QBUF failed: %1").arg(strerror(errno)));
-                return false;
+            for (int i = 0; i < k; ++i) {
+                boxAccumulateRow(job.src + (srcRow + i) * job.srcStride, acc.data(), srcBytes, i == 0);
+            }
+            if (packed) {
+                // luma per pixel, each chroma channel per pixel pair
+                const int c = 1 - job.lumaOffset;
+                boxReduceRow(acc.data() + job.lumaOffset, 2, k, k * k, reducedRow + job.lumaOffset, 2, w);
+                boxReduceRow(acc.data() + c, 4, k, k * k, reducedRow + c, 4, w / 2);
+                boxReduceRow(acc.data() + c + 2, 4, k, k * k, reducedRow + c + 2, 4, w / 2);
+            } else {
+                boxReduceRow(acc.data(), 1, k, k * k, reducedRow, 1, w);
+            }
+            if (job.kind == ConvertJob::SemiPlanar && job.dst) {
+                // the half-height chroma rows under this output row
+                const int first = srcRow / 2;
+                const int last = (srcRow + k - 1) / 2;
+                for (int r = first; r <= last; ++r) {
+                    boxAccumulateRow(job.uv + r * job.uvStride, acc.data(), w * k, r == first);
+                }
+                const int divisor = (last - first + 1) * k;
+                uchar *uvRow = reducedUv.data() + (size_t)slot * w;
+                boxReduceRow(acc.data(), 2, k, divisor, uvRow, 2, w / 2);
+                boxReduceRow(acc.data() + 1, 2, k, divisor, uvRow + 1, 2, w / 2);
+                uv = uvRow;
             }
         }
+        rows.src[slot] = src;
+        rows.uv[slot] = uv;
+        rows.luma[slot] = luma;
+        if (slot == strip - 1 || row == rowEnd - 1) finishRows(job, row - slot, slot + 1, rows, packedScratch.data());
     }
-    return true;
 }
 
-void V4L2Camera::uninitMmap()
+void V4L2Camera::convertFrame(ConvertJob &job, const PixelLut &pointOps, QImage &out, QImage &thumb)
 {
-    for (auto &b : m_buffers) {
-        for (size_t p = 0; p < b.starts.size(); ++p) {
-            if (b.starts[p] && b.lengths[p]) {
-                munmap(b.starts[p], b.lengths[p]);
-            }
-            b.starts[p] = nullptr;
-            b.lengths[p] = 0;
+    job.dst = out.isNull() ? nullptr : out.bits();
+    job.dstStride = out.bytesPerLine();
+    job.greyRow = m_kernels->grey;
+
+    // all point operations of this frame come from one snapshot
+    if (!pointOps.identity) {
+        if (pointOps.mapped || job.kind == ConvertJob::Grey) {
+            // palette, or nothing but luma to map: one RGB lookup per pixel
+            job.kind = (job.kind == ConvertJob::Packed) ? ConvertJob::PackedLut : ConvertJob::PlanarLut;
+            job.lut = pointOps.rgb;
+        } else {
+            job.curve = pointOps.curve;
         }
     }
-    m_buffers.clear();
+    // a scaled frame is not sharpened; the next layout goes back to full size
+    const int sharpen = (job.dst && job.scale == 1) ? m_sharpen.load(std::memory_order_relaxed) : 0;
+    job.sharpenAmount = sharpen & 0xff;
+    job.sharpenRadius = sharpen >> 8;
+    // semi-planar bands start on even rows so each chroma row belongs to one
+    // band, and with a thumbnail each block of thumbnail rows does too
+    int rowAlign = (job.kind == ConvertJob::SemiPlanar && job.scale == 1) ? 2 : 1;
+    if (!thumb.isNull()) {
+        job.thumb = thumb.bits();
+        job.thumbStride = thumb.bytesPerLine();
+        job.thumbWidth = thumb.width();
+        job.thumbHeight = thumb.height();
+        rowAlign = HotSpotTracker::ThumbnailScale;
+    }
+    // the filter sees every displayed frame in order: thumbnail-only passes
+    // leave the accumulator alone, a frame without the filter voids it
+    const int denoise = job.dst ? m_denoise.load(std::memory_order_relaxed) : 0;
+    if (denoise) {
+        if (m_denoiseRestart.exchange(false)) m_denoiser.reset();
+        m_denoiser.configure(job.width, job.height, denoise & 0xff, denoise >> 8);
+        job.denoiser = &m_denoiser;
+        // whole strips per band; a multiple of the alignments above
+        rowAlign = TemporalDenoiser::BlockSize;
+    } else if (job.dst) {
+        m_denoiser.reset();
+    }
+    if (m_sensorBits) {
+        job.src16 = reinterpret_cast<const uint16_t*>(job.src);
+        job.agc = &m_agc;
+        job.bandRows = m_pool->bandRows(job.height, rowAlign);
+    }
+    m_pool->run(job.height, rowAlign, &V4L2Camera::convertRows, &job);
+    if (job.denoiser) m_denoiser.frameDone();
+
+    // this frame's histogram becomes the next frame's mapping
+    if (m_sensorBits) {
+        if (job.agcLearns) m_agc.update((Agc::Mode)m_agcMode.load(std::memory_order_relaxed));
+        else m_agc.discard();
+    }
 }
 
-bool V4L2Camera::startStreaming()
+// rect of buf as frame planes: pointers move to its corner, the driver's
+// strides stay. x must be even, so 4:2:2 pairs and chroma samples line up.
+void V4L2Camera::cropPlanes(const SourceBuffer &buf, const QRect &rect, RawFrame &raw) const
 {
-    v4l2_buf_type type = m_is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    if (xioctl(m_fd, VIDIOC_STREAMON, &type) == -1) {
-        emit errorOccurred(QString("VIDIOC_STREAMON failed: %1").arg(strerror(errno)));
-        return false;
+    const int x = rect.x();
+    const int y = rect.y();
+    const bool wide = m_sensorBits || m_pixfmt == V4L2_PIX_FMT_UYVY || m_pixfmt == V4L2_PIX_FMT_YUYV;
+    raw.pixelFormat = m_pixfmt;
+    raw.width = rect.width();
+    raw.height = rect.height();
+    raw.planeCount = 0;
+    if (!buf.planeCount) return;
+    raw.planeCount = 1;
+    raw.planes[0] = { buf.planes[0] + (size_t)y * buf.bytesPerLine[0] + x * (wide ? 2 : 1), buf.bytesPerLine[0] };
+    if ((m_pixfmt == V4L2_PIX_FMT_NV12 || m_pixfmt == V4L2_PIX_FMT_NV21) && buf.planeCount > 1) {
+        raw.planeCount = 2;
+        raw.planes[1] = { buf.planes[1] + (size_t)(y / 2) * buf.bytesPerLine[1] + x, buf.bytesPerLine[1] };
     }
-    return true;
 }
 
-void V4L2Camera::stopStreaming()
+// how to convert raw, box-filtered by scale
+void V4L2Camera::describeFrame(const RawFrame &raw, int scale, ConvertJob &job) const
 {
-    if (m_fd < 0) return;
-    v4l2_buf_type type = m_is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    xioctl(m_fd, VIDIOC_STREAMOFF, &type);
+    if (!raw.planeCount) return;
+    const uint32_t pixfmt = raw.pixelFormat;
+    job.src = raw.planes[0].data;
+    job.srcStride = raw.planes[0].bytesPerLine;
+    job.scale = scale;
+    // chroma pairs stay whole at the output size too
+    job.width = scale > 1 ? (raw.width / scale) & ~1 : raw.width;
+    job.height = raw.height / scale;
+    job.lumaOffset = (pixfmt == V4L2_PIX_FMT_UYVY) ? 1 : 0;
+    if (pixfmt == V4L2_PIX_FMT_NV12 || pixfmt == V4L2_PIX_FMT_NV21) {
+        if (raw.planeCount > 1) {
+            job.kind = ConvertJob::SemiPlanar;
+            job.semiPlanarRow = (pixfmt == V4L2_PIX_FMT_NV21) ? m_kernels->nv21 : m_kernels->nv12;
+            job.uv = raw.planes[1].data;
+            job.uvStride = raw.planes[1].bytesPerLine;
+            return;
+        }
+    } else if (pixfmt == V4L2_PIX_FMT_UYVY || pixfmt == V4L2_PIX_FMT_YUYV) {
+        job.kind = ConvertJob::Packed;
+        job.packedRow = (pixfmt == V4L2_PIX_FMT_UYVY) ? m_kernels->uyvy : m_kernels->yuyv;
+        return;
+    }
+    // fallback -> grayscale (or radiometric) from the first plane
+    job.kind = ConvertJob::Grey;
 }
 
-// small helpers for conversion
-static inline uchar clamp255(int v) {
-    if (v < 0) return 0;
-    if (v > 255) return 255;
-    return (uchar)v;
-}
-static inline void yuvToRgbPixel(int y, int u, int v, uchar &r, uchar &g, uchar &b)
+QImage V4L2Camera::acquireThumbnail()
 {
-    int c = y - 16;
-    int d = u - 128;
-    int e = v - 128;
-    int rr = (298 * c + 409 * e + 128) >> 8;
-    int gg = (298 * c - 100 * d - 208 * e + 128) >> 8;
-    int bb = (298 * c + 516 * d + 128) >> 8;
-    r = clamp255(rr);
-    g = clamp255(gg);
-    b = clamp255(bb);
+    HotSpotTracker *tracker = m_tracker.load(std::memory_order_acquire);
+    if (!tracker || !tracker->enabled() || !m_thumbPool) return QImage();
+    // a dry pool means the tracker is still busy: it just skips this frame
+    return m_thumbPool->acquire();
 }
 
-bool V4L2Camera::readOneFrame()
+bool V4L2Camera::processBuffer(const SourceBuffer &buf, FrameTiming &timing)
 {
-    if (m_is_mplane) {
-        v4l2_buffer buf;
-        memset(&buf,0,sizeof(buf));
-        v4l2_plane planes[VIDEO_MAX_PLANES];
-        memset(planes,0,sizeof(planes));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
-        buf.memory = V4L2_MEMORY_MMAP;
-        buf.m.planes = planes;
-        buf.length = VIDEO_MAX_PLANES;
+    std::lock_guard<std::mutex> lock(m_convertMutex);
+    RawFrame view;
+    cropPlanes(buf, m_cropRect, view);
+    ConvertJob job;
+    describeFrame(view, m_scale, job);
+    if (!job.src) return true;
+    if (m_calibrated.load(std::memory_order_relaxed)) correctFrame(buf, job);
+
+    const PixelLut &pointOps = m_pixelLuts.current();
+    QImage thumb = acquireThumbnail();
 
-        if (xioctl(m_fd, VIDIOC_DQBUF, &buf) == -1) {
-            if (errno == EAGAIN) return false;
-            emit errorOccurred(QString("VIDIOC_DQBUF (mplane) failed: %1").arg(strerror(errno)));
+    // raw hand-off, converted on the GPU or by the display when it shows the frame
+    const bool gpu = m_rawOutput && pointOps.identity && !sharpening() && !denoising()
+        && rawOutputSupported();
+    const bool lazy = !gpu && m_lazy && !m_sensorBits && !denoising()
+        && !m_listenerCount.load(std::memory_order_acquire);
+    bool thumbDone = false;
+    if (gpu || lazy) {
+        // the thumbnail has to be taken before the consumer can give the
+        // buffer back to the driver; on a copy, since convertFrame() adapts
+        // the job to the point ops and job may still be needed below
+        QImage none;
+        if (!thumb.isNull()) {
+            ConvertJob thumbJob = job;
+            convertFrame(thumbJob, pointOps, none, thumb);
+            thumbDone = true;
+        }
+        if (publishRawFrame(buf, lazy ? m_scale : 0, timing)) {
+            submitThumbnail(thumb);
             return false;
         }
+    }
+
+    // a failed hand-off falls back to converting, the thumbnail already taken
+    QImage out = acquireOutputImage(job.width, job.height);
+    QImage noThumb;
+    if (timing.valid()) timing.convertStartNs = monotonicNs();
+    convertFrame(job, pointOps, out, thumbDone ? noThumb : thumb);
+    if (timing.valid()) timing.convertEndNs = monotonicNs();
 
-        int idx = buf.index;
-        int planes_count = buf.length;
-        if (planes_count <= 0) planes_count = m_num_planes;
-        if ((size_t)idx >= m_buffers.size()) {
-            // defensive
-            if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1) {
-                emit errorOccurred(QString("VIDIOC_QBUF (requeue invalid idx) failed: %1").arg(strerror(errno)));
+    VideoFrame frame;
+    frame.image = out;
+    frame.timing = timing;
+    publishFrame(frame);
+    submitThumbnail(thumb);
+    return true;
+}
+
+// Frozen: the tracker keeps following the live frame through a
+// thumbnail-only pass, and the AGC of radiometric input through that pass or
+// a histogram-only one, while the display is handed the pinned frame. That is converted again only when the pin, the layout or the
+// settings behind it change; in between the last image is republished.
+void V4L2Camera::processFrozen(const SourceBuffer &live, const SourceBuffer &pinned, FrameTiming &timing)
+{
+    std::lock_guard<std::mutex> lock(m_convertMutex);
+    const PixelLut &pointOps = m_pixelLuts.current();
+    const bool calibrated = m_calibrated.load(std::memory_order_relaxed);
+
+    QImage thumb = acquireThumbnail();
+    if (!thumb.isNull() || m_sensorBits) {
+        RawFrame view;
+        cropPlanes(live, m_cropRect, view);
+        ConvertJob job;
+        describeFrame(view, m_scale, job);
+        if (job.src) {
+            if (calibrated) correctFrame(live, job);
+            if (!thumb.isNull()) {
+                QImage none;
+                convertFrame(job, pointOps, none, thumb);
+            } else {
+                learnAgc(job);
             }
-            return false;
         }
+        submitThumbnail(thumb);
+    }
 
-        QImage out(m_width, m_height, QImage::Format_RGB888);
-
-        // handle NV12 / NV21 common mplane layout: plane0 = Y, plane1 = interleaved UV
-        const unsigned char *yPlane = nullptr;
-        const unsigned char *uvPlane = nullptr;
-        if (m_buffers[idx].starts.size() > 0) yPlane = static_cast<const unsigned char*>(m_buffers[idx].starts[0]);
-        if (m_buffers[idx].starts.size() > 1) uvPlane = static_cast<const unsigned char*>(m_buffers[idx].starts[1]);
-
-        bool isNV21 = (m_pixfmt == V4L2_PIX_FMT_NV21);
-        if ((m_pixfmt == V4L2_PIX_FMT_NV12 || m_pixfmt == V4L2_PIX_FMT_NV21) && yPlane && uvPlane) {
-            for (int row = 0; row < m_height; ++row) {
-                uchar *dst = out.scanLine(row);
-                int yRow = row * m_width;
-                int uvRow = (row / 2) * m_width;
-                for (int col = 0; col < m_width; ++col) {
-                    int y = yPlane[yRow + col];
-                    int uvIndex = uvRow + (col & ~1);
-                    int u = uvPlane[uvIndex + (isNV21 ? 1 : 0)];
-                    int v = uvPlane[uvIndex + (isNV21 ? 0 : 1)];
-                    uchar r,g,b;
-                    yuvToRgbPixel(y,u,v,r,g,b);
-                    dst[col*3 + 0] = r;
-                    dst[col*3 + 1] = g;
-                    dst[col*3 + 2] = b;
-                }
-            }
+    FrozenFrame key;
+    key.data = pinned.planes[0];
+    key.sequence = pinned.sequence;
+    key.timestampNs = pinned.timestampNs;
+    key.rect = m_cropRect;
+    key.scale = m_scale;
+    key.pointOps = m_pixelLuts.generation();
+    key.sharpen = m_sharpen.load(std::memory_order_relaxed);
+    key.denoise = m_denoise.load(std::memory_order_relaxed);
+    key.agcMode = m_agcMode.load(std::memory_order_relaxed);
+    key.calibrated = calibrated;
+    const FrozenFrame &last = m_frozen;
+    if (last.image.isNull() || key.data != last.data || key.sequence != last.sequence
+        || key.timestampNs != last.timestampNs || key.rect != last.rect || key.scale != last.scale
+        || key.pointOps != last.pointOps || key.sharpen != last.sharpen || key.denoise != last.denoise
+        || key.agcMode != last.agcMode || key.calibrated != last.calibrated) {
+        RawFrame view;
+        cropPlanes(pinned, m_cropRect, view);
+        ConvertJob job;
+        describeFrame(view, m_scale, job);
+        if (!job.src) return;
+        if (calibrated) correctFrame(pinned, job);
+        // a held frame says nothing about the scene the AGC is following
+        job.agcLearns = false;
+        key.image = acquireOutputImage(job.width, job.height);
+        if (timing.valid()) timing.convertStartNs = monotonicNs();
+        QImage none;
+        convertFrame(job, pointOps, key.image, none);
+        if (timing.valid()) timing.convertEndNs = monotonicNs();
+        m_frozen = key;
+    }
+
+    VideoFrame frame;
+    frame.image = m_frozen.image;
+    frame.timing = timing;
+    publishFrame(frame);
+}
+
+namespace {
+struct HistogramJob {
+    Agc *agc;
+    const uint16_t *src;
+    int srcStride; // in pixels
+    int width;
+    int bandRows;
+};
+}
+
+void V4L2Camera::agcHistogramRows(void *ctx, int rowBegin, int rowEnd)
+{
+    const HistogramJob &job = *static_cast<const HistogramJob*>(ctx);
+    uint32_t *hist = job.agc->bandHistogram(rowBegin / job.bandRows);
+    for (int row = rowBegin; row < rowEnd; ++row) {
+        agcHistogramRow(job.src + (size_t)row * job.srcStride, job.agc->maxValue(), job.agc->binShift(),
+                        hist, job.width);
+    }
+}
+
+// capture thread, under m_convertMutex: counts the radiometric crop job
+// describes into the AGC and updates the mapping, converting nothing
+void V4L2Camera::learnAgc(const ConvertJob &job)
+{
+    HistogramJob histogram;
+    histogram.agc = &m_agc;
+    histogram.src = reinterpret_cast<const uint16_t*>(job.src);
+    histogram.srcStride = job.srcStride / 2;
+    histogram.width = m_cropRect.width();
+    histogram.bandRows = m_pool->bandRows(m_cropRect.height(), 1);
+    m_pool->run(m_cropRect.height(), 1, &V4L2Camera::agcHistogramRows, &histogram);
+    m_agc.update((Agc::Mode)m_agcMode.load(std::memory_order_relaxed));
+}
+
+void V4L2Camera::convertDeferred(VideoFrame &frame)
+{
+    if (!frame.deferred()) return;
+    const RawFrameRef raw = std::move(frame.raw);
+    const int scale = frame.deferredScale;
+    frame.deferredScale = 0;
+
+    std::lock_guard<std::mutex> lock(m_convertMutex);
+    // capture has stopped, or restarted on another format, since
+    if (!m_pool || raw->pixelFormat != m_pixfmt || m_sensorBits) return;
+    ConvertJob job;
+    describeFrame(*raw.get(), scale, job);
+    if (!job.src) return;
+
+    QImage out = acquireOutputImage(job.width, job.height);
+    QImage none;
+    if (frame.timing.valid()) frame.timing.convertStartNs = monotonicNs();
+    convertFrame(job, m_pixelLuts.current(), out, none);
+    if (frame.timing.valid()) {
+        frame.timing.convertEndNs = monotonicNs();
+        m_stats->recordConversion(frame.timing);
+    }
+    frame.image = out;
+}
+
+void V4L2Camera::submitThumbnail(const QImage &thumb)
+{
+    HotSpotTracker *tracker = m_tracker.load(std::memory_order_acquire);
+    if (thumb.isNull() || !tracker) return;
+    VideoFrame frame;
+    frame.image = thumb;
+    tracker->submit(frame);
+}
+
+void V4L2Camera::setTracker(HotSpotTracker *tracker)
+{
+    m_tracker.store(tracker, std::memory_order_release);
+}
+
+void V4L2Camera::setRecorder(RawRecorder *recorder)
+{
+    m_recorder.store(recorder, std::memory_order_release);
+}
+
+void V4L2Camera::setHistory(FrameHistory *history)
+{
+    m_history.store(history, std::memory_order_release);
+}
+
+void V4L2Camera::setExporter(ShmExporter *exporter)
+{
+    m_exporter.store(exporter, std::memory_order_release);
+}
+
+// capture thread: the recorder, the history and the exporter copy the frame
+// out before it is converted or handed on
+void V4L2Camera::recordBuffer(const SourceBuffer &buf)
+{
+    RawRecorder *recorder = m_recorder.load(std::memory_order_acquire);
+    FrameHistory *history = m_history.load(std::memory_order_acquire);
+    ShmExporter *exporter = m_exporter.load(std::memory_order_acquire);
+    const bool recording = recorder && recorder->recording();
+    const bool keeping = history && !history->frozen();
+    const bool exporting = exporter && exporter->readers() > 0;
+    if (!recording && !keeping && !exporting) return;
+    RawFrame frame;
+    cropPlanes(buf, QRect(0, 0, m_width, m_height), frame);
+    const qint64 timestampNs = buf.timestampNs ? buf.timestampNs : monotonicNs();
+    if (recording) recorder->submit(frame, buf.sequence, timestampNs);
+    if (keeping) history->submit(frame, buf.sequence, timestampNs);
+    if (exporting) exporter->submit(frame, buf.sequence, timestampNs);
+}
+
+// capture thread: takes over the calibration last set from the GUI, if any
+void V4L2Camera::applyCalibration()
+{
+    std::unique_ptr<Calibration> calibration;
+    {
+        std::lock_guard<std::mutex> lock(m_configMutex);
+        calibration = std::move(m_pendingCalibration);
+    }
+    std::lock_guard<std::mutex> lock(m_convertMutex);
+    // a capture of offsets in progress was for the calibration it replaces
+    if (m_flatField.running()) {
+        m_flatField.cancel();
+        m_flatFieldRunning = false;
+        emit calibrationChanged();
+    }
+    m_calibration = std::move(calibration);
+    if (m_calibrationModified.exchange(false)) emit calibrationChanged();
+    checkCalibration();
+}
+
+// capture thread, under m_convertMutex: whether m_calibration fits the stream
+void V4L2Camera::checkCalibration()
+{
+    bool usable = false;
+    if (m_calibration) {
+        if (!m_sensorBits) {
+            qWarning() << "Calibration ignored: only radiometric (Y10..Y16) input is corrected";
+        } else if (m_calibration->width() != m_width || m_calibration->height() != m_height) {
+            emit errorOccurred(QString("Calibration is for %1x%2 frames, the sensor gives %3x%4")
+                               .arg(m_calibration->width()).arg(m_calibration->height())
+                               .arg(m_width).arg(m_height));
         } else {
-            // fallback -> grayscale from first plane
-            if (!yPlane && m_buffers[idx].starts.size() > 0) {
-                yPlane = static_cast<const unsigned char*>(m_buffers[idx].starts[0]);
-            }
-            if (yPlane) {
-                for (int row = 0; row < m_height; ++row) {
-                    uchar *dst = out.scanLine(row);
-                    int yRow = row * m_width;
-                    for (int col = 0; col < m_width; ++col) {
-                        int y = yPlane[yRow + col];
-                        dst[col*3 + 0] = y;
-                        dst[col*3 + 1] = y;
-                        dst[col*3 + 2] = y;
-                    }
-                }
-            }
+            usable = true;
         }
+    }
+    if (m_calibrated.exchange(usable, std::memory_order_relaxed) != usable) emit calibrationChanged();
+}
 
-        emit frameReady(out);
+namespace {
+struct CorrectJob {
+    const Calibration *calibration;
+    const uint16_t *src; // whole sensor frame
+    int srcStride;       // in pixels
+    QRect rect;
+    int maxValue;
+    uint16_t *dst;       // rect.width() pixels per row
+};
 
-        // requeue
-        buf.m.planes = planes;
-        buf.length = planes_count;
-        if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1) {
-            emit errorOccurred(QString("VIDIOC_QBUF (requeue mplane) failed: %1").arg(strerror(errno)));
-            return false;
-        }
-        return true;
-    } else {
-        // single-planar path
-        v4l2_buffer buf;
-        memset(&buf,0,sizeof(buf));
-        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-        buf.memory = V4L2_MEMORY_MMAP;
-
-        if (xioctl(m_fd, VIDIOC_DQBUF, &buf) == -1) {
-            if (errno == EAGAIN) return false;
-            emit errorOccurred(QString("VIDIOC_DQBUF failed: %1").arg(strerror(errno)));
-            return false;
-        }
+struct FlatFieldJob {
+    FlatField *flatField;
+    const uint16_t *src;
+    int srcStride;
+};
+}
 
-        int idx = buf.index;
-        if ((size_t)idx >= m_buffers.size()) {
-            if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1) {
-                emit errorOccurred(QString("VIDIOC_QBUF (requeue invalid idx) failed: %1").arg(strerror(errno)));
-            }
-            return false;
-        }
+void V4L2Camera::correctRows(void *ctx, int rowBegin, int rowEnd)
+{
+    const CorrectJob &job = *static_cast<const CorrectJob*>(ctx);
+    job.calibration->correctRows(job.src, job.srcStride, job.rect, job.maxValue,
+                                 job.dst + (size_t)rowBegin * job.rect.width(), job.rect.width(),
+                                 rowBegin, rowEnd);
+}
 
-        const unsigned char *data = static_cast<const unsigned char*>(m_buffers[idx].starts[0]);
-
-        QImage out(m_width, m_height, QImage::Format_RGB888);
-
-        if (m_pixfmt == V4L2_PIX_FMT_NV12 || m_pixfmt == V4L2_PIX_FMT_NV21) {
-            const unsigned char *yPlane = data;
-            const unsigned char *uvPlane = data + (m_width * m_height);
-            bool isNV21 = (m_pixfmt == V4L2_PIX_FMT_NV21);
-
-            for (int row = 0; row < m_height; ++row) {
-                uchar *dst = out.scanLine(row);
-                const int yRow = row * m_width;
-                const int uvRow = (row / 2) * m_width;
-                for (int col = 0; col < m_width; ++col) {
-                    int y = yPlane[yRow + col];
-                    int uvIndex = uvRow + (col & ~1);
-                    int u = uvPlane[uvIndex + (isNV21 ? 1 : 0)];
-                    int v = uvPlane[uvIndex + (isNV21 ? 0 : 1)];
-                    uchar r,g,b;
-                    yuvToRgbPixel(y,u,v,r,g,b);
-                    dst[col*3 + 0] = r;
-                    dst[col*3 + 1] = g;
-                    dst[col*3 + 2] = b;
-                }
-            }
-        } else if (m_pixfmt == V4L2_PIX_FMT_UYVY || m_pixfmt == V4L2_PIX_FMT_YUYV) {
-            const unsigned char *p = data;
-            for (int row = 0; row < m_height; ++row) {
-                const unsigned char *rowPtr = p + row * m_width * 2;
-                uchar *dst = out.scanLine(row);
-                for (int col = 0; col < m_width; col += 2) {
-                    int A = rowPtr[(col/2)*4 + 0];
-                    int B = rowPtr[(col/2)*4 + 1];
-                    int C = rowPtr[(col/2)*4 + 2];
-                    int D = rowPtr[(col/2)*4 + 3];
-                    int U, Y0, V, Y1;
-                    if (m_pixfmt == V4L2_PIX_FMT_UYVY) {
-                        U = A; Y0 = B; V = C; Y1 = D;
-                    } else { // YUYV
-                        Y0 = A; U = B; Y1 = C; V = D;
-                    }
-                    uchar r,g,b;
-                    yuvToRgbPixel(Y0, U, V, r, g, b);
-                    dst[col*3 + 0] = r; dst[col*3 + 1] = g; dst[col*3 + 2] = b;
-                    yuvToRgbPixel(Y1, U, V, r, g, b);
-                    dst[(col+1)*3 + 0] = r; dst[(col+1)*3 + 1] = g; dst[(col+1)*3 + 2] = b;
-                }
-            }
+void V4L2Camera::flatFieldRows(void *ctx, int rowBegin, int rowEnd)
+{
+    const FlatFieldJob &job = *static_cast<const FlatFieldJob*>(ctx);
+    job.flatField->accumulateRows(job.src, job.srcStride, rowBegin, rowEnd);
+}
+
+// capture thread, under m_convertMutex: the crop of buf through the
+// calibration into m_corrected, band-parallel, which job then converts in
+// place of the buffer. The box filter, sharpening and the AGC all see
+// corrected words that way.
+void V4L2Camera::correctFrame(const SourceBuffer &buf, ConvertJob &job)
+{
+    const QRect &rect = m_cropRect;
+    const size_t pixels = (size_t)rect.width() * rect.height();
+    if (m_corrected.size() < pixels) m_corrected.resize(pixels);
+    CorrectJob correct;
+    correct.calibration = m_calibration.get();
+    correct.src = reinterpret_cast<const uint16_t*>(buf.planes[0]);
+    correct.srcStride = buf.bytesPerLine[0] / 2;
+    correct.rect = rect;
+    correct.maxValue = (1 << m_sensorBits) - 1;
+    correct.dst = m_corrected.data();
+    m_pool->run(rect.height(), 1, &V4L2Camera::correctRows, &correct);
+    // dead pixels read corrected neighbours, so after every band is done
+    m_calibration->replaceDeadPixels(correct.src, correct.srcStride, rect, correct.maxValue,
+                                     correct.dst, rect.width());
+    job.src = reinterpret_cast<const unsigned char*>(m_corrected.data());
+    job.srcStride = rect.width() * 2;
+}
+
+// capture thread: adds the whole sensor frame to a flat field being captured,
+// and swaps the new offsets in after its last frame
+void V4L2Camera::accumulateFlatField(const SourceBuffer &buf)
+{
+    const int frames = m_flatFieldRequest.exchange(0, std::memory_order_relaxed);
+    if (frames) {
+        if (!m_sensorBits) {
+            emit errorOccurred("Flat field: only radiometric (Y10..Y16) input is calibrated");
         } else {
-            // fallback grayscale
-            const unsigned char *yPlane = data;
-            for (int row = 0; row < m_height; ++row) {
-                uchar *dst = out.scanLine(row);
-                for (int col = 0; col < m_width; ++col) {
-                    uchar y = yPlane[row * m_width + col];
-                    dst[col*3 + 0] = y;
-                    dst[col*3 + 1] = y;
-                    dst[col*3 + 2] = y;
-                }
-            }
+            m_flatField.begin(m_width, m_height, frames);
+            m_flatFieldRunning = true;
+            emit calibrationChanged();
         }
+    }
+    if (!m_flatField.running() || !buf.planeCount) return;
 
-        emit frameReady(out);
+    std::lock_guard<std::mutex> lock(m_convertMutex);
+    FlatFieldJob job = { &m_flatField, reinterpret_cast<const uint16_t*>(buf.planes[0]), buf.bytesPerLine[0] / 2 };
+    m_pool->run(m_height, 1, &V4L2Camera::flatFieldRows, &job);
+    if (!m_flatField.frameDone()) return;
 
-        if (xioctl(m_fd, VIDIOC_QBUF, &buf) == -1) {
-            emit errorOccurred(QString("VIDIOC_QBUF(requeue) failed: %1").arg(strerror(errno)));
-            return false;
-        }
-        return true;
+    // gains from a calibration for another sensor are no use here
+    if (!m_calibration || m_calibration->width() != m_width || m_calibration->height() != m_height) {
+        m_calibration.reset(new Calibration(m_width, m_height));
     }
+    m_calibration->setOffsets(m_flatField.takeOffsets(*m_calibration));
+    // calibrationFile() no longer holds what is applied
+    m_calibrationModified = true;
+    qDebug() << "Flat field: new offsets for" << m_width << "x" << m_height;
+    m_flatFieldRunning = false;
+    checkCalibration();
+    emit calibrationChanged();
 }
@@ -4,58 +4,459 @@
 #include <QImage>
 #include <QString>
 #include <QMutex>
+#include <QRect>
+#include <QVariantMap>
 #include <vector>
 #include <atomic>
+#include <memory>
+#include <mutex>
+
+#include "yuvkernels.h"
+#include "workerpool.h"
+#include "framepool.h"
+#include "framemailbox.h"
+#include "videoframe.h"
+#include "toneadjust.h"
+#include "agc.h"
+#include "framesource.h"
+#include "boxscale.h"
+#include "denoise.h"
+#include "calibration.h"
+
+struct Palette;
+class HotSpotTracker;
+class RawRecorder;
+class FrameHistory;
+class ShmExporter;
+class FrameStats;
+
+// Gets every frame capture publishes, for analytics that must not miss any:
+// while one is registered nothing is left to lazy conversion.
+class FrameListener
+{
+public:
+    virtual ~FrameListener() {}
+    // capture thread; the converted image, or the raw buffer under
+    // setRawOutput(). Every frame held on to keeps a pooled buffer out.
+    virtual void frameCaptured(const VideoFrame &frame) = 0;
+};
 
 class V4L2Camera : public QThread
 {
     Q_OBJECT
+    // thermal palette by menu id ("white_hot", "iron", ...); empty for the
+    // plain colour conversion
+    Q_PROPERTY(QString palette READ palette WRITE setPalette NOTIFY paletteChanged)
+    // point operations of the "Контраст" and "Кадр" menus, see ToneSettings
+    Q_PROPERTY(bool negative READ negative WRITE setNegative NOTIFY adjustmentsChanged)
+    Q_PROPERTY(double contrast READ contrast WRITE setContrast NOTIFY adjustmentsChanged)
+    Q_PROPERTY(int brightness READ brightness WRITE setBrightness NOTIFY adjustmentsChanged)
+    Q_PROPERTY(double gamma READ gamma WRITE setGamma NOTIFY adjustmentsChanged)
+    // where brightness, contrast and gamma are applied: "sensor" or "software"
+    Q_PROPERTY(QVariantMap adjustmentPaths READ adjustmentPaths NOTIFY adjustmentPathsChanged)
+    // unsharp mask on luma: strength 0 (off) .. 4, radius 1 (3x3) or 2 (5x5)
+    Q_PROPERTY(double sharpen READ sharpen WRITE setSharpen NOTIFY sharpenChanged)
+    Q_PROPERTY(int sharpenRadius READ sharpenRadius WRITE setSharpenRadius NOTIFY sharpenChanged)
+    // temporal noise reduction on luma: strength 0 (off) .. 1, and the mean
+    // luma difference per 8x8 block above which it backs off as motion
+    Q_PROPERTY(double denoise READ denoise WRITE setDenoise NOTIFY denoiseChanged)
+    Q_PROPERTY(int denoiseThreshold READ denoiseThreshold WRITE setDenoiseThreshold NOTIFY denoiseChanged)
+    // non-uniformity correction of radiometric input: the calibration file
+    // ("" for none), whether a calibration is being applied, whether its
+    // offsets have since been replaced by a flat field, and whether a flat
+    // field is being captured
+    Q_PROPERTY(QString calibrationFile READ calibrationFile WRITE setCalibrationFile NOTIFY calibrationChanged)
+    Q_PROPERTY(bool calibrated READ calibrated NOTIFY calibrationChanged)
+    Q_PROPERTY(bool calibrationModified READ calibrationModified NOTIFY calibrationChanged)
+    Q_PROPERTY(bool flatFieldRunning READ flatFieldRunning NOTIFY calibrationChanged)
+    // how 10..16-bit radiometric frames are brought down to 8 bits
+    Q_PROPERTY(AgcMode agcMode READ agcMode WRITE setAgcMode NOTIFY agcModeChanged)
+    // per-stage latency, fps and drop counters; off until enabled
+    Q_PROPERTY(FrameStats *stats READ stats CONSTANT)
 public:
+    enum AgcMode { AgcLinear = Agc::Linear, AgcPlateau = Agc::Plateau };
+    Q_ENUM(AgcMode)
+
     explicit V4L2Camera(const QString &device = "/dev/video0", int width = 1280, int height = 720, QObject *parent = nullptr);
     ~V4L2Camera() override;
 
     void stopCapture();
 
+    // Replaces the V4L2 device given to the constructor, e.g. with a
+    // ReplaySource; takes ownership. Only while capture is not running.
+    void setSource(FrameSource *source);
+    // where frames come from: a V4L2Source on the device given to the
+    // constructor unless replaced. Configure it only while capture is not
+    // running.
+    FrameSource *source() const { return m_source.get(); }
+
+    // band-parallel conversion; applied right away when capture is running
+    void setConversionThreads(int threads);
+    void setConversionCpus(const std::vector<int> &cpus);
+    int conversionThreads() const;
+
+    // SCHED_FIFO priority (1..99, 0 keeps the default policy) and CPU
+    // (-1 for any) of the capture thread; takes effect on the next start()
+    void setCaptureScheduling(int fifoPriority, int cpu);
+
+    // number of preallocated output frames; takes effect on the next start()
+    void setFramePoolSize(int buffers);
+    int framePoolSize() const { return m_framePoolSize; }
+    // how often capture found every pooled frame still in use
+    quint64 framePoolExhaustedCount() const { return m_framePoolExhausted; }
+
     int width() const { return m_width; }
     int height() const { return m_height; }
     QString deviceName() const { return m_device; }
 
+    // Region of interest in normalized frame coordinates, e.g. a digital
+    // zoom. Only its pixels are converted and published, and the AGC and
+    // the tracker see nothing else; an empty rect is the whole frame.
+    // aspect > 0 trims the region around its centre to that width/height
+    // ratio, so a view that crops to fill itself gets just what it shows.
+    // Any thread; capture switches over on its next frame.
+    void setCrop(const QRectF &crop, qreal aspect = 0);
+    QRectF crop() const;
+
+    // Frames need be no larger than size, in pixels (e.g. the view's size
+    // times its device pixel ratio): the crop is box-filtered down by the
+    // largest integer factor, up to MaxBoxFactor, that keeps it at least
+    // that big, inside the colour conversion. An empty size converts at full
+    // resolution, as does sharpening; raw frames are never scaled. Any
+    // thread; capture switches over on its next frame.
+    void setOutputSize(const QSize &size);
+    QSize outputSize() const;
+
+    // newest converted frame; the display side is its single consumer
+    FrameMailbox *mailbox() { return &m_mailbox; }
+    // frames replaced in the mailbox before the display picked them up
+    quint64 droppedFrames() const { return m_mailbox.droppedCount(); }
+
+    // frames carry FrameTiming stamps while stats()->enabled(); the display
+    // side records its part through the same object
+    FrameStats *stats() const { return m_stats; }
+
+    // Publish NV12/NV21/UYVY/YUYV frames as raw driver buffers instead of
+    // converting them, for consumers that convert on the GPU. Other formats
+    // are still converted. Safe to toggle from any thread.
+    void setRawOutput(bool enabled) { m_rawOutput = enabled; }
+    bool rawOutput() const { return m_rawOutput; }
+
+    // Lazy conversion: capture publishes the newest driver buffer as it is
+    // and the display converts it with convertDeferred() when it is about to
+    // show it, so frames that are never shown (hidden window, display slower
+    // than the sensor) cost a DQBUF/QBUF and the tracker thumbnail. The
+    // buffer is out of the driver's queue while it waits in the mailbox.
+    // Radiometric input, whose AGC learns from every frame, denoising, which
+    // filters every frame, and capture with frame listeners are still
+    // converted up front. Any thread.
+    void setLazyConversion(bool enabled) { m_lazy = enabled; }
+    bool lazyConversion() const { return m_lazy; }
+    // display side, with a frame taken from mailbox(): converts a deferred
+    // frame in place; it comes back null when its stream has ended
+    void convertDeferred(VideoFrame &frame);
+
+    // Registered listeners get every published frame; any thread. Removal
+    // waits for a call in progress, after it listener may be destroyed.
+    void addFrameListener(FrameListener *listener);
+    void removeFrameListener(FrameListener *listener);
+
+    // Feed luma thumbnails of every frame to tracker while it is enabled;
+    // nullptr detaches it. The tracker must outlive capture.
+    void setTracker(HotSpotTracker *tracker);
+
+    // Hand every dequeued buffer, the whole sensor frame whatever the crop,
+    // to recorder while it is recording; nullptr detaches it. The recorder
+    // must outlive capture.
+    void setRecorder(RawRecorder *recorder);
+    // Keep every dequeued frame in history, and show its pinned frame
+    // instead of live ones while it is frozen; nullptr detaches it. The
+    // history must outlive capture.
+    void setHistory(FrameHistory *history);
+    // Publish every dequeued frame, the whole sensor frame, through exporter
+    // while it has readers; nullptr detaches it. The exporter must outlive
+    // capture.
+    void setExporter(ShmExporter *exporter);
+
+    // Palette and adjustments are set from the GUI thread; capture picks the
+    // new tables up on its next frame without taking a lock. While any of
+    // them is active, frames are always converted on the CPU and raw output
+    // is suspended.
+    QString palette() const { return m_paletteName; }
+    void setPalette(const QString &name);
+
+    bool negative() const { return m_tone.negative; }
+    void setNegative(bool negative);
+    double contrast() const { return m_tone.contrast; }
+    void setContrast(double contrast);
+    int brightness() const { return m_tone.brightness; }
+    void setBrightness(int brightness);
+    double gamma() const { return m_tone.gamma; }
+    void setGamma(double gamma);
+    // Brightness, contrast and gamma go to the sensor's own controls when
+    // the source has them, and into the conversion tables only where it
+    // does not (or a control was refused). Radiometric input keeps them in
+    // software: the AGC would undo anything the sensor did first.
+    QVariantMap adjustmentPaths() const;
+
+    // sharpening runs inside the conversion bands; strength 0 skips it entirely
+    double sharpen() const { return m_sharpenStrength; }
+    void setSharpen(double strength);
+    int sharpenRadius() const { return m_sharpenRadius; }
+    void setSharpenRadius(int radius);
+
+    // Noise reduction filters every converted frame against the previous
+    // ones inside the conversion bands, at the output size; it keeps frames
+    // on the CPU path like sharpening does. Strength 0 skips it entirely.
+    double denoise() const { return m_denoiseStrength; }
+    void setDenoise(double strength);
+    int denoiseThreshold() const { return m_denoiseThreshold; }
+    void setDenoiseThreshold(int threshold);
+
+    // Gains, offsets and dead pixels of Y10..Y16 input are corrected ahead of
+    // the AGC while a calibration file for the sensor's size is loaded (see
+    // calibration.h); an empty path turns correction off. Raw recording,
+    // the history and the exporter keep getting uncorrected frames. GUI
+    // thread; capture switches over on its next frame.
+    QString calibrationFile() const { return m_calibrationFile; }
+    void setCalibrationFile(const QString &path);
+    bool calibrated() const { return m_calibrated.load(std::memory_order_relaxed); }
+    // Averages the next frames, which should all see the same uniform scene
+    // (lens cap, shutter), into new offsets for the calibration in use, or
+    // for unity gains without one. Frames keep streaming meanwhile. Any thread.
+    // The new offsets live in memory only: calibrationModified() is true
+    // from then on, until saveCalibration() persists them or another file
+    // (or the same one again) is loaded.
+    Q_INVOKABLE void captureFlatField(int frames = 32);
+    bool flatFieldRunning() const { return m_flatFieldRunning.load(std::memory_order_relaxed); }
+    bool calibrationModified() const { return m_calibrationModified.load(std::memory_order_relaxed); }
+    // writes the calibration in use, flat-field offsets included; path then
+    // becomes calibrationFile()
+    Q_INVOKABLE bool saveCalibration(const QString &path);
+
+    // Y10/Y12/Y14/Y16 input only; the histogram of each frame sets the gain
+    // of the next one
+    AgcMode agcMode() const { return (AgcMode)m_agcMode.load(std::memory_order_relaxed); }
+    void setAgcMode(AgcMode mode);
+
 signals:
-    void frameReady(const QImage &img);
+    // a new frame is waiting in mailbox(); not re-emitted until the consumer
+    // calls FrameMailbox::acknowledge()
+    void frameAvailable();
     void errorOccurred(const QString &message);
+    void paletteChanged();
+    void adjustmentsChanged();
+    void sharpenChanged();
+    void denoiseChanged();
+    void calibrationChanged();
+    void agcModeChanged();
+    void adjustmentPathsChanged();
 
 protected:
     void run() override;
 
+private slots:
+    // queued from capture when the source's controls change
+    void updatePixelLut();
+
 private:
-    bool openDevice();
-    void closeDevice();
-    bool queryCaps();
-    bool trySetFormatSingle(uint32_t pixfmt);
-    bool trySetFormatMPlane(uint32_t pixfmt);
-    bool initFormat();
-    bool initMmap();
-    void uninitMmap();
-    bool startStreaming();
-    void stopStreaming();
-    bool readOneFrame();
+    // describes how to turn one mapped buffer into RGB rows
+    struct ConvertJob {
+        // the *Lut kinds map luma through a palette, chroma is ignored
+        enum Kind { SemiPlanar, Packed, Grey, PlanarLut, PackedLut } kind{Grey};
+        const unsigned char *src{nullptr}; // luma plane, or the packed 4:2:2 plane
+        const unsigned char *uv{nullptr};  // interleaved chroma plane (semi-planar only)
+        int srcStride{0}; // bytes from one src row to the next, padding included
+        int uvStride{0};
+        int scale{1}; // box factor: every output pixel averages scale x scale source pixels
+        void (*semiPlanarRow)(const uint8_t*, const uint8_t*, uint8_t*, int){nullptr};
+        void (*packedRow)(const uint8_t*, uint8_t*, int){nullptr};
+        void (*greyRow)(const uint8_t*, uint8_t*, int){nullptr};
+        const uint32_t *lut{nullptr};     // luma -> RGBX (*Lut kinds)
+        const uint8_t *curve{nullptr};    // luma -> luma before colour conversion, or null
+        int lumaOffset{0}; // luma byte within a packed pixel
+        int sharpenAmount{0}; // LumaSharpener amount, 0 = off
+        int sharpenRadius{1};
+        // temporal filter over strips of its BlockSize rows, or null
+        TemporalDenoiser *denoiser{nullptr};
+        // radiometric input: src as 16-bit words, brought to 8-bit luma by the AGC
+        const uint16_t *src16{nullptr};
+        Agc *agc{nullptr};
+        int bandRows{0}; // band index = rowBegin / bandRows, for its histogram
+        bool agcLearns{true}; // false: the histogram is dropped (a held frame)
+        // max-pooled luma thumbnail for the tracker, or null; dst is null
+        // when only the thumbnail is wanted
+        uchar *thumb{nullptr};
+        int thumbStride{0};
+        int thumbWidth{0};
+        int thumbHeight{0};
+        uchar *dst{nullptr};
+        int dstStride{0};
+        int width{0};
+        int height{0};
+    };
+    void applyCaptureScheduling();
+    void createWorkerPool();
+    QRect cropPixels() const;
+    void applyLayout();
+    QImage acquireOutputImage(int width, int height);
+    void publishFrame(VideoFrame &frame);
+    bool rawOutputSupported() const;
+    bool publishRawFrame(const SourceBuffer &buf, int deferredScale, const FrameTiming &timing);
+    static void convertRows(void *ctx, int rowBegin, int rowEnd);
+    static void convertRowsScaled(const ConvertJob &job, int rowBegin, int rowEnd);
+    static void thumbnailRow(const ConvertJob &job, int row, const uchar *src, const uchar *luma);
+    // consecutive rows whose source and prepared luma (null: read it from
+    // src) are ready; one, or a strip of BlockSize while denoising
+    struct RowStrip {
+        const uchar *src[TemporalDenoiser::BlockSize];
+        const uchar *uv[TemporalDenoiser::BlockSize];
+        const uchar *luma[TemporalDenoiser::BlockSize];
+    };
+    static void finishRows(const ConvertJob &job, int firstRow, int count, const RowStrip &rows,
+                           uint8_t *packedScratch);
+    static void convertRow(const ConvertJob &job, const uchar *src, const uchar *uv, const uchar *luma,
+                           uchar *dst, uint8_t *packedScratch);
+    void convertFrame(ConvertJob &job, const PixelLut &pointOps, QImage &out, QImage &thumb);
+    void cropPlanes(const SourceBuffer &buf, const QRect &rect, RawFrame &raw) const;
+    void describeFrame(const RawFrame &raw, int scale, ConvertJob &job) const;
+    // false when the buffer was handed on as a raw frame instead of converted
+    bool processBuffer(const SourceBuffer &buf, FrameTiming &timing);
+    void processFrozen(const SourceBuffer &live, const SourceBuffer &pinned, FrameTiming &timing);
+    void learnAgc(const ConvertJob &job);
+    static void agcHistogramRows(void *ctx, int rowBegin, int rowEnd);
+    void recordBuffer(const SourceBuffer &buf);
+    QImage acquireThumbnail();
+    void submitThumbnail(const QImage &thumb);
+    void applyControls();
+    void setSourceControls(int controls);
+    void updateSharpen();
+    bool sharpening() const { return m_sharpen.load(std::memory_order_relaxed) != 0; }
+    void updateDenoise();
+    bool denoising() const { return m_denoise.load(std::memory_order_relaxed) != 0; }
+    void applyCalibration();
+    void checkCalibration();
+    void correctFrame(const SourceBuffer &buf, ConvertJob &job);
+    void accumulateFlatField(const SourceBuffer &buf);
+    static void correctRows(void *ctx, int rowBegin, int rowEnd);
+    static void flatFieldRows(void *ctx, int rowBegin, int rowEnd);
 
     QString m_device;
     int m_width;
     int m_height;
-    int m_fd{-1};
     std::atomic<bool> m_running{false};
 
-    // If the device is multplane, we set this true and use VIDEO_CAPTURE_MPLANE ioctls
-    bool m_is_mplane{false};
-    int m_num_planes{0};
     uint32_t m_pixfmt{0};
+    int m_sensorBits{0}; // 10..16 for radiometric grey formats, 0 otherwise
+
+    // per-row YUV->RGB kernels, best available for this CPU
+    const YuvRowKernels *m_kernels;
+
+    // device I/O; buffers are dequeued and requeued on the capture thread
+    std::unique_ptr<FrameSource> m_source;
+
+    // conversion workers, alive while capturing
+    mutable std::mutex m_configMutex; // m_convThreads, m_convCpus, m_crop, m_cropAspect, m_outputSize
+    int m_convThreads{1};
+    std::vector<int> m_convCpus;
+    std::atomic<bool> m_reconfigure{false}; // rebuild m_pool before the next frame
+    std::unique_ptr<WorkerPool> m_pool;
+
+    // capture thread scheduling
+    int m_captureFifo{0};
+    int m_captureCpu{-1};
 
-    struct Buffer {
-        // for single-planar: starts.size()==1, lengths[0] valid
-        // for multplane: starts.size()==m_num_planes
-        std::vector<void*> starts;
-        std::vector<size_t> lengths;
+    // requested region of interest and output size; capture turns them
+    // into the pixels it converts and the box factor it scales them by
+    QRectF m_crop;
+    qreal m_cropAspect{0};
+    QSize m_outputSize;
+    std::atomic<bool> m_layoutChanged{false};
+    QRect m_cropRect; // capture thread only
+    int m_scale{1};   // capture thread only
+
+    // recycled RGB output frames of the output size, alive while capturing
+    int m_framePoolSize{4};
+    std::unique_ptr<FramePool> m_framePool;
+    std::atomic<quint64> m_framePoolExhausted{0};
+
+    // tracker thumbnails, alive while capturing
+    std::atomic<HotSpotTracker*> m_tracker{nullptr};
+    std::unique_ptr<FramePool> m_thumbPool;
+
+    std::atomic<RawRecorder*> m_recorder{nullptr};
+    std::atomic<FrameHistory*> m_history{nullptr};
+    std::atomic<ShmExporter*> m_exporter{nullptr};
+
+    // capture thread only: the pinned frame's conversion, shown again until
+    // the pin, the layout or the settings it was made with change
+    struct FrozenFrame {
+        QImage image;
+        const uchar *data{nullptr};
+        uint32_t sequence{0};
+        qint64 timestampNs{0};
+        QRect rect;
+        int scale{0};
+        unsigned pointOps{0}; // m_pixelLuts generation
+        int sharpen{0};
+        int denoise{0};
+        int agcMode{0};
+        bool calibrated{false};
     };
-    std::vector<Buffer> m_buffers;
+    FrozenFrame m_frozen;
+
+    FrameMailbox m_mailbox;
+    FrameStats *m_stats;
+
+    std::atomic<bool> m_rawOutput{false};
+    std::atomic<bool> m_lazy{false};
+
+    // Conversion runs on the capture thread, and with lazy conversion on the
+    // render thread too: this serializes it and guards everything it uses
+    // that capture changes mid-stream (m_pool, the layout and output pools,
+    // m_pixelLuts' reader side).
+    std::mutex m_convertMutex;
+
+    std::mutex m_listenerMutex; // m_listeners, held while they are called
+    std::vector<FrameListener*> m_listeners;
+    std::atomic<int> m_listenerCount{0};
+
+    // GUI-side settings; every change rebuilds a PixelLut and publishes it
+    QString m_paletteName;
+    const Palette *m_paletteTable{nullptr};
+    ToneSettings m_tone;
+    PixelLutExchange m_pixelLuts;
+    // controls of the running source (bits of FrameSource::Control), set by
+    // capture; the GUI thread splits the settings between them and the tables
+    std::atomic<int> m_sourceControls{0};
+    int m_hardwareTone{0}; // GUI thread: settings currently done by the source
+    int m_controlMask{0};  // m_configMutex: controls capture is to set, and to what
+    double m_controlValues[FrameSource::ControlCount] = {};
+    std::atomic<bool> m_controlsChanged{false};
+    double m_sharpenStrength{0.0};
+    int m_sharpenRadius{1};
+    std::atomic<int> m_sharpen{0}; // amount | radius << 8, 0 = off
+    double m_denoiseStrength{0.0};
+    int m_denoiseThreshold{4};
+    std::atomic<int> m_denoise{0}; // strength | threshold << 8, 0 = off
+    std::atomic<bool> m_denoiseRestart{false}; // turned on since the last filtered frame
+    // the accumulator, under m_convertMutex
+    TemporalDenoiser m_denoiser;
+
+    QString m_calibrationFile; // GUI thread
+    std::unique_ptr<Calibration> m_pendingCalibration; // m_configMutex
+    std::atomic<bool> m_calibrationChanged{false};
+    // under m_convertMutex: the calibration in use and the corrected crop
+    // that conversion reads in place of the buffer
+    std::unique_ptr<Calibration> m_calibration;
+    std::vector<uint16_t> m_corrected;
+    std::atomic<bool> m_calibrated{false};
+    std::atomic<bool> m_calibrationModified{false}; // set and cleared under m_convertMutex
+    FlatField m_flatField; // capture thread only
+    std::atomic<int> m_flatFieldRequest{0}; // frames to average, 0 = none
+    std::atomic<bool> m_flatFieldRunning{false};
+
+    // capture thread only, set up per stream
+    Agc m_agc;
+    std::atomic<int> m_agcMode{AgcPlateau};
 };
@@ -0,0 +1,851 @@
+#include "v4l2source.h"
+#include <linux/videodev2.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cstring>
+#include <errno.h>
+#include <cstdlib>
+#include <cmath>
+#include <QDebug>
+#include <QStringList>
+
+// helper ioctl loop
+static int xioctl(int fd, unsigned long request, void *arg)
+{
+    int r;
+    do {
+        r = ioctl(fd, request, arg);
+    } while (r == -1 && errno == EINTR);
+    return r;
+}
+
+// bytes per pixel of the first plane; 0 for formats we do not convert
+static int lumaBytesPerPixel(uint32_t pixfmt)
+{
+    switch (pixfmt) {
+    case V4L2_PIX_FMT_NV12:
+    case V4L2_PIX_FMT_NV21:
+    case V4L2_PIX_FMT_GREY:
+        return 1;
+    default:
+        return 2;
+    }
+}
+
+static bool isSemiPlanar(uint32_t pixfmt)
+{
+    return pixfmt == V4L2_PIX_FMT_NV12 || pixfmt == V4L2_PIX_FMT_NV21;
+}
+
+void V4L2Source::takePlaneLayout(const v4l2_format &fmt)
+{
+    m_planeSizes.clear();
+    m_bytesPerLine.clear();
+    if (m_is_mplane) {
+        const int n = qBound(1, (int)fmt.fmt.pix_mp.num_planes, (int)VIDEO_MAX_PLANES);
+        for (int p = 0; p < n; ++p) {
+            m_planeSizes.push_back(fmt.fmt.pix_mp.plane_fmt[p].sizeimage);
+            m_bytesPerLine.push_back(fmt.fmt.pix_mp.plane_fmt[p].bytesperline);
+        }
+    } else {
+        m_planeSizes.push_back(fmt.fmt.pix.sizeimage);
+        m_bytesPerLine.push_back(fmt.fmt.pix.bytesperline);
+    }
+    while ((int)m_bytesPerLine.size() < m_num_planes) m_bytesPerLine.push_back(0);
+    // 0 means the driver leaves it to us: tightly packed rows
+    for (size_t p = 0; p < m_bytesPerLine.size(); ++p) {
+        const int tight = (p == 0) ? m_width * lumaBytesPerPixel(m_pixfmt) : m_width;
+        if (m_bytesPerLine[p] < tight) m_bytesPerLine[p] = tight;
+    }
+    // a contiguous semi-planar buffer: the chroma plane shares the luma stride
+    if (isSemiPlanar(m_pixfmt) && m_bytesPerLine.size() == 1) {
+        m_bytesPerLine.push_back(m_bytesPerLine[0]);
+    }
+}
+
+// false when a buffer cannot hold a frame of the negotiated layout
+bool V4L2Source::checkBufferSizes(QString &error) const
+{
+    const Buffer &b = m_mapped->buffers[0];
+    for (size_t p = 0; p < b.lengths.size() && p < m_bytesPerLine.size(); ++p) {
+        size_t needed = (size_t)m_bytesPerLine[p] * m_height;
+        if (isSemiPlanar(m_pixfmt)) {
+            // a separate chroma plane has half the rows, a contiguous one follows the luma
+            if (p == 1) needed /= 2;
+            else if (b.lengths.size() == 1) needed += (size_t)m_bytesPerLine[1] * (m_height / 2);
+        }
+        if (b.lengths[p] < needed) {
+            error = QString("%1: plane %2 buffers hold %3 bytes, the format needs %4")
+                        .arg(m_device).arg(p).arg(b.lengths[p]).arg(needed);
+            return false;
+        }
+    }
+    return true;
+}
+
+V4L2Source::MappedBuffers::MappedBuffers(int fd, bool mplane, bool userPtr, int numPlanes, uint32_t count)
+    : fd(fd), mplane(mplane), userPtr(userPtr), numPlanes(numPlanes)
+{
+    buffers.resize(count);
+    rawFrames.reset(new RawFrame[count]);
+    for (uint32_t i = 0; i < count; ++i) {
+        rawFrames[i].release = &MappedBuffers::releaseRawFrame;
+        rawFrames[i].owner = this;
+        rawFrames[i].index = i;
+    }
+}
+
+V4L2Source::MappedBuffers::~MappedBuffers()
+{
+    for (auto &b : buffers) {
+        for (int dmabuf : b.dmabufFds) {
+            if (dmabuf >= 0) ::close(dmabuf);
+        }
+        for (size_t p = 0; p < b.starts.size(); ++p) {
+            if (userPtr) {
+                free(b.starts[p]);
+            } else if (b.starts[p] && b.starts[p] != MAP_FAILED && b.lengths[p]) {
+                munmap(b.starts[p], b.lengths[p]);
+            }
+        }
+    }
+}
+
+// queue buffer index back to the driver
+bool V4L2Source::MappedBuffers::queue(uint32_t index)
+{
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    v4l2_plane planes[VIDEO_MAX_PLANES];
+    memset(planes, 0, sizeof(planes));
+    buf.type = mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = userPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if (mplane) {
+        buf.m.planes = planes;
+        buf.length = numPlanes;
+    }
+    if (userPtr) {
+        // the driver is told again where to write, every time
+        if (index >= buffers.size()) {
+            errno = EINVAL;
+            return false;
+        }
+        const Buffer &b = buffers[index];
+        if (mplane) {
+            for (int p = 0; p < numPlanes; ++p) {
+                planes[p].m.userptr = (unsigned long)b.starts[p];
+                planes[p].length = b.lengths[p];
+            }
+        } else {
+            buf.m.userptr = (unsigned long)b.starts[0];
+            buf.length = b.lengths[0];
+        }
+    }
+    return xioctl(fd, VIDIOC_QBUF, &buf) != -1;
+}
+
+void V4L2Source::MappedBuffers::unref()
+{
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+}
+
+void V4L2Source::MappedBuffers::releaseRawFrame(RawFrame *frame)
+{
+    MappedBuffers *self = static_cast<MappedBuffers*>(frame->owner);
+    {
+        std::lock_guard<std::mutex> lock(self->mutex);
+        if (self->streaming && !self->queue(frame->index)) {
+            qWarning() << "VIDIOC_QBUF (raw frame release) failed:" << strerror(errno);
+        }
+    }
+    self->unref();
+}
+
+bool V4L2Source::openDevice(QString &error)
+{
+    m_fd = ::open(m_device.toLocal8Bit().constData(), O_RDWR | O_NONBLOCK, 0);
+    if (m_fd < 0) {
+        error = QString("open(%1) failed: %2").arg(m_device).arg(strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+void V4L2Source::closeDevice()
+{
+    if (m_fd >= 0) {
+        ::close(m_fd);
+        m_fd = -1;
+    }
+}
+
+bool V4L2Source::queryCaps(QString &error)
+{
+    v4l2_capability cap;
+    if (xioctl(m_fd, VIDIOC_QUERYCAP, &cap) == -1) {
+        error = QString("VIDIOC_QUERYCAP failed: %1").arg(strerror(errno));
+        return false;
+    }
+    if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE_MPLANE) {
+        m_is_mplane = true;
+    } else if (cap.capabilities & V4L2_CAP_VIDEO_CAPTURE) {
+        m_is_mplane = false;
+    } else {
+        error = "Device does not support video capture";
+        return false;
+    }
+
+    if (!(cap.capabilities & V4L2_CAP_STREAMING)) {
+        error = "Device does not support streaming I/O";
+        return false;
+    }
+    return true;
+}
+
+bool V4L2Source::trySetFormatSingle(uint32_t pixfmt)
+{
+    v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    fmt.fmt.pix.width = m_width;
+    fmt.fmt.pix.height = m_height;
+    fmt.fmt.pix.pixelformat = pixfmt;
+    fmt.fmt.pix.field = V4L2_FIELD_ANY;
+
+    if (xioctl(m_fd, VIDIOC_S_FMT, &fmt) == -1) {
+        return false;
+    }
+    m_width = fmt.fmt.pix.width;
+    m_height = fmt.fmt.pix.height;
+    m_pixfmt = fmt.fmt.pix.pixelformat;
+    m_num_planes = 1;
+    takePlaneLayout(fmt);
+    qDebug() << "Selected single-planar format" << m_pixfmt << " size " << m_width << "x" << m_height;
+    return true;
+}
+
+bool V4L2Source::trySetFormatMPlane(uint32_t pixfmt)
+{
+    v4l2_format fmt;
+    memset(&fmt, 0, sizeof(fmt));
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    fmt.fmt.pix_mp.width = m_width;
+    fmt.fmt.pix_mp.height = m_height;
+    fmt.fmt.pix_mp.pixelformat = pixfmt;
+    fmt.fmt.pix_mp.field = V4L2_FIELD_ANY;
+
+    if (xioctl(m_fd, VIDIOC_S_FMT, &fmt) == -1) {
+        return false;
+    }
+    m_width = fmt.fmt.pix_mp.width;
+    m_height = fmt.fmt.pix_mp.height;
+    m_pixfmt = fmt.fmt.pix_mp.pixelformat;
+    m_num_planes = fmt.fmt.pix_mp.num_planes;
+    if (m_num_planes <= 0) m_num_planes = 2; // safe default
+    takePlaneLayout(fmt);
+    qDebug() << "Selected mplane format" << m_pixfmt << " size " << m_width << "x" << m_height << " planes=" << m_num_planes;
+    return true;
+}
+
+bool V4L2Source::initFormat(QString &error)
+{
+    // thermal cores: radiometric grey first, then common formats (NV12, NV21, UYVY, YUYV)
+    const uint32_t preferred[] = {
+        V4L2_PIX_FMT_Y16, V4L2_PIX_FMT_Y14, V4L2_PIX_FMT_Y12, V4L2_PIX_FMT_Y10,
+        V4L2_PIX_FMT_NV12, V4L2_PIX_FMT_NV21, V4L2_PIX_FMT_UYVY, V4L2_PIX_FMT_YUYV
+    };
+
+    if (m_is_mplane) {
+        for (uint32_t f : preferred) {
+            if (trySetFormatMPlane(f)) return true;
+        }
+        // fallback: get current format
+        v4l2_format fmt;
+        memset(&fmt,0,sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        if (xioctl(m_fd, VIDIOC_G_FMT, &fmt) == -1) {
+            error = "VIDIOC_G_FMT (mplane) failed";
+            return false;
+        }
+        m_width = fmt.fmt.pix_mp.width;
+        m_height = fmt.fmt.pix_mp.height;
+        m_pixfmt = fmt.fmt.pix_mp.pixelformat;
+        m_num_planes = fmt.fmt.pix_mp.num_planes;
+        if (m_num_planes <= 0) m_num_planes = 2;
+        takePlaneLayout(fmt);
+        qDebug() << "Fallback mplane format" << m_pixfmt << " size " << m_width << "x" << m_height << " planes=" << m_num_planes;
+        return true;
+    } else {
+        for (uint32_t f : preferred) {
+            if (trySetFormatSingle(f)) return true;
+        }
+        // fallback: get current single-planar format
+        v4l2_format fmt;
+        memset(&fmt,0,sizeof(fmt));
+        fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+        if (xioctl(m_fd, VIDIOC_G_FMT, &fmt) == -1) {
+            error = "VIDIOC_G_FMT failed";
+            return false;
+        }
+        m_width = fmt.fmt.pix.width;
+        m_height = fmt.fmt.pix.height;
+        m_pixfmt = fmt.fmt.pix.pixelformat;
+        m_num_planes = 1;
+        takePlaneLayout(fmt);
+        qDebug() << "Fallback single-planar format" << m_pixfmt << " size " << m_width << "x" << m_height;
+        return true;
+    }
+}
+
+static const char *memoryName(V4L2Source::Memory memory)
+{
+    switch (memory) {
+    case V4L2Source::UserPtr: return "USERPTR";
+    case V4L2Source::DmaBuf: return "DMABUF";
+    default: return "MMAP";
+    }
+}
+
+bool V4L2Source::parseMemory(const QString &name, Memory &memory)
+{
+    const QString n = name.trimmed().toLower();
+    if (n == "mmap") memory = Mmap;
+    else if (n == "userptr") memory = UserPtr;
+    else if (n == "dmabuf") memory = DmaBuf;
+    else return false;
+    return true;
+}
+
+void V4L2Source::setBufferCount(int count)
+{
+    m_requestedBuffers = qBound(2, count, (int)VIDEO_MAX_FRAME);
+}
+
+void V4L2Source::setMemory(Memory memory)
+{
+    m_requestedMemory = memory;
+}
+
+// VIDIOC_REQBUFS; count is updated to what the driver granted, and 0 frees
+// whatever the queue holds
+bool V4L2Source::requestBuffers(uint32_t memory, uint32_t &count, QString &error)
+{
+    v4l2_requestbuffers req;
+    memset(&req, 0, sizeof(req));
+    req.count = count;
+    req.memory = memory;
+    req.type = m_is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+
+    if (xioctl(m_fd, VIDIOC_REQBUFS, &req) == -1) {
+        error = QString("VIDIOC_REQBUFS failed: %1").arg(strerror(errno));
+        return false;
+    }
+    if (count && req.count < 2) {
+        error = "Insufficient buffer memory";
+        return false;
+    }
+    if (count && req.count != count) {
+        qDebug() << m_device << "granted" << req.count << "of" << count << "buffers";
+    }
+    count = req.count;
+    return true;
+}
+
+bool V4L2Source::initBuffers(QString &error)
+{
+    m_memory = m_requestedMemory;
+    if (m_memory == UserPtr) {
+        if (initUserPtr(error)) {
+            m_bufferCount = (int)m_mapped->buffers.size();
+        } else {
+            qWarning() << "USERPTR streaming unavailable on" << m_device << ":" << error << ", using MMAP";
+            error.clear();
+            uninitMmap();
+            uint32_t none = 0;
+            requestBuffers(V4L2_MEMORY_USERPTR, none, error);
+            error.clear();
+            m_memory = Mmap;
+        }
+    }
+    if (m_memory != UserPtr) {
+        if (!initMmap(error)) return false;
+        m_bufferCount = (int)m_mapped->buffers.size();
+        QString why;
+        if (m_memory == DmaBuf && !exportDmabufs(why)) {
+            qWarning() << "DMABUF export unavailable on" << m_device << ":" << why << ", using MMAP";
+            m_memory = Mmap;
+        }
+    }
+
+    if (!checkBufferSizes(error)) return false;
+
+    // queue buffers
+    for (uint32_t i = 0; i < (uint32_t)m_mapped->buffers.size(); ++i) {
+        if (!m_mapped->queue(i)) {
+            error = QString("VIDIOC_QBUF failed: %1").arg(strerror(errno));
+            return false;
+        }
+    }
+    qDebug() << m_device << "streaming through" << m_bufferCount << memoryName(m_memory) << "buffers";
+    return true;
+}
+
+bool V4L2Source::initMmap(QString &error)
+{
+    uint32_t count = m_requestedBuffers;
+    if (!requestBuffers(V4L2_MEMORY_MMAP, count, error)) return false;
+
+    m_mapped = new MappedBuffers(m_fd, m_is_mplane, false, m_num_planes, count);
+
+    for (uint32_t i = 0; i < count; ++i) {
+        if (m_is_mplane) {
+            // multi-planar: query buffer with plane info
+            v4l2_buffer buf;
+            memset(&buf, 0, sizeof(buf));
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+            buf.memory = V4L2_MEMORY_MMAP;
+            buf.index = i;
+
+            // prepare planes array to receive info
+            v4l2_plane planes[VIDEO_MAX_PLANES];
+            memset(planes, 0, sizeof(planes));
+            buf.m.planes = planes;
+            buf.length = VIDEO_MAX_PLANES;
+
+            if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) == -1) {
+                error = QString("VIDIOC_QUERYBUF (mplane) failed: %1").arg(strerror(errno));
+                return false;
+            }
+
+            // number of planes filled by driver is in buf.length OR m_num_planes; use min
+            int planes_count = buf.length;
+            if (planes_count <= 0) planes_count = m_num_planes;
+            if (planes_count > VIDEO_MAX_PLANES) planes_count = VIDEO_MAX_PLANES;
+
+            m_mapped->buffers[i].starts.resize(planes_count);
+            m_mapped->buffers[i].lengths.resize(planes_count);
+
+            for (int p = 0; p < planes_count; ++p) {
+                size_t len = planes[p].length;
+                off_t off = planes[p].m.mem_offset;
+                void *start = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, off);
+                if (start == MAP_FAILED) {
+                    error = QString("mmap plane %1 failed: %2").arg(p).arg(strerror(errno));
+                    // unmap previously mapped planes for this buffer
+                    for (int q = 0; q < p; ++q) {
+                        if (m_mapped->buffers[i].starts[q]) munmap(m_mapped->buffers[i].starts[q], m_mapped->buffers[i].lengths[q]);
+                        m_mapped->buffers[i].starts[q] = nullptr;
+                        m_mapped->buffers[i].lengths[q] = 0;
+                    }
+                    return false;
+                }
+                m_mapped->buffers[i].starts[p] = start;
+                m_mapped->buffers[i].lengths[p] = len;
+            }
+        } else {
+            // single-planar
+            v4l2_buffer buf;
+            memset(&buf, 0, sizeof(buf));
+            buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            buf.memory = V4L2_MEMORY_MMAP;
+            buf.index = i;
+
+            if (xioctl(m_fd, VIDIOC_QUERYBUF, &buf) == -1) {
+                error = QString("VIDIOC_QUERYBUF failed: %1").arg(strerror(errno));
+                return false;
+            }
+
+            m_mapped->buffers[i].starts.resize(1);
+            m_mapped->buffers[i].lengths.resize(1);
+            m_mapped->buffers[i].lengths[0] = buf.length;
+            m_mapped->buffers[i].starts[0] = mmap(nullptr, buf.length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, buf.m.offset);
+            if (m_mapped->buffers[i].starts[0] == MAP_FAILED) {
+                error = QString("mmap failed: %1").arg(strerror(errno));
+                return false;
+            }
+        }
+    }
+
+    return true;
+}
+
+// page-aligned buffers of our own, sized from the negotiated format
+bool V4L2Source::initUserPtr(QString &error)
+{
+    for (size_t size : m_planeSizes) {
+        if (!size) {
+            error = "the driver reports no image size";
+            return false;
+        }
+    }
+    uint32_t count = m_requestedBuffers;
+    if (!requestBuffers(V4L2_MEMORY_USERPTR, count, error)) return false;
+
+    const int planeCount = m_is_mplane ? (int)m_planeSizes.size() : 1;
+    m_mapped = new MappedBuffers(m_fd, m_is_mplane, true, planeCount, count);
+    const size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (Buffer &b : m_mapped->buffers) {
+        for (int p = 0; p < planeCount; ++p) {
+            const size_t len = (m_planeSizes[p] + page - 1) / page * page;
+            void *start = nullptr;
+            if (posix_memalign(&start, page, len) != 0) {
+                error = QString("allocating %1 bytes for USERPTR buffers failed").arg(len);
+                return false;
+            }
+            b.starts.push_back(start);
+            b.lengths.push_back(len);
+        }
+    }
+    return true;
+}
+
+// one DMABUF fd per plane of every buffer; all or none
+bool V4L2Source::exportDmabufs(QString &error)
+{
+    for (uint32_t i = 0; i < (uint32_t)m_mapped->buffers.size(); ++i) {
+        Buffer &b = m_mapped->buffers[i];
+        for (uint32_t p = 0; p < (uint32_t)b.starts.size(); ++p) {
+            v4l2_exportbuffer exp;
+            memset(&exp, 0, sizeof(exp));
+            exp.type = m_is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+            exp.index = i;
+            exp.plane = p;
+            exp.flags = O_RDONLY | O_CLOEXEC;
+            if (xioctl(m_fd, VIDIOC_EXPBUF, &exp) == -1) {
+                error = QString("VIDIOC_EXPBUF failed: %1").arg(strerror(errno));
+                for (uint32_t j = 0; j <= i; ++j) {
+                    for (int fd : m_mapped->buffers[j].dmabufFds) ::close(fd);
+                    m_mapped->buffers[j].dmabufFds.clear();
+                    for (int &fd : m_mapped->rawFrames[j].dmabufFds) fd = -1;
+                }
+                return false;
+            }
+            b.dmabufFds.push_back(exp.fd);
+            if (p < 3) m_mapped->rawFrames[i].dmabufFds[p] = exp.fd;
+        }
+    }
+    return true;
+}
+
+void V4L2Source::uninitMmap()
+{
+    // raw frames still held by consumers keep the mappings alive; the last
+    // reference unmaps them
+    if (m_mapped) {
+        m_mapped->unref();
+        m_mapped = nullptr;
+    }
+}
+
+bool V4L2Source::startStreaming(QString &error)
+{
+    v4l2_buf_type type = m_is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    if (xioctl(m_fd, VIDIOC_STREAMON, &type) == -1) {
+        error = QString("VIDIOC_STREAMON failed: %1").arg(strerror(errno));
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mapped->mutex);
+    m_mapped->streaming = true;
+    return true;
+}
+
+void V4L2Source::stopStreaming()
+{
+    if (m_fd < 0) return;
+    if (m_mapped) {
+        // no more QBUF from raw frame releases after this point
+        std::lock_guard<std::mutex> lock(m_mapped->mutex);
+        m_mapped->streaming = false;
+    }
+    v4l2_buf_type type = m_is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    xioctl(m_fd, VIDIOC_STREAMOFF, &type);
+}
+
+
+V4L2Source::V4L2Source(const QString &device)
+    : m_device(device)
+{
+    // lives as long as the source, so wakeup() is safe whether or not it streams
+    m_wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (m_wakeFd < 0) qWarning() << "eventfd failed:" << strerror(errno);
+}
+
+V4L2Source::~V4L2Source()
+{
+    stop();
+    if (m_wakeFd >= 0) ::close(m_wakeFd);
+}
+
+void V4L2Source::wakeup()
+{
+    if (m_wakeFd < 0) return;
+    const uint64_t one = 1;
+    if (::write(m_wakeFd, &one, sizeof(one)) < 0 && errno != EAGAIN) {
+        qWarning() << "eventfd write failed:" << strerror(errno);
+    }
+}
+
+bool V4L2Source::initEpoll(QString &error)
+{
+    m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+    if (m_epollFd < 0) {
+        error = QString("epoll_create1 failed: %1").arg(strerror(errno));
+        return false;
+    }
+    epoll_event ev{};
+    ev.events = EPOLLIN;
+    ev.data.fd = m_fd;
+    if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_fd, &ev) == -1) {
+        error = QString("epoll_ctl(%1) failed: %2").arg(m_device).arg(strerror(errno));
+        return false;
+    }
+    if (m_wakeFd >= 0) {
+        ev.data.fd = m_wakeFd;
+        if (epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_wakeFd, &ev) == -1) {
+            error = QString("epoll_ctl(eventfd) failed: %1").arg(strerror(errno));
+            return false;
+        }
+    }
+    return true;
+}
+
+void V4L2Source::closeEpoll()
+{
+    if (m_epollFd >= 0) {
+        ::close(m_epollFd);
+        m_epollFd = -1;
+    }
+}
+
+bool V4L2Source::start(int width, int height, QString &error)
+{
+    m_width = width;
+    m_height = height;
+    if (!openDevice(error)) {
+        return false;
+    }
+    if (!queryCaps(error) || !initFormat(error)) {
+        closeDevice();
+        return false;
+    }
+    if (!initBuffers(error) || !initEpoll(error) || !startStreaming(error)) {
+        closeEpoll();
+        uninitMmap();
+        closeDevice();
+        return false;
+    }
+    queryControls();
+    return true;
+}
+
+void V4L2Source::stop()
+{
+    stopStreaming();
+    closeEpoll();
+    uninitMmap();
+    closeDevice();
+    for (ControlRange &range : m_controls) range = ControlRange();
+}
+
+// walks every control the driver lists and keeps the ranges of those we can
+// drive; only plain writable integer controls qualify
+void V4L2Source::queryControls()
+{
+    static const uint32_t ids[ControlCount] = { V4L2_CID_BRIGHTNESS, V4L2_CID_CONTRAST, V4L2_CID_GAMMA };
+    for (ControlRange &range : m_controls) range = ControlRange();
+
+    QStringList found;
+    v4l2_query_ext_ctrl query;
+    memset(&query, 0, sizeof(query));
+    query.id = V4L2_CTRL_FLAG_NEXT_CTRL;
+    while (xioctl(m_fd, VIDIOC_QUERY_EXT_CTRL, &query) == 0) {
+        const uint32_t id = query.id;
+        query.id |= V4L2_CTRL_FLAG_NEXT_CTRL;
+        const uint32_t unusable = V4L2_CTRL_FLAG_DISABLED | V4L2_CTRL_FLAG_READ_ONLY | V4L2_CTRL_FLAG_INACTIVE;
+        if (query.type != V4L2_CTRL_TYPE_INTEGER || (query.flags & unusable)
+            || query.maximum <= query.minimum) {
+            continue;
+        }
+        for (int c = 0; c < ControlCount; ++c) {
+            if (id != ids[c]) continue;
+            ControlRange &range = m_controls[c];
+            range.id = id;
+            range.minimum = query.minimum;
+            range.maximum = query.maximum;
+            range.step = query.step ? query.step : 1;
+            range.defaultValue = query.default_value;
+            found << QString("%1 %2..%3 (default %4)").arg(QString::fromLatin1(query.name))
+                         .arg(query.minimum).arg(query.maximum).arg(query.default_value);
+        }
+    }
+    if (!found.isEmpty()) qDebug() << m_device << "controls:" << found.join(", ");
+}
+
+int V4L2Source::controls() const
+{
+    int mask = 0;
+    for (int c = 0; c < ControlCount; ++c) {
+        if (m_controls[c].id) mask |= 1 << c;
+    }
+    return mask;
+}
+
+// A menu value in the control's units. Brightness spans the control's range
+// as -255..255 spans the menu's, centred on the default; contrast and gamma
+// scale the default, which stands for 1.
+int64_t V4L2Source::controlValue(const ControlRange &range, Control control, double value) const
+{
+    const double span = (double)(range.maximum - range.minimum);
+    const double base = range.defaultValue > 0 ? (double)range.defaultValue
+                                               : range.minimum + span / 2;
+    double v = (control == Brightness) ? range.defaultValue + value * span / 510.0 : base * value;
+    v = qBound((double)range.minimum, v, (double)range.maximum);
+    const int64_t steps = std::llround((v - range.minimum) / range.step);
+    return qMin(range.maximum, range.minimum + steps * (int64_t)range.step);
+}
+
+int V4L2Source::setControls(int mask, const double *values, QString &error)
+{
+    v4l2_ext_control ctrls[ControlCount];
+    Control which[ControlCount];
+    int count = 0;
+    int failed = 0;
+    memset(ctrls, 0, sizeof(ctrls));
+    for (int c = 0; c < ControlCount; ++c) {
+        if (!(mask & (1 << c))) continue;
+        if (!m_controls[c].id) {
+            failed |= 1 << c;
+            continue;
+        }
+        ctrls[count].id = m_controls[c].id;
+        ctrls[count].value = (int32_t)controlValue(m_controls[c], (Control)c, values[c]);
+        which[count++] = (Control)c;
+    }
+    if (!count) {
+        if (failed) error = QString("%1 lacks the requested controls").arg(m_device);
+        return failed;
+    }
+
+    v4l2_ext_controls batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.which = V4L2_CTRL_WHICH_CUR_VAL;
+    batch.count = count;
+    batch.controls = ctrls;
+    if (xioctl(m_fd, VIDIOC_S_EXT_CTRLS, &batch) == 0) {
+        if (failed) error = QString("%1 lacks some of the requested controls").arg(m_device);
+        return failed;
+    }
+    // the batch is all or nothing: find the culprits one at a time
+    error = QString("VIDIOC_S_EXT_CTRLS on %1 failed: %2").arg(m_device).arg(strerror(errno));
+    for (int i = 0; i < count; ++i) {
+        batch.count = 1;
+        batch.controls = &ctrls[i];
+        if (xioctl(m_fd, VIDIOC_S_EXT_CTRLS, &batch) == -1) failed |= 1 << which[i];
+    }
+    return failed;
+}
+
+FrameSource::Status V4L2Source::dequeue(SourceBuffer &out, int timeoutMs, QString &error)
+{
+    v4l2_buffer buf;
+    memset(&buf, 0, sizeof(buf));
+    v4l2_plane planes[VIDEO_MAX_PLANES];
+    memset(planes, 0, sizeof(planes));
+    buf.type = m_is_mplane ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = m_mapped->userPtr ? V4L2_MEMORY_USERPTR : V4L2_MEMORY_MMAP;
+    if (m_is_mplane) {
+        buf.m.planes = planes;
+        buf.length = VIDEO_MAX_PLANES;
+    }
+
+    // a buffer that is ready already is taken without waiting; only an
+    // empty queue sleeps in epoll, until the driver or wakeup() signals
+    bool waited = false;
+    while (xioctl(m_fd, VIDIOC_DQBUF, &buf) == -1) {
+        if (errno == ENODEV) {
+            error = QString("%1 is gone").arg(m_device);
+            return Finished;
+        }
+        if (errno != EAGAIN) {
+            error = QString("VIDIOC_DQBUF failed: %1").arg(strerror(errno));
+            return Failed;
+        }
+        if (waited) return Again; // readable but nothing to dequeue after all
+
+        epoll_event events[2];
+        const int n = epoll_wait(m_epollFd, events, 2, timeoutMs);
+        if (n == -1) {
+            if (errno == EINTR) return Again;
+            error = QString("epoll_wait failed: %1").arg(strerror(errno));
+            return Finished;
+        }
+        if (n == 0) return Again;
+        for (int i = 0; i < n; ++i) {
+            if (events[i].data.fd == m_wakeFd) {
+                uint64_t count;
+                if (::read(m_wakeFd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+                    qWarning() << "eventfd read failed:" << strerror(errno);
+                }
+                return Again;
+            }
+        }
+        waited = true;
+    }
+
+    int idx = buf.index;
+    if ((size_t)idx >= m_mapped->buffers.size()) {
+        // defensive
+        if (!m_mapped->queue(idx)) {
+            error = QString("VIDIOC_QBUF (requeue invalid idx) failed: %1").arg(strerror(errno));
+        } else {
+            error = QString("VIDIOC_DQBUF returned invalid index %1").arg(idx);
+        }
+        return Failed;
+    }
+
+    const Buffer &b = m_mapped->buffers[idx];
+    out.index = idx;
+    out.planeCount = qMin(qMin((int)b.starts.size(), (int)m_bytesPerLine.size()), 3);
+    for (int p = 0; p < out.planeCount; ++p) {
+        out.planes[p] = static_cast<const uchar*>(b.starts[p]);
+        out.bytesPerLine[p] = m_bytesPerLine[p];
+    }
+    if (isSemiPlanar(m_pixfmt) && out.planeCount == 1) {
+        // contiguous NV12/NV21: chroma starts right after the padded luma rows
+        out.planeCount = 2;
+        out.planes[1] = out.planes[0] + (size_t)m_bytesPerLine[0] * m_height;
+        out.bytesPerLine[1] = m_bytesPerLine[1];
+    }
+    out.sequence = buf.sequence;
+    // only a monotonic driver timestamp compares with our own clock
+    if ((buf.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC
+        && (buf.timestamp.tv_sec || buf.timestamp.tv_usec)) {
+        out.timestampNs = (qint64)buf.timestamp.tv_sec * 1000000000LL + (qint64)buf.timestamp.tv_usec * 1000;
+    } else {
+        out.timestampNs = 0;
+    }
+    return Ok;
+}
+
+bool V4L2Source::requeue(int index, QString &error)
+{
+    if (!m_mapped->queue(index)) {
+        error = QString("VIDIOC_QBUF (requeue) failed: %1").arg(strerror(errno));
+        return false;
+    }
+    return true;
+}
+
+RawFrame *V4L2Source::exportBuffer(int index)
+{
+    // the buffer goes back to the driver when the last reference is dropped
+    m_mapped->refs.fetch_add(1, std::memory_order_relaxed);
+    return &m_mapped->rawFrames[index];
+}
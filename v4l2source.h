@@ -0,0 +1,134 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "framesource.h"
+
+struct v4l2_format;
+
+// Capture from a V4L2 device, single-planar or multi-planar. dequeue()
+// sleeps in epoll on the device and an eventfd, so wakeup() ends a wait at
+// once.
+//
+// Buffers are driver memory mapped into the process (Mmap), the same with
+// every plane also exported as a DMABUF fd for zero-copy sharing (DmaBuf),
+// or page-aligned memory of our own that the driver writes into (UserPtr).
+// A mode the driver does not support falls back to plain Mmap.
+class V4L2Source : public FrameSource
+{
+public:
+    enum Memory { Mmap, UserPtr, DmaBuf };
+
+    explicit V4L2Source(const QString &device);
+    ~V4L2Source() override;
+
+    // Driver queue depth, 2..32: fewer buffers mean less latency between
+    // sensor and screen, more ride out longer consumer stalls without drops.
+    // Both settings take effect on the next start(); the getters report what
+    // the driver granted once started.
+    void setBufferCount(int count);
+    int bufferCount() const { return m_bufferCount; }
+    void setMemory(Memory memory);
+    Memory memory() const { return m_memory; }
+    // "mmap", "userptr" or "dmabuf"; false for anything else
+    static bool parseMemory(const QString &name, Memory &memory);
+
+    QString name() const override { return m_device; }
+
+    bool start(int width, int height, QString &error) override;
+    void stop() override;
+
+    Status dequeue(SourceBuffer &buf, int timeoutMs, QString &error) override;
+    void wakeup() override;
+    bool requeue(int index, QString &error) override;
+    RawFrame *exportBuffer(int index) override;
+
+    // brightness, contrast and gamma through V4L2_CID_*, when the driver has them
+    int controls() const override;
+    int setControls(int mask, const double *values, QString &error) override;
+
+private:
+    // range of one driver control; id 0 when the driver lacks it
+    struct ControlRange {
+        uint32_t id{0};
+        int64_t minimum{0};
+        int64_t maximum{0};
+        uint64_t step{1};
+        int64_t defaultValue{0};
+    };
+
+    void queryControls();
+    int64_t controlValue(const ControlRange &range, Control control, double value) const;
+
+    bool openDevice(QString &error);
+    void closeDevice();
+    bool queryCaps(QString &error);
+    bool trySetFormatSingle(uint32_t pixfmt);
+    bool trySetFormatMPlane(uint32_t pixfmt);
+    bool initFormat(QString &error);
+    void takePlaneLayout(const v4l2_format &fmt);
+    bool checkBufferSizes(QString &error) const;
+    bool initBuffers(QString &error);
+    bool requestBuffers(uint32_t memory, uint32_t &count, QString &error);
+    bool initMmap(QString &error);
+    bool initUserPtr(QString &error);
+    bool exportDmabufs(QString &error);
+    void uninitMmap();
+    bool startStreaming(QString &error);
+    void stopStreaming();
+    bool initEpoll(QString &error);
+    void closeEpoll();
+
+    QString m_device;
+    int m_fd{-1};
+    int m_epollFd{-1};  // device + m_wakeFd, while streaming
+    int m_wakeFd{-1};   // eventfd, for the whole lifetime
+
+    // If the device is multplane, we set this true and use VIDEO_CAPTURE_MPLANE ioctls
+    bool m_is_mplane{false};
+    int m_num_planes{0};
+    std::vector<size_t> m_planeSizes; // sizeimage per plane, from the format
+    // row stride of every plane the camera sees; a contiguous NV12/NV21
+    // buffer has two of them for its one memory plane
+    std::vector<int> m_bytesPerLine;
+
+    int m_requestedBuffers{4};
+    Memory m_requestedMemory{Mmap};
+    int m_bufferCount{0}; // granted, while started
+    Memory m_memory{Mmap};
+
+    ControlRange m_controls[ControlCount]; // while started
+
+    struct Buffer {
+        // for single-planar: starts.size()==1, lengths[0] valid
+        // for multplane: starts.size()==m_num_planes
+        std::vector<void*> starts;
+        std::vector<size_t> lengths;
+        std::vector<int> dmabufFds; // per plane, DmaBuf only
+    };
+
+    // The driver buffers, mapped or our own. Reference counted: raw frames
+    // handed to consumers keep the memory alive past uninitMmap(), and
+    // releasing one queues its buffer back to the driver while streaming.
+    struct MappedBuffers {
+        std::vector<Buffer> buffers;
+        std::unique_ptr<RawFrame[]> rawFrames; // one per buffer
+        std::atomic<int> refs{1};
+        std::mutex mutex; // guards streaming against QBUF from consumer threads
+        bool streaming{false};
+        int fd{-1};
+        bool mplane{false};
+        bool userPtr{false}; // starts are our allocations, not mappings
+        int numPlanes{1};
+
+        MappedBuffers(int fd, bool mplane, bool userPtr, int numPlanes, uint32_t count);
+        ~MappedBuffers();
+        void unref();
+        bool queue(uint32_t index);
+        static void releaseRawFrame(RawFrame *frame);
+    };
+    MappedBuffers *m_mapped{nullptr};
+};
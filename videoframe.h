@@ -0,0 +1,112 @@
+#pragma once
+
+#include <QImage>
+#include <atomic>
+#include <cstdint>
+
+// A captured driver buffer handed out without conversion. The buffer stays
+// dequeued, and its memory mapped, until the last RawFrameRef to it is gone;
+// the owner's release hook then gives it back to the driver.
+struct RawFrame
+{
+    struct Plane {
+        const uchar *data;
+        int bytesPerLine;
+    };
+
+    uint32_t pixelFormat{0}; // V4L2_PIX_FMT_*
+    int width{0};
+    int height{0};
+    int planeCount{0};
+    Plane planes[3];
+
+    // set up once by the owner
+    void (*release)(RawFrame *frame){nullptr};
+    void *owner{nullptr};
+    int index{-1};
+    // DMABUF fd of each driver buffer plane, for zero-copy import by other
+    // consumers; -1 unless the source exports them. Owned by the source.
+    int dmabufFds[3] = {-1, -1, -1};
+    std::atomic<int> refs{0};
+};
+
+// Intrusive reference to a RawFrame; copying never allocates.
+class RawFrameRef
+{
+public:
+    RawFrameRef() {}
+    explicit RawFrameRef(RawFrame *frame) : m_frame(frame) { acquire(); }
+    RawFrameRef(const RawFrameRef &other) : m_frame(other.m_frame) { acquire(); }
+    RawFrameRef(RawFrameRef &&other) : m_frame(other.m_frame) { other.m_frame = nullptr; }
+    ~RawFrameRef() { reset(); }
+
+    RawFrameRef &operator=(const RawFrameRef &other)
+    {
+        if (m_frame != other.m_frame) {
+            reset();
+            m_frame = other.m_frame;
+            acquire();
+        }
+        return *this;
+    }
+    RawFrameRef &operator=(RawFrameRef &&other)
+    {
+        if (this != &other) {
+            reset();
+            m_frame = other.m_frame;
+            other.m_frame = nullptr;
+        }
+        return *this;
+    }
+
+    void reset()
+    {
+        if (m_frame && m_frame->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            m_frame->release(m_frame);
+        }
+        m_frame = nullptr;
+    }
+
+    const RawFrame *get() const { return m_frame; }
+    const RawFrame *operator->() const { return m_frame; }
+    explicit operator bool() const { return m_frame != nullptr; }
+
+private:
+    void acquire()
+    {
+        if (m_frame) m_frame->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    RawFrame *m_frame{nullptr};
+};
+
+// Monotonic timestamps (ns) of one frame on its way to the screen; all zero
+// unless FrameStats is enabled.
+struct FrameTiming
+{
+    uint32_t sequence{0};    // v4l2_buffer.sequence
+    qint64 driverNs{0};      // v4l2_buffer.timestamp, 0 if not monotonic
+    qint64 dequeueNs{0};     // DQBUF returned
+    qint64 convertStartNs{0};
+    qint64 convertEndNs{0};
+    qint64 publishNs{0};     // handed to the mailbox
+    qint64 takeNs{0};        // taken by the scene graph
+
+    bool valid() const { return dequeueNs != 0; }
+};
+
+// What the capture thread publishes: a converted RGB image, the raw driver
+// buffer, or both.
+struct VideoFrame
+{
+    QImage image;
+    RawFrameRef raw;
+    FrameTiming timing;
+    // > 0: raw still has to be converted, box-filtered by this factor, by
+    // V4L2Camera::convertDeferred() (lazy conversion)
+    int deferredScale{0};
+
+    bool isNull() const { return image.isNull() && !raw; }
+    bool deferred() const { return deferredScale > 0; }
+    QSize size() const { return raw ? QSize(raw->width, raw->height) : image.size(); }
+};
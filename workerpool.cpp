@@ -0,0 +1,94 @@
+#include "workerpool.h"
+#include <pthread.h>
+#include <sched.h>
+
+WorkerPool::WorkerPool(int threads, const std::vector<int> &cpus)
+    : m_cpus(cpus)
+{
+    if (threads < 1) threads = 1;
+    m_bands.resize(threads);
+    m_workers.reserve(threads - 1);
+    for (int i = 1; i < threads; ++i) {
+        m_workers.push_back(std::thread(&WorkerPool::workerLoop, this, i));
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_startCond.notify_all();
+    for (auto &t : m_workers) t.join();
+}
+
+int WorkerPool::bandRows(int rows, int rowAlign) const
+{
+    if (rowAlign < 1) rowAlign = 1;
+    const int n = threadCount();
+    int per = (rows + n - 1) / n;
+    return (per + rowAlign - 1) / rowAlign * rowAlign;
+}
+
+void WorkerPool::run(int rows, int rowAlign, BandFn fn, void *ctx)
+{
+    if (rows <= 0) return;
+    const int n = threadCount();
+    if (n == 1) {
+        fn(ctx, 0, rows);
+        return;
+    }
+
+    const int per = bandRows(rows, rowAlign);
+    for (int i = 0; i < n; ++i) {
+        int begin = i * per;
+        int end = begin + per;
+        m_bands[i].begin = begin < rows ? begin : rows;
+        m_bands[i].end = end < rows ? end : rows;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fn = fn;
+        m_ctx = ctx;
+        m_pending = n - 1;
+        ++m_generation;
+    }
+    m_startCond.notify_all();
+
+    if (m_bands[0].begin < m_bands[0].end) fn(ctx, m_bands[0].begin, m_bands[0].end);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_doneCond.wait(lock, [this] { return m_pending == 0; });
+}
+
+void WorkerPool::workerLoop(int index)
+{
+    if (!m_cpus.empty()) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(m_cpus[(index - 1) % m_cpus.size()], &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+
+    unsigned long seen = 0;
+    for (;;) {
+        BandFn fn;
+        void *ctx;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_startCond.wait(lock, [&] { return m_quit || m_generation != seen; });
+            if (m_quit) return;
+            seen = m_generation;
+            fn = m_fn;
+            ctx = m_ctx;
+        }
+
+        const Band &band = m_bands[index];
+        if (band.begin < band.end) fn(ctx, band.begin, band.end);
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_pending == 0) m_doneCond.notify_one();
+    }
+}
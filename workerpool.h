@@ -0,0 +1,53 @@
+#pragma once
+
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Persistent pool that runs one function over horizontal bands of a frame.
+// The calling thread takes the first band itself, so a pool of N threads
+// starts N-1 workers. run() neither allocates nor returns before every band
+// has finished.
+class WorkerPool
+{
+public:
+    typedef void (*BandFn)(void *ctx, int rowBegin, int rowEnd);
+
+    // threads: total number of threads taking part, including the caller.
+    // cpus: optional CPU list; the worker taking band b (1..threads-1) is
+    // pinned to cpus[(b - 1) % cpus.size()], the caller keeps its affinity.
+    explicit WorkerPool(int threads = 1, const std::vector<int> &cpus = std::vector<int>());
+    ~WorkerPool();
+
+    int threadCount() const { return (int)m_workers.size() + 1; }
+
+    // Splits [0, rows) into threadCount() bands whose boundaries are multiples
+    // of rowAlign and calls fn(ctx, begin, end) for each of them in parallel.
+    void run(int rows, int rowAlign, BandFn fn, void *ctx);
+
+    // rows per band for the same arguments: band i starts at i * bandRows(),
+    // so fn can tell which band it got from rowBegin
+    int bandRows(int rows, int rowAlign) const;
+
+private:
+    struct Band {
+        int begin;
+        int end;
+    };
+
+    void workerLoop(int index);
+
+    std::vector<std::thread> m_workers;
+    std::vector<int> m_cpus;
+    std::vector<Band> m_bands; // one per thread, sized once in the constructor
+
+    std::mutex m_mutex;
+    std::condition_variable m_startCond;
+    std::condition_variable m_doneCond;
+    unsigned long m_generation{0};
+    int m_pending{0};
+    bool m_quit{false};
+    BandFn m_fn{nullptr};
+    void *m_ctx{nullptr};
+};
@@ -0,0 +1,568 @@
+#include "yuvkernels.h"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define OWLET_HAVE_X86 1
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define OWLET_HAVE_NEON 1
+#endif
+
+// ---------------------------------------------------------------------------
+// scalar reference
+// ---------------------------------------------------------------------------
+
+static inline uint8_t clamp255(int v) {
+    if (v < 0) return 0;
+    if (v > 255) return 255;
+    return (uint8_t)v;
+}
+static inline void yuvToRgbPixel(int y, int u, int v, uint8_t *rgb)
+{
+    int c = y - 16;
+    int d = u - 128;
+    int e = v - 128;
+    rgb[0] = clamp255((298 * c + 409 * e + 128) >> 8);
+    rgb[1] = clamp255((298 * c - 100 * d - 208 * e + 128) >> 8);
+    rgb[2] = clamp255((298 * c + 516 * d + 128) >> 8);
+}
+
+static void nv12RowScalar(const uint8_t *y, const uint8_t *uv, uint8_t *rgb, int width)
+{
+    for (int col = 0; col < width; ++col) {
+        int uvIndex = col & ~1;
+        yuvToRgbPixel(y[col], uv[uvIndex], uv[uvIndex + 1], rgb + col * 3);
+    }
+}
+
+static void nv21RowScalar(const uint8_t *y, const uint8_t *vu, uint8_t *rgb, int width)
+{
+    for (int col = 0; col < width; ++col) {
+        int uvIndex = col & ~1;
+        yuvToRgbPixel(y[col], vu[uvIndex + 1], vu[uvIndex], rgb + col * 3);
+    }
+}
+
+static void uyvyRowScalar(const uint8_t *src, uint8_t *rgb, int width)
+{
+    for (int col = 0; col < width; col += 2) {
+        const uint8_t *p = src + col * 2;
+        yuvToRgbPixel(p[1], p[0], p[2], rgb + col * 3);
+        if (col + 1 < width) yuvToRgbPixel(p[3], p[0], p[2], rgb + (col + 1) * 3);
+    }
+}
+
+static void yuyvRowScalar(const uint8_t *src, uint8_t *rgb, int width)
+{
+    for (int col = 0; col < width; col += 2) {
+        const uint8_t *p = src + col * 2;
+        yuvToRgbPixel(p[0], p[1], p[3], rgb + col * 3);
+        if (col + 1 < width) yuvToRgbPixel(p[2], p[1], p[3], rgb + (col + 1) * 3);
+    }
+}
+
+static void greyRowScalar(const uint8_t *y, uint8_t *rgb, int width)
+{
+    for (int col = 0; col < width; ++col) {
+        rgb[col * 3 + 0] = y[col];
+        rgb[col * 3 + 1] = y[col];
+        rgb[col * 3 + 2] = y[col];
+    }
+}
+
+static const YuvRowKernels s_scalarKernels = {
+    nv12RowScalar, nv21RowScalar, uyvyRowScalar, yuyvRowScalar, greyRowScalar, "scalar"
+};
+
+// All SIMD kernels below evaluate exactly the scalar formula: 16-bit products
+// summed in 32-bit lanes, arithmetic >> 8, then saturation to [0,255] which is
+// what clamp255() does. Rows are processed in blocks of 16 pixels and the
+// remainder goes through the scalar kernel.
+
+// two int16 coefficients packed into one 32-bit lane for pmaddwd
+#define OWLET_PAIR16(lo, hi) ((int)(((uint32_t)(uint16_t)(int16_t)(hi) << 16) | (uint16_t)(int16_t)(lo)))
+
+#ifdef OWLET_HAVE_X86
+
+// ---------------------------------------------------------------------------
+// SSE2 (baseline on x86_64)
+// ---------------------------------------------------------------------------
+
+// 8 pixels: c = y-16, d = u-128, e = v-128 as int16 -> r,g,b as int16
+static inline void rgb16Sse2(__m128i c, __m128i d, __m128i e, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i kR = _mm_set1_epi32(OWLET_PAIR16(298, 409));
+    const __m128i kGcd = _mm_set1_epi32(OWLET_PAIR16(298, -100));
+    const __m128i kGe = _mm_set1_epi32(OWLET_PAIR16(-208, 128)); // e * -208 + 1 * 128
+    const __m128i kB = _mm_set1_epi32(OWLET_PAIR16(298, 516));
+    const __m128i kRound = _mm_set1_epi32(128);
+    const __m128i one = _mm_set1_epi16(1);
+
+    __m128i ceLo = _mm_unpacklo_epi16(c, e), ceHi = _mm_unpackhi_epi16(c, e);
+    __m128i cdLo = _mm_unpacklo_epi16(c, d), cdHi = _mm_unpackhi_epi16(c, d);
+    __m128i e1Lo = _mm_unpacklo_epi16(e, one), e1Hi = _mm_unpackhi_epi16(e, one);
+
+    __m128i rLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceLo, kR), kRound), 8);
+    __m128i rHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(ceHi, kR), kRound), 8);
+    __m128i gLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdLo, kGcd), _mm_madd_epi16(e1Lo, kGe)), 8);
+    __m128i gHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdHi, kGcd), _mm_madd_epi16(e1Hi, kGe)), 8);
+    __m128i bLo = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdLo, kB), kRound), 8);
+    __m128i bHi = _mm_srai_epi32(_mm_add_epi32(_mm_madd_epi16(cdHi, kB), kRound), 8);
+
+    // results are within [-223, 481], so the int16 pack never saturates
+    r = _mm_packs_epi32(rLo, rHi);
+    g = _mm_packs_epi32(gLo, gHi);
+    b = _mm_packs_epi32(bLo, bHi);
+}
+
+// 16 pixels of 8-bit y/u/v -> 8-bit r/g/b
+static inline void rgb8Sse2(__m128i y, __m128i u, __m128i v, __m128i &r, __m128i &g, __m128i &b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i k16 = _mm_set1_epi16(16);
+    const __m128i k128 = _mm_set1_epi16(128);
+
+    __m128i rl, gl, bl, rh, gh, bh;
+    rgb16Sse2(_mm_sub_epi16(_mm_unpacklo_epi8(y, zero), k16),
+              _mm_sub_epi16(_mm_unpacklo_epi8(u, zero), k128),
+              _mm_sub_epi16(_mm_unpacklo_epi8(v, zero), k128), rl, gl, bl);
+    rgb16Sse2(_mm_sub_epi16(_mm_unpackhi_epi8(y, zero), k16),
+              _mm_sub_epi16(_mm_unpackhi_epi8(u, zero), k128),
+              _mm_sub_epi16(_mm_unpackhi_epi8(v, zero), k128), rh, gh, bh);
+    r = _mm_packus_epi16(rl, rh);
+    g = _mm_packus_epi16(gl, gh);
+    b = _mm_packus_epi16(bl, bh);
+}
+
+// Interleaves 16 pixels into 48 bytes of RGB888. SSE2 has no byte shuffle, so
+// each group of 4 pixels is squeezed from RGBX to 12 bytes with shifts and
+// stored as a full 16-byte vector: the 4 trailing bytes are scratch that the
+// next store overwrites. The last store spills 4 bytes past the block, so the
+// caller must have at least 2 more pixels in the row.
+static inline void storeRgbSse2(uint8_t *dst, __m128i r, __m128i g, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i lo24 = _mm_set1_epi64x(0xFFFFFFLL);
+    const __m128i mid24 = _mm_set1_epi64x(0xFFFFFF000000LL);
+    const __m128i lo64 = _mm_set_epi32(0, 0, -1, -1);
+
+    __m128i rgLo = _mm_unpacklo_epi8(r, g), rgHi = _mm_unpackhi_epi8(r, g);
+    __m128i bzLo = _mm_unpacklo_epi8(b, zero), bzHi = _mm_unpackhi_epi8(b, zero);
+    __m128i px[4] = {
+        _mm_unpacklo_epi16(rgLo, bzLo), _mm_unpackhi_epi16(rgLo, bzLo),
+        _mm_unpacklo_epi16(rgHi, bzHi), _mm_unpackhi_epi16(rgHi, bzHi)
+    };
+    for (int i = 0; i < 4; ++i) {
+        // 2 pixels per 64-bit lane: RGBX RGBX -> RGBRGB00
+        __m128i t = _mm_or_si128(_mm_and_si128(px[i], lo24), _mm_and_si128(_mm_srli_epi64(px[i], 8), mid24));
+        // close the 2-byte gap between the lanes
+        t = _mm_or_si128(_mm_and_si128(t, lo64), _mm_srli_si128(_mm_andnot_si128(lo64, t), 2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i * 12), t);
+    }
+}
+
+// chroma row bytes [c0 c1 c0 c1 ...] -> c0 and c1 each duplicated per pixel pair
+static inline void splitChromaSse2(__m128i uv, __m128i &first, __m128i &second)
+{
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+    const __m128i highByte = _mm_set1_epi16((short)0xFF00);
+    first = _mm_or_si128(_mm_and_si128(uv, lowByte), _mm_slli_epi16(uv, 8));
+    second = _mm_or_si128(_mm_srli_epi16(uv, 8), _mm_and_si128(uv, highByte));
+}
+
+static void nv12RowSse2(const uint8_t *y, const uint8_t *uv, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 18 <= width; x += 16) {
+        __m128i yv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        __m128i u, v, r, g, b;
+        splitChromaSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + x)), u, v);
+        rgb8Sse2(yv, u, v, r, g, b);
+        storeRgbSse2(rgb + x * 3, r, g, b);
+    }
+    nv12RowScalar(y + x, uv + x, rgb + x * 3, width - x);
+}
+
+static void nv21RowSse2(const uint8_t *y, const uint8_t *vu, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 18 <= width; x += 16) {
+        __m128i yv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        __m128i u, v, r, g, b;
+        splitChromaSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(vu + x)), v, u);
+        rgb8Sse2(yv, u, v, r, g, b);
+        storeRgbSse2(rgb + x * 3, r, g, b);
+    }
+    nv21RowScalar(y + x, vu + x, rgb + x * 3, width - x);
+}
+
+// 16 packed 4:2:2 pixels -> luma bytes and NV12-style interleaved chroma
+static inline void unpack422Sse2(const uint8_t *src, bool lumaFirst, __m128i &y, __m128i &uv)
+{
+    const __m128i lowByte = _mm_set1_epi16(0x00FF);
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + 16));
+    __m128i evenBytes = _mm_packus_epi16(_mm_and_si128(a, lowByte), _mm_and_si128(b, lowByte));
+    __m128i oddBytes = _mm_packus_epi16(_mm_srli_epi16(a, 8), _mm_srli_epi16(b, 8));
+    y = lumaFirst ? evenBytes : oddBytes;
+    uv = lumaFirst ? oddBytes : evenBytes;
+}
+
+static void uyvyRowSse2(const uint8_t *src, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 18 <= width; x += 16) {
+        __m128i yv, uv, u, v, r, g, b;
+        unpack422Sse2(src + x * 2, false, yv, uv);
+        splitChromaSse2(uv, u, v);
+        rgb8Sse2(yv, u, v, r, g, b);
+        storeRgbSse2(rgb + x * 3, r, g, b);
+    }
+    uyvyRowScalar(src + x * 2, rgb + x * 3, width - x);
+}
+
+static void yuyvRowSse2(const uint8_t *src, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 18 <= width; x += 16) {
+        __m128i yv, uv, u, v, r, g, b;
+        unpack422Sse2(src + x * 2, true, yv, uv);
+        splitChromaSse2(uv, u, v);
+        rgb8Sse2(yv, u, v, r, g, b);
+        storeRgbSse2(rgb + x * 3, r, g, b);
+    }
+    yuyvRowScalar(src + x * 2, rgb + x * 3, width - x);
+}
+
+static void greyRowSse2(const uint8_t *y, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 18 <= width; x += 16) {
+        __m128i yv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        storeRgbSse2(rgb + x * 3, yv, yv, yv);
+    }
+    greyRowScalar(y + x, rgb + x * 3, width - x);
+}
+
+static const YuvRowKernels s_sse2Kernels = {
+    nv12RowSse2, nv21RowSse2, uyvyRowSse2, yuyvRowSse2, greyRowSse2, "sse2"
+};
+
+// ---------------------------------------------------------------------------
+// AVX2: 16 pixels of arithmetic per instruction, pshufb for the RGB interleave.
+// Compiled with a target attribute so the rest of the build stays baseline.
+// ---------------------------------------------------------------------------
+
+#define OWLET_AVX2 __attribute__((target("avx2")))
+
+OWLET_AVX2 static inline void rgb8Avx2(__m128i y, __m128i u, __m128i v, __m128i &r8, __m128i &g8, __m128i &b8)
+{
+    const __m256i kR = _mm256_set1_epi32(OWLET_PAIR16(298, 409));
+    const __m256i kGcd = _mm256_set1_epi32(OWLET_PAIR16(298, -100));
+    const __m256i kGe = _mm256_set1_epi32(OWLET_PAIR16(-208, 128));
+    const __m256i kB = _mm256_set1_epi32(OWLET_PAIR16(298, 516));
+    const __m256i kRound = _mm256_set1_epi32(128);
+    const __m256i one = _mm256_set1_epi16(1);
+
+    __m256i c = _mm256_sub_epi16(_mm256_cvtepu8_epi16(y), _mm256_set1_epi16(16));
+    __m256i d = _mm256_sub_epi16(_mm256_cvtepu8_epi16(u), _mm256_set1_epi16(128));
+    __m256i e = _mm256_sub_epi16(_mm256_cvtepu8_epi16(v), _mm256_set1_epi16(128));
+
+    // the in-lane unpacks and packs below cancel out, so pixel order is preserved
+    __m256i ceLo = _mm256_unpacklo_epi16(c, e), ceHi = _mm256_unpackhi_epi16(c, e);
+    __m256i cdLo = _mm256_unpacklo_epi16(c, d), cdHi = _mm256_unpackhi_epi16(c, d);
+    __m256i e1Lo = _mm256_unpacklo_epi16(e, one), e1Hi = _mm256_unpackhi_epi16(e, one);
+
+    __m256i r = _mm256_packs_epi32(
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceLo, kR), kRound), 8),
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(ceHi, kR), kRound), 8));
+    __m256i g = _mm256_packs_epi32(
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cdLo, kGcd), _mm256_madd_epi16(e1Lo, kGe)), 8),
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cdHi, kGcd), _mm256_madd_epi16(e1Hi, kGe)), 8));
+    __m256i b = _mm256_packs_epi32(
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cdLo, kB), kRound), 8),
+        _mm256_srai_epi32(_mm256_add_epi32(_mm256_madd_epi16(cdHi, kB), kRound), 8));
+
+    r8 = _mm_packus_epi16(_mm256_castsi256_si128(r), _mm256_extracti128_si256(r, 1));
+    g8 = _mm_packus_epi16(_mm256_castsi256_si128(g), _mm256_extracti128_si256(g, 1));
+    b8 = _mm_packus_epi16(_mm256_castsi256_si128(b), _mm256_extracti128_si256(b, 1));
+}
+
+// 16 pixels -> exactly 48 bytes of RGB888, no spill
+OWLET_AVX2 static inline void storeRgbAvx2(uint8_t *dst, __m128i r, __m128i g, __m128i b)
+{
+    // shuffle masks: output chunk k, byte j takes channel (16k+j)%3 of pixel (16k+j)/3
+    const __m128i r0 = _mm_setr_epi8(0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1, 5);
+    const __m128i g0 = _mm_setr_epi8(-1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1, -1);
+    const __m128i b0 = _mm_setr_epi8(-1, -1, 0, -1, -1, 1, -1, -1, 2, -1, -1, 3, -1, -1, 4, -1);
+    const __m128i r1 = _mm_setr_epi8(-1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10, -1);
+    const __m128i g1 = _mm_setr_epi8(5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1, 10);
+    const __m128i b1 = _mm_setr_epi8(-1, 5, -1, -1, 6, -1, -1, 7, -1, -1, 8, -1, -1, 9, -1, -1);
+    const __m128i r2 = _mm_setr_epi8(-1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1, -1);
+    const __m128i g2 = _mm_setr_epi8(-1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15, -1);
+    const __m128i b2 = _mm_setr_epi8(10, -1, -1, 11, -1, -1, 12, -1, -1, 13, -1, -1, 14, -1, -1, 15);
+
+    __m128i o0 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r0), _mm_shuffle_epi8(g, g0)), _mm_shuffle_epi8(b, b0));
+    __m128i o1 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r1), _mm_shuffle_epi8(g, g1)), _mm_shuffle_epi8(b, b1));
+    __m128i o2 = _mm_or_si128(_mm_or_si128(_mm_shuffle_epi8(r, r2), _mm_shuffle_epi8(g, g2)), _mm_shuffle_epi8(b, b2));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), o0);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 16), o1);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + 32), o2);
+}
+
+OWLET_AVX2 static void nv12RowAvx2(const uint8_t *y, const uint8_t *uv, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i u, v, r, g, b;
+        splitChromaSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(uv + x)), u, v);
+        rgb8Avx2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x)), u, v, r, g, b);
+        storeRgbAvx2(rgb + x * 3, r, g, b);
+    }
+    nv12RowScalar(y + x, uv + x, rgb + x * 3, width - x);
+}
+
+OWLET_AVX2 static void nv21RowAvx2(const uint8_t *y, const uint8_t *vu, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i u, v, r, g, b;
+        splitChromaSse2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(vu + x)), v, u);
+        rgb8Avx2(_mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x)), u, v, r, g, b);
+        storeRgbAvx2(rgb + x * 3, r, g, b);
+    }
+    nv21RowScalar(y + x, vu + x, rgb + x * 3, width - x);
+}
+
+OWLET_AVX2 static void uyvyRowAvx2(const uint8_t *src, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i yv, uv, u, v, r, g, b;
+        unpack422Sse2(src + x * 2, false, yv, uv);
+        splitChromaSse2(uv, u, v);
+        rgb8Avx2(yv, u, v, r, g, b);
+        storeRgbAvx2(rgb + x * 3, r, g, b);
+    }
+    uyvyRowScalar(src + x * 2, rgb + x * 3, width - x);
+}
+
+OWLET_AVX2 static void yuyvRowAvx2(const uint8_t *src, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i yv, uv, u, v, r, g, b;
+        unpack422Sse2(src + x * 2, true, yv, uv);
+        splitChromaSse2(uv, u, v);
+        rgb8Avx2(yv, u, v, r, g, b);
+        storeRgbAvx2(rgb + x * 3, r, g, b);
+    }
+    yuyvRowScalar(src + x * 2, rgb + x * 3, width - x);
+}
+
+OWLET_AVX2 static void greyRowAvx2(const uint8_t *y, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i yv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + x));
+        storeRgbAvx2(rgb + x * 3, yv, yv, yv);
+    }
+    greyRowScalar(y + x, rgb + x * 3, width - x);
+}
+
+static const YuvRowKernels s_avx2Kernels = {
+    nv12RowAvx2, nv21RowAvx2, uyvyRowAvx2, yuyvRowAvx2, greyRowAvx2, "avx2"
+};
+
+#endif // OWLET_HAVE_X86
+
+#ifdef OWLET_HAVE_NEON
+
+// ---------------------------------------------------------------------------
+// NEON (baseline on aarch64, and on armv7 builds with -mfpu=neon)
+// ---------------------------------------------------------------------------
+
+// 8 pixels; vrshrn_n_s32(x, 8) is (x + 128) >> 8, the rounding term of the formula
+static inline void rgb8Neon(uint8x8_t y, uint8x8_t u, uint8x8_t v, uint8x8_t &r, uint8x8_t &g, uint8x8_t &b)
+{
+    int16x8_t c = vreinterpretq_s16_u16(vsubl_u8(y, vdup_n_u8(16)));
+    int16x8_t d = vreinterpretq_s16_u16(vsubl_u8(u, vdup_n_u8(128)));
+    int16x8_t e = vreinterpretq_s16_u16(vsubl_u8(v, vdup_n_u8(128)));
+
+    int32x4_t cLo = vmull_n_s16(vget_low_s16(c), 298);
+    int32x4_t cHi = vmull_n_s16(vget_high_s16(c), 298);
+
+    int32x4_t rLo = vmlal_n_s16(cLo, vget_low_s16(e), 409);
+    int32x4_t rHi = vmlal_n_s16(cHi, vget_high_s16(e), 409);
+    int32x4_t gLo = vmlal_n_s16(vmlal_n_s16(cLo, vget_low_s16(d), -100), vget_low_s16(e), -208);
+    int32x4_t gHi = vmlal_n_s16(vmlal_n_s16(cHi, vget_high_s16(d), -100), vget_high_s16(e), -208);
+    int32x4_t bLo = vmlal_n_s16(cLo, vget_low_s16(d), 516);
+    int32x4_t bHi = vmlal_n_s16(cHi, vget_high_s16(d), 516);
+
+    r = vqmovun_s16(vcombine_s16(vrshrn_n_s32(rLo, 8), vrshrn_n_s32(rHi, 8)));
+    g = vqmovun_s16(vcombine_s16(vrshrn_n_s32(gLo, 8), vrshrn_n_s32(gHi, 8)));
+    b = vqmovun_s16(vcombine_s16(vrshrn_n_s32(bLo, 8), vrshrn_n_s32(bHi, 8)));
+}
+
+// 16 pixels from luma + one chroma sample per pixel pair
+static inline void convertStoreNeon(uint8x16_t y, uint8x8_t u, uint8x8_t v, uint8_t *dst)
+{
+    uint8x8x2_t uu = vzip_u8(u, u);
+    uint8x8x2_t vv = vzip_u8(v, v);
+    uint8x8_t rl, gl, bl, rh, gh, bh;
+    rgb8Neon(vget_low_u8(y), uu.val[0], vv.val[0], rl, gl, bl);
+    rgb8Neon(vget_high_u8(y), uu.val[1], vv.val[1], rh, gh, bh);
+    uint8x16x3_t out;
+    out.val[0] = vcombine_u8(rl, rh);
+    out.val[1] = vcombine_u8(gl, gh);
+    out.val[2] = vcombine_u8(bl, bh);
+    vst3q_u8(dst, out);
+}
+
+static void nv12RowNeon(const uint8_t *y, const uint8_t *uv, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x8x2_t c = vld2_u8(uv + x);
+        convertStoreNeon(vld1q_u8(y + x), c.val[0], c.val[1], rgb + x * 3);
+    }
+    nv12RowScalar(y + x, uv + x, rgb + x * 3, width - x);
+}
+
+static void nv21RowNeon(const uint8_t *y, const uint8_t *vu, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x8x2_t c = vld2_u8(vu + x);
+        convertStoreNeon(vld1q_u8(y + x), c.val[1], c.val[0], rgb + x * 3);
+    }
+    nv21RowScalar(y + x, vu + x, rgb + x * 3, width - x);
+}
+
+static void uyvyRowNeon(const uint8_t *src, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x8x4_t p = vld4_u8(src + x * 2); // U Y0 V Y1
+        uint8x8x2_t yy = vzip_u8(p.val[1], p.val[3]);
+        convertStoreNeon(vcombine_u8(yy.val[0], yy.val[1]), p.val[0], p.val[2], rgb + x * 3);
+    }
+    uyvyRowScalar(src + x * 2, rgb + x * 3, width - x);
+}
+
+static void yuyvRowNeon(const uint8_t *src, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x8x4_t p = vld4_u8(src + x * 2); // Y0 U Y1 V
+        uint8x8x2_t yy = vzip_u8(p.val[0], p.val[2]);
+        convertStoreNeon(vcombine_u8(yy.val[0], yy.val[1]), p.val[1], p.val[3], rgb + x * 3);
+    }
+    yuyvRowScalar(src + x * 2, rgb + x * 3, width - x);
+}
+
+static void greyRowNeon(const uint8_t *y, uint8_t *rgb, int width)
+{
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        uint8x16x3_t out;
+        out.val[0] = out.val[1] = out.val[2] = vld1q_u8(y + x);
+        vst3q_u8(rgb + x * 3, out);
+    }
+    greyRowScalar(y + x, rgb + x * 3, width - x);
+}
+
+static const YuvRowKernels s_neonKernels = {
+    nv12RowNeon, nv21RowNeon, uyvyRowNeon, yuyvRowNeon, greyRowNeon, "neon"
+};
+
+#endif // OWLET_HAVE_NEON
+
+// ---------------------------------------------------------------------------
+// LUT kernels: a table lookup per pixel does not vectorize profitably, so
+// these stay scalar but write each pixel with a single 4-byte store; the
+// stray fourth byte is overwritten by the next pixel.
+// ---------------------------------------------------------------------------
+
+static inline void lutStoreRow(const uint8_t *luma, int step, const uint32_t *lut, uint8_t *rgb, int width)
+{
+    if (width <= 0) return;
+    int col = 0;
+    for (; col + 1 < width; ++col) {
+        memcpy(rgb + col * 3, &lut[luma[col * step]], 4);
+    }
+    // last pixel: exactly 3 bytes so nothing past the row is touched
+    memcpy(rgb + col * 3, &lut[luma[col * step]], 3);
+}
+
+void lutRowPlanar(const uint8_t *y, const uint32_t *lut, uint8_t *rgb, int width)
+{
+    lutStoreRow(y, 1, lut, rgb, width);
+}
+
+void lutRowPacked(const uint8_t *src, int lumaOffset, const uint32_t *lut, uint8_t *rgb, int width)
+{
+    lutStoreRow(src + lumaOffset, 2, lut, rgb, width);
+}
+
+void curveRowPlanar(const uint8_t *y, const uint8_t *curve, uint8_t *out, int width)
+{
+    for (int col = 0; col < width; ++col) out[col] = curve[y[col]];
+}
+
+void curveRowPacked(const uint8_t *src, int lumaOffset, const uint8_t *curve, uint8_t *out, int width)
+{
+    const int bytes = width * 2;
+    for (int i = 0; i < bytes; i += 2) {
+        out[i + lumaOffset] = curve[src[i + lumaOffset]];
+        out[i + 1 - lumaOffset] = src[i + 1 - lumaOffset];
+    }
+}
+
+// ---------------------------------------------------------------------------
+// runtime selection
+// ---------------------------------------------------------------------------
+
+static const YuvRowKernels &selectKernels()
+{
+    const char *force = getenv("OWLET_YUV_KERNELS");
+    if (force && strcmp(force, "scalar") == 0) return s_scalarKernels;
+#ifdef OWLET_HAVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return s_avx2Kernels;
+    if (__builtin_cpu_supports("sse2")) return s_sse2Kernels;
+#endif
+#ifdef OWLET_HAVE_NEON
+    return s_neonKernels;
+#endif
+    return s_scalarKernels;
+}
+
+const YuvRowKernels &scalarYuvRowKernels()
+{
+    return s_scalarKernels;
+}
+
+int availableYuvRowKernels(const YuvRowKernels **sets, int max)
+{
+    int n = 0;
+    if (n < max) sets[n++] = &s_scalarKernels;
+#ifdef OWLET_HAVE_X86
+    __builtin_cpu_init();
+    if (n < max && __builtin_cpu_supports("sse2")) sets[n++] = &s_sse2Kernels;
+    if (n < max && __builtin_cpu_supports("avx2")) sets[n++] = &s_avx2Kernels;
+#endif
+#ifdef OWLET_HAVE_NEON
+    if (n < max) sets[n++] = &s_neonKernels;
+#endif
+    return n;
+}
+
+const YuvRowKernels &yuvRowKernels()
+{
+    static const YuvRowKernels &kernels = selectKernels();
+    return kernels;
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstdint>
+
+// Row conversion kernels: each call converts one row of source pixels into
+// packed RGB888. All kernel sets produce output bit-identical to the scalar one.
+struct YuvRowKernels
+{
+    // y: luma row, uv: interleaved chroma row (U first for NV12, V first for NV21)
+    void (*nv12)(const uint8_t *y, const uint8_t *uv, uint8_t *rgb, int width);
+    void (*nv21)(const uint8_t *y, const uint8_t *vu, uint8_t *rgb, int width);
+    // src: packed 4:2:2 row, 2 bytes per pixel
+    void (*uyvy)(const uint8_t *src, uint8_t *rgb, int width);
+    void (*yuyv)(const uint8_t *src, uint8_t *rgb, int width);
+    // y: 8-bit luma row, replicated into R, G and B
+    void (*grey)(const uint8_t *y, uint8_t *rgb, int width);
+    const char *name;
+};
+
+// plain C++ reference implementation, always available
+const YuvRowKernels &scalarYuvRowKernels();
+
+// fastest kernel set supported by the running CPU, picked once on first use.
+// OWLET_YUV_KERNELS=scalar in the environment forces the reference kernels.
+const YuvRowKernels &yuvRowKernels();
+
+// every kernel set the running CPU can execute, scalar first; for
+// benchmarks and cross-checks. Returns the number written to sets (at most max).
+int availableYuvRowKernels(const YuvRowKernels **sets, int max);
+
+// Luma -> RGB through a 256-entry table whose entries are R, G, B, 0 bytes in
+// memory order (see palette.h). Planar: one luma byte per pixel. Packed:
+// 4:2:2 row with luma at byte lumaOffset of every pixel pair half (0 for
+// YUYV, 1 for UYVY).
+void lutRowPlanar(const uint8_t *y, const uint32_t *lut, uint8_t *rgb, int width);
+void lutRowPacked(const uint8_t *src, int lumaOffset, const uint32_t *lut, uint8_t *rgb, int width);
+
+// Luma -> luma through a 256-entry curve, chroma untouched, so a colour
+// kernel can run on the result. Planar: width luma bytes. Packed: a 4:2:2
+// row of width pixels is copied with its luma bytes mapped.
+void curveRowPlanar(const uint8_t *y, const uint8_t *curve, uint8_t *out, int width);
+void curveRowPacked(const uint8_t *src, int lumaOffset, const uint8_t *curve, uint8_t *out, int width);
@@ -0,0 +1,226 @@
+#include "yuvnode.h"
+#include "framestats.h"
+
+#ifdef OWLET_HAVE_YUV_NODE
+
+#include <QSGMaterial>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLShaderProgram>
+#include <linux/videodev2.h>
+
+// y = 298/256 * (Y - 16/255), u = U - 128/255, v = V - 128/255; the rest are
+// the integer coefficients of yuvToRgbPixel() divided by 256
+#define OWLET_YUV_FRAGMENT(Y, U, V) \
+    "uniform sampler2D yTex;\n" \
+    "uniform sampler2D cTex;\n" \
+    "uniform lowp float qt_Opacity;\n" \
+    "varying highp vec2 vTex;\n" \
+    "void main() {\n" \
+    "    highp float y = 1.1640625 * (texture2D(yTex, vTex)." Y " - 0.0627451);\n" \
+    "    highp vec4 c = texture2D(cTex, vTex);\n" \
+    "    highp float u = c." U " - 0.5019608;\n" \
+    "    highp float v = c." V " - 0.5019608;\n" \
+    "    gl_FragColor = vec4(y + 1.59765625 * v,\n" \
+    "                        y - 0.390625 * u - 0.8125 * v,\n" \
+    "                        y + 2.015625 * u, 1.0) * qt_Opacity;\n" \
+    "}\n"
+
+// Texture layouts:
+//  NV12/NV21: yTex LUMINANCE w x h, cTex LUMINANCE_ALPHA w/2 x h/2 (L = 1st byte, A = 2nd)
+//  YUYV/UYVY: yTex LUMINANCE_ALPHA w x h (one texel per pixel: luma + one chroma byte),
+//             cTex RGBA w/2 x h (one texel per macropixel) over the same plane
+enum YuvLayout { LayoutNV12, LayoutNV21, LayoutYUYV, LayoutUYVY, LayoutCount };
+
+static const char *const s_fragmentShaders[LayoutCount] = {
+    OWLET_YUV_FRAGMENT("r", "r", "a"), // NV12: U V
+    OWLET_YUV_FRAGMENT("r", "a", "r"), // NV21: V U
+    OWLET_YUV_FRAGMENT("r", "g", "a"), // YUYV: Y0 U Y1 V
+    OWLET_YUV_FRAGMENT("a", "r", "b"), // UYVY: U Y0 V Y1
+};
+
+static const char s_vertexShader[] =
+    "attribute highp vec4 aVertex;\n"
+    "attribute highp vec2 aTexCoord;\n"
+    "uniform highp mat4 qt_Matrix;\n"
+    "varying highp vec2 vTex;\n"
+    "void main() {\n"
+    "    gl_Position = qt_Matrix * aVertex;\n"
+    "    vTex = aTexCoord;\n"
+    "}\n";
+
+static int layoutFor(uint32_t pixelFormat)
+{
+    switch (pixelFormat) {
+    case V4L2_PIX_FMT_NV12: return LayoutNV12;
+    case V4L2_PIX_FMT_NV21: return LayoutNV21;
+    case V4L2_PIX_FMT_YUYV: return LayoutYUYV;
+    case V4L2_PIX_FMT_UYVY: return LayoutUYVY;
+    default: return -1;
+    }
+}
+
+class YuvMaterial : public QSGMaterial
+{
+public:
+    ~YuvMaterial() override
+    {
+        QOpenGLContext *ctx = QOpenGLContext::currentContext();
+        if (ctx && m_textures[0]) ctx->functions()->glDeleteTextures(2, m_textures);
+    }
+
+    QSGMaterialType *type() const override
+    {
+        static QSGMaterialType types[LayoutCount];
+        return &types[m_layout];
+    }
+    QSGMaterialShader *createShader() const override;
+
+    void setFrame(const RawFrameRef &frame, FrameStats *stats, const FrameTiming &timing)
+    {
+        m_pending = frame;
+        m_layout = layoutFor(frame->pixelFormat);
+        m_stats = stats;
+        m_timing = timing;
+    }
+
+    // render thread, GL context current: binds both textures and uploads a
+    // pending frame into them, then lets go of the driver buffer
+    void bindTextures(QOpenGLFunctions *gl)
+    {
+        if (!m_textures[0]) {
+            gl->glGenTextures(2, m_textures);
+            for (int i = 0; i < 2; ++i) {
+                gl->glBindTexture(GL_TEXTURE_2D, m_textures[i]);
+                gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+                gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+                gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+                gl->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+            }
+        }
+
+        const RawFrame *f = m_pending.get();
+        gl->glActiveTexture(GL_TEXTURE1);
+        gl->glBindTexture(GL_TEXTURE_2D, m_textures[1]);
+        if (f) {
+            gl->glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+            if (m_layout == LayoutNV12 || m_layout == LayoutNV21) {
+                upload(gl, 1, GL_LUMINANCE_ALPHA, f->width / 2, f->height / 2, 2, f->planes[1]);
+            } else {
+                upload(gl, 1, GL_RGBA, f->width / 2, f->height, 4, f->planes[0]);
+            }
+        }
+        gl->glActiveTexture(GL_TEXTURE0);
+        gl->glBindTexture(GL_TEXTURE_2D, m_textures[0]);
+        if (f) {
+            if (m_layout == LayoutNV12 || m_layout == LayoutNV21) {
+                upload(gl, 0, GL_LUMINANCE, f->width, f->height, 1, f->planes[0]);
+            } else {
+                upload(gl, 0, GL_LUMINANCE_ALPHA, f->width, f->height, 2, f->planes[0]);
+            }
+            gl->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+            // glTexSubImage2D has copied the data; the buffer can go back to the driver
+            m_pending.reset();
+            if (m_stats) m_stats->recordDisplay(m_timing, monotonicNs());
+            m_stats = nullptr;
+        }
+    }
+
+private:
+    void upload(QOpenGLFunctions *gl, int tex, GLenum format, int w, int h, int bytesPerTexel,
+                const RawFrame::Plane &plane)
+    {
+        if (m_allocated[tex] != QSize(w, h)) {
+            gl->glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, nullptr);
+            m_allocated[tex] = QSize(w, h);
+        }
+        if (plane.bytesPerLine == w * bytesPerTexel) {
+            gl->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, w, h, format, GL_UNSIGNED_BYTE, plane.data);
+        } else {
+            for (int y = 0; y < h; ++y) {
+                gl->glTexSubImage2D(GL_TEXTURE_2D, 0, 0, y, w, 1, format, GL_UNSIGNED_BYTE,
+                                    plane.data + y * plane.bytesPerLine);
+            }
+        }
+    }
+
+    int m_layout{LayoutNV12};
+    RawFrameRef m_pending;
+    FrameStats *m_stats{nullptr};
+    FrameTiming m_timing;
+    GLuint m_textures[2] = {0, 0};
+    QSize m_allocated[2];
+};
+
+class YuvShader : public QSGMaterialShader
+{
+public:
+    explicit YuvShader(int layout) : m_layout(layout) {}
+
+    const char *vertexShader() const override { return s_vertexShader; }
+    const char *fragmentShader() const override { return s_fragmentShaders[m_layout]; }
+
+    char const *const *attributeNames() const override
+    {
+        static const char *const names[] = { "aVertex", "aTexCoord", nullptr };
+        return names;
+    }
+
+    void initialize() override
+    {
+        m_matrixLoc = program()->uniformLocation("qt_Matrix");
+        m_opacityLoc = program()->uniformLocation("qt_Opacity");
+        m_yTexLoc = program()->uniformLocation("yTex");
+        m_cTexLoc = program()->uniformLocation("cTex");
+    }
+
+    void updateState(const RenderState &state, QSGMaterial *newMaterial, QSGMaterial *oldMaterial) override
+    {
+        Q_UNUSED(oldMaterial)
+        if (state.isMatrixDirty()) program()->setUniformValue(m_matrixLoc, state.combinedMatrix());
+        if (state.isOpacityDirty()) program()->setUniformValue(m_opacityLoc, state.opacity());
+        program()->setUniformValue(m_yTexLoc, 0);
+        program()->setUniformValue(m_cTexLoc, 1);
+        static_cast<YuvMaterial*>(newMaterial)->bindTextures(QOpenGLContext::currentContext()->functions());
+    }
+
+private:
+    int m_layout;
+    int m_matrixLoc{-1};
+    int m_opacityLoc{-1};
+    int m_yTexLoc{-1};
+    int m_cTexLoc{-1};
+};
+
+QSGMaterialShader *YuvMaterial::createShader() const
+{
+    return new YuvShader(m_layout);
+}
+
+YuvNode::YuvNode()
+    : m_geometry(QSGGeometry::defaultAttributes_TexturedPoint2D(), 4)
+    , m_material(new YuvMaterial)
+{
+    setGeometry(&m_geometry);
+    setMaterial(m_material);
+    setFlag(OwnsMaterial);
+}
+
+bool YuvNode::supports(uint32_t pixelFormat)
+{
+    return layoutFor(pixelFormat) >= 0;
+}
+
+void YuvNode::setFrame(const RawFrameRef &frame, FrameStats *stats, const FrameTiming &timing)
+{
+    m_material->setFrame(frame, stats, timing);
+    markDirty(DirtyMaterial);
+}
+
+void YuvNode::setRects(const QRectF &target, const QRectF &normalizedSource)
+{
+    QSGGeometry::updateTexturedRectGeometry(&m_geometry, target, normalizedSource);
+    markDirty(DirtyGeometry);
+}
+
+#endif // OWLET_HAVE_YUV_NODE
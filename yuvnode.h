@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QSGGeometryNode>
+#include <QSGGeometry>
+
+#include "videoframe.h"
+
+class FrameStats;
+
+#if QT_VERSION < QT_VERSION_CHECK(6, 0, 0)
+#define OWLET_HAVE_YUV_NODE 1
+
+class YuvMaterial;
+
+// Draws a raw NV12/NV21/UYVY/YUYV frame with an OpenGL shader: the planes are
+// uploaded unchanged into persistent textures and the fragment shader applies
+// the same BT.601 coefficients as the CPU kernels. The driver buffer is held
+// only until its planes have been uploaded on the render thread.
+class YuvNode : public QSGGeometryNode
+{
+public:
+    YuvNode();
+
+    static bool supports(uint32_t pixelFormat);
+
+    // the upload of the frame is recorded into stats, if given
+    void setFrame(const RawFrameRef &frame, FrameStats *stats = nullptr,
+                  const FrameTiming &timing = FrameTiming());
+    // target in item coordinates, source normalized to [0,1]
+    void setRects(const QRectF &target, const QRectF &normalizedSource);
+
+private:
+    QSGGeometry m_geometry;
+    YuvMaterial *m_material;
+};
+
+#endif